@@ -0,0 +1,78 @@
+/*
+ * This file is part of the yadi.cpp project.
+ *
+ * Copyright (C) 2017 Paulo Faco <paulofaco@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef YADI_DLMS_ARENA_H
+#define YADI_DLMS_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace dlms
+{
+
+/**
+ * Bump allocator for data that dies all at once, e.g. the values decoded from one response. Memory
+ * is taken from blocks that are only released when the arena is destroyed; reset() makes all of it
+ * available again without freeing, so an arena reused from one response to the next stops allocating
+ * once its blocks are large enough. Only trivially destructible objects belong in an arena.
+ */
+class Arena {
+public:
+    explicit Arena(size_t block_size = 64 * 1024);
+    Arena(Arena const&) = delete;
+    Arena& operator=(Arena const&) = delete;
+    Arena(Arena &&rhs) = default;
+    Arena& operator=(Arena &&rhs) = default;
+
+    auto allocate(size_t size, size_t alignment = alignof(std::max_align_t)) -> void*;
+
+    template<typename T>
+    auto allocate(size_t count) -> T* {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    /**
+     * Invalidates everything allocated so far and keeps the blocks for the next allocations
+     */
+    void reset();
+
+    /**
+     * @return bytes held by the blocks of the arena
+     */
+    auto capacity() const -> size_t;
+
+private:
+    struct Block {
+        std::unique_ptr<uint8_t[]> data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks_;
+    size_t current_ = 0; ///< block allocations are taken from
+    size_t used_ = 0;    ///< bytes taken from the current block
+    size_t block_size_;
+};
+
+}
+
+#endif //YADI_DLMS_ARENA_H
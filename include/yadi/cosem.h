@@ -26,6 +26,11 @@
 #include <array>
 #include <cstdint>
 #include <memory>
+#include <string>
+#include <functional>
+#include <initializer_list>
+#include <stdexcept>
+#include <yadi/gcm.h>
 
 namespace dlms
 {
@@ -80,40 +85,193 @@ enum class ClassID : uint16_t {
     ASSOCIATION_LN = 15,
 };
 
+class InvocationCounterStore;
+
 struct CosemParameters {
     CosemParameters() = default;
     CosemParameters(CosemParameters &&rhs) = default;
     AuthenticationMechanism authentication = AuthenticationMechanism::LOWEST;
     SecurityContext security = SecurityContext::NONE;
     std::array<uint8_t,8> system_title{0};
-    std::array<uint8_t,8> secret{0};
+    std::vector<uint8_t> secret; ///< LLS password, or HLS secret
     std::array<uint8_t,16> ak{0};
     std::array<uint8_t,16> guek{0};
     unsigned challenger_size = 8;
+    bool dedicated_key = false; ///< cipher with a fresh dedicated key sent in the AARQ, instead of the global key
+    uint8_t gbt_window_size = 0; ///< window proposed for general-block-transfer, 0 disables it
+    unsigned max_pending_requests = 1; ///< confirmed requests that may be outstanding at once, up to 16
+    InvocationCounterStore *invocation_counters = nullptr; ///< shared store of the client invocation counters, if any
+    uint32_t invocation_counter_range = 256; ///< counters reserved from the store at a time
+};
+
+/**
+ * State of a general-block-transfer (GBT) exchange. Block numbers are reset
+ * at the start of each confirmed service.
+ */
+struct GbtContext {
+    uint16_t block_number = 0;          ///< last block number sent by the client
+    uint16_t block_number_ack = 0;      ///< last block received in sequence from the server
+    uint16_t peer_block_number_ack = 0; ///< last client block acknowledged by the server
+    uint8_t peer_window = 1;            ///< window size announced by the server
 };
 
 struct CosemContext {
     CosemContext() = default;
     CosemContext(CosemContext &&rhs) = default;
     uint16_t max_pdu_size = 0xFFFF;
-    uint32_t invocation_counter = 0;
+    uint32_t invocation_counter = 0; ///< invocation counter of the next ciphered APDU
+    uint32_t invocation_counter_end = 0; ///< end of the range reserved from the counter store
     std::array<uint8_t,8> client_system_title{0};
-    std::array<uint8_t,16> dek[16]; //dedicated encryption key
+    std::array<uint8_t,8> server_system_title{0};
+    std::vector<uint8_t> client_challenger; ///< CtoS, sent in the AARQ
+    std::vector<uint8_t> server_challenger; ///< StoC, received in the AARE
+    std::array<uint8_t,16> dek{0}; //dedicated encryption key
+    Gcm glo_cipher; ///< global unicast key schedule, expanded once per association
+    Gcm ded_cipher; ///< dedicated key schedule, expanded once per association
+    GbtContext gbt;
+    uint8_t invoke_id = 1;             ///< invoke-id of the next request
+    uint16_t pending_invoke_ids = 0;   ///< one bit per invoke-id waiting for its response
 };
 
+/**
+ * OBIS code of a COSEM object, held as its 6 value groups. It is a trivially copyable value type,
+ * compared and hashed as a single 48-bit integer.
+ *
+ * Codes are parsed from the dotted notation "A.B.C.D.E.F", each group a decimal from 0 to 255. The
+ * parser is constexpr, so a malformed code in a constant expression, e.g. "1.0.1.8.0.256"_obis bound
+ * to a constexpr variable, fails to compile. At run time it throws std::runtime_error.
+ */
 class LogicalName {
 public:
+    constexpr LogicalName() : LogicalName{0, Packed{}} {}
+    constexpr LogicalName(const char *str) : LogicalName{parse(str, length(str)), Packed{}} {}
     LogicalName(std::string const& str);
-    LogicalName(std::initializer_list<uint8_t> const& initializer_list);
-    LogicalName(const LogicalName &rhs);
-    ~LogicalName();
-    std::array<uint8_t,6>::const_iterator begin() const;
-    std::array<uint8_t,6>::const_iterator end() const;
+    constexpr LogicalName(std::initializer_list<uint8_t> initializer_list) :
+        LogicalName{pack(initializer_list), Packed{}} {}
+
+    std::array<uint8_t,6>::const_iterator begin() const { return value_.begin(); }
+    std::array<uint8_t,6>::const_iterator end() const { return value_.end(); }
+    constexpr auto operator[](size_t group) const -> uint8_t { return value_[group]; }
+
+    /**
+     * @return the value groups as a 48-bit integer, A in the most significant byte
+     */
+    constexpr auto value() const -> uint64_t {
+        return uint64_t{value_[0]} << 40U | uint64_t{value_[1]} << 32U | uint64_t{value_[2]} << 24U |
+               uint64_t{value_[3]} << 16U | uint64_t{value_[4]} << 8U | uint64_t{value_[5]};
+    }
+
+    /**
+     * Parses the dotted notation of an OBIS code
+     * @return the value groups as a 48-bit integer
+     * @throw std::runtime_error if str is not six groups from 0 to 255 separated by dots
+     */
+    static constexpr auto parse(const char *str, size_t size) -> uint64_t {
+        uint64_t value = 0;
+        size_t groups = 0;
+        size_t i = 0;
+        while (true) {
+            unsigned group = 0;
+            size_t digits = 0;
+            for (; i < size && str[i] >= '0' && str[i] <= '9'; ++i, ++digits) {
+                group = 10 * group + static_cast<unsigned>(str[i] - '0');
+                if (group > 255) {
+                    throw std::runtime_error{"logical name group out of range"};
+                }
+            }
+            if (digits == 0) {
+                throw std::runtime_error{"logical name group must be a number"};
+            }
+            value = value << 8U | group;
+            if (++groups == 6 || i == size || str[i] != '.') {
+                break;
+            }
+            ++i;
+        }
+        if (groups != 6 || i != size) {
+            throw std::runtime_error{"logical name must be 6 groups separated by dots"};
+        }
+        return value;
+    }
+
+    /**
+     * @param value the value groups as a 48-bit integer, see value()
+     */
+    static constexpr auto from_value(uint64_t value) -> LogicalName {
+        return LogicalName{value, Packed{}};
+    }
+
+    friend constexpr bool operator==(LogicalName const& lhs, LogicalName const& rhs) { return lhs.value() == rhs.value(); }
+    friend constexpr bool operator!=(LogicalName const& lhs, LogicalName const& rhs) { return lhs.value() != rhs.value(); }
+    friend constexpr bool operator<(LogicalName const& lhs, LogicalName const& rhs) { return lhs.value() < rhs.value(); }
+
 private:
-    class impl;
-    std::unique_ptr<impl> pimpl_;
+    struct Packed {};
+
+    constexpr LogicalName(uint64_t value, Packed) :
+        value_{{static_cast<uint8_t>(value >> 40U), static_cast<uint8_t>(value >> 32U), static_cast<uint8_t>(value >> 24U),
+                static_cast<uint8_t>(value >> 16U), static_cast<uint8_t>(value >> 8U), static_cast<uint8_t>(value)}} {}
+
+    static constexpr auto length(const char *str) -> size_t {
+        size_t size = 0;
+        while (str[size] != '\0') {
+            ++size;
+        }
+        return size;
+    }
+
+    static constexpr auto pack(std::initializer_list<uint8_t> initializer_list) -> uint64_t {
+        if (initializer_list.size() != 6) {
+            throw std::runtime_error{"logical name must be 6 bytes long"};
+        }
+        uint64_t value = 0;
+        for (auto group : initializer_list) {
+            value = value << 8U | group;
+        }
+        return value;
+    }
+
+    std::array<uint8_t,6> value_;
+};
+
+inline namespace literals {
+
+/**
+ * OBIS code literal, e.g. "1.0.1.8.0.255"_obis
+ */
+constexpr auto operator"" _obis(const char *str, size_t size) -> LogicalName {
+    return LogicalName::from_value(LogicalName::parse(str, size));
+}
+
+}
+
+enum class ObisNotation {
+    DOTTED, ///< "1.0.1.8.0.255"
+    OBIS,   ///< "1-0:1.8.0*255"
+};
+
+struct LogicalNameError {
+    size_t line;        ///< 1-based
+    const char *reason;
 };
 
+/**
+ * Parses a buffer of OBIS codes, one per line, e.g. a column of an object list exported as CSV.
+ * Each line holds a code in either notation, with groups of at most 3 digits, and may end in "\r\n".
+ * Blank lines are skipped. Digits are classified 16 bytes at a time where SSE2 is available.
+ * @param names parsed codes are appended to it, in order
+ * @return one error per malformed line; the line is left out of names
+ */
+auto parse_logical_names(const char *text, size_t size, std::vector<LogicalName> &names) -> std::vector<LogicalNameError>;
+
+/**
+ * Appends the codes to text, one per line, each followed by '\n'
+ */
+void format_logical_names(LogicalName const *names, size_t count, std::string &text,
+                          ObisNotation notation = ObisNotation::DOTTED);
+
+auto to_string(LogicalName const& logical_name, ObisNotation notation = ObisNotation::DOTTED) -> std::string;
+
 struct Request {
     ClassID class_id;
     LogicalName logical_name;
@@ -124,6 +282,7 @@ struct Request {
 struct Response {
     DataAccessResult result;
     std::vector<uint8_t> data;
+    uint8_t invoke_id = 0;
 };
 
 struct Cosem {
@@ -131,6 +290,51 @@ struct Cosem {
     CosemParameters parameters;
 };
 
+enum class RequestType : uint8_t {
+    GET,
+    SET,
+    ACTION,
+};
+
+/**
+ * A request serialized once and framed for many associations, e.g. the same readout sent to every meter.
+ * Framing copies the serialized APDU and only stores what changes per request: the invoke-id, the declared
+ * fields of the request data and, in secured associations, the ciphering header and tag.
+ */
+class RequestTemplate {
+public:
+    RequestTemplate(RequestType type, Request const& request);
+
+    /**
+     * Declares a field of Request::data that changes from one request to the next, e.g. the from and to
+     * date-time of a range descriptor.
+     * @param offset position of the field in Request::data
+     * @return the position of the field among the values given to serialize
+     */
+    auto add_field(size_t offset, size_t size) -> size_t;
+
+    /**
+     * Frames the request for an association into apdu, reusing its capacity
+     * @param values one pointer per declared field, to the new bytes of the field
+     */
+    void serialize(Cosem &cosem, std::vector<uint8_t> &apdu, std::initializer_list<const uint8_t*> values = {}) const;
+    auto serialize(Cosem &cosem, std::initializer_list<const uint8_t*> values = {}) const -> std::vector<uint8_t>;
+
+private:
+    struct Field {
+        size_t offset;
+        size_t size;
+    };
+
+    std::vector<uint8_t> plain_; ///< plain APDU, with invoke-id 0
+    std::vector<Field> fields_;
+    uint8_t glo_tag_ = 0;
+    uint8_t ded_tag_ = 0;
+};
+
+auto allocate_invoke_id(Cosem &cosem) -> uint8_t;
+void release_invoke_id(Cosem &cosem, uint8_t invoke_id);
+
 auto serialize_aarq(Cosem &cosem) -> std::vector<uint8_t>;
 auto serialize_get_request(Cosem &cosem, const Request& req) -> std::vector<uint8_t>;
 auto serialize_set_request(Cosem &cosem, const Request& req) -> std::vector<uint8_t>;
@@ -138,6 +342,57 @@ auto serialize_action_request(Cosem &cosem, const Request& req) -> std::vector<u
 
 auto parse_aare(Cosem &cosem, const std::vector<uint8_t>& data) -> AssociationResult;
 auto parse_get_response(Cosem &cosem, const std::vector<uint8_t>& data) -> Response;
+auto parse_set_response(Cosem &cosem, const std::vector<uint8_t>& data) -> Response;
+auto parse_action_response(Cosem &cosem, const std::vector<uint8_t>& data) -> Response;
+
+auto serialize_reply_to_hls_authentication(Cosem &cosem) -> std::vector<uint8_t>;
+auto serialize_reply_to_hls_authentication(std::vector<Cosem*> const& sessions) -> std::vector<std::vector<uint8_t>>;
+auto parse_reply_to_hls_authentication(Cosem &cosem, const std::vector<uint8_t>& data) -> bool;
+
+enum class GbtStatus {
+    RECEIVING,          ///< more blocks of the current window are expected
+    WINDOW_COMPLETE,    ///< the window ended (or a block was lost), an acknowledgement must be sent
+    LAST_BLOCK          ///< the last block was received, the transfer is complete
+};
+
+/**
+ * Receives the block data of a transfer, in order, as soon as it arrives.
+ */
+using BlockConsumer = std::function<void(const uint8_t *data, size_t size)>;
+
+auto is_gbt(const std::vector<uint8_t>& data) -> bool;
+auto gbt_block_count(Cosem const& cosem, const std::vector<uint8_t>& apdu) -> size_t;
+auto serialize_gbt(Cosem &cosem, const std::vector<uint8_t>& apdu, size_t first) -> std::vector<std::vector<uint8_t>>;
+auto serialize_gbt_ack(Cosem &cosem) -> std::vector<uint8_t>;
+auto parse_gbt(Cosem &cosem, const std::vector<uint8_t>& data, BlockConsumer const& consumer) -> GbtStatus;
+
+/**
+ * Receives a Get-Response-Normal block by block and hands the consumer only the encoded Data it carries,
+ * without the invoke-id and result header, so the Data can be decoded as it arrives. A ciphered response
+ * cannot be trusted before its tag is checked: it is kept until finish() deciphers it, and its Data then
+ * reaches the consumer in one piece.
+ */
+class GetResponseStream {
+public:
+    GetResponseStream(Cosem &cosem, BlockConsumer consumer);
+
+    void operator()(const uint8_t *data, size_t size);
+
+    /**
+     * Ends the response once its last block was received
+     * @return the result of the response; its data holds what follows a result other than success
+     * @throw InvalidCosemFrame if the response is not a Get-Response-Normal or ends in its header
+     * @throw CosemAuthenticationError if a ciphered response fails authentication
+     */
+    auto finish() -> Response;
+
+private:
+    Cosem &cosem_;
+    BlockConsumer consumer_;
+    std::vector<uint8_t> header_;
+    std::vector<uint8_t> result_;
+    std::vector<uint8_t> ciphered_;
+};
 
 struct InvalidCosemFrame : public std::exception {
     const char* what() const noexcept override {
@@ -145,6 +400,24 @@ struct InvalidCosemFrame : public std::exception {
     }
 };
 
+struct CosemAuthenticationError : public std::exception {
+    const char* what() const noexcept override {
+        return "cosem authentication failure";
+    }
+};
+
+}
+
+namespace std
+{
+
+template<>
+struct hash<dlms::LogicalName> {
+    auto operator()(dlms::LogicalName const& logical_name) const noexcept -> size_t {
+        return std::hash<uint64_t>{}(logical_name.value());
+    }
+};
+
 }
 
 #endif /* COSEM_H_ */
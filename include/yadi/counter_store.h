@@ -0,0 +1,83 @@
+/*
+ * This file is part of the yadi.cpp project.
+ *
+ * Copyright (C) 2017 Paulo Faco <paulofaco@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef YADI_DLMS_COUNTER_STORE_H
+#define YADI_DLMS_COUNTER_STORE_H
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace dlms
+{
+
+/**
+ * Invocation counters of the client system titles, kept in a memory-mapped file shared by every thread
+ * and process that opens it. Counters are handed out in ranges with an atomic add, so sessions never
+ * lock and two sessions never get the same counter.
+ *
+ * Counters survive a crash of the process or of the system: each title keeps on disk a limit the
+ * counters handed out never pass, written ahead by a margin, and opening the store moves every
+ * counter to its limit. A counter is thus never used twice, at the cost of at most margin unused
+ * counters per title each time the store is opened, and of one sync to disk per margin counters.
+ */
+class InvocationCounterStore {
+public:
+    /**
+     * Opens the store, creating the file if it does not exist. Processes opening the same file at
+     * once are serialized with a lock on it.
+     * @param capacity system titles the file can hold, only used when the file is created
+     * @param margin counters of a title handed out between two writes of its limit to disk
+     * @throw std::runtime_error if the file cannot be mapped or is not a counter store
+     */
+    explicit InvocationCounterStore(std::string const& path, size_t capacity = 1024, uint32_t margin = 4096);
+    ~InvocationCounterStore();
+    InvocationCounterStore(InvocationCounterStore const&) = delete;
+    InvocationCounterStore& operator=(InvocationCounterStore const&) = delete;
+
+    /**
+     * Reserves count consecutive invocation counters for a system title
+     * @return the first counter of the range
+     * @throw std::overflow_error if the 32-bit counter space is exhausted
+     * @throw std::length_error if the store has no room for a new system title
+     * @throw std::runtime_error if the limit of the title cannot be written to disk
+     */
+    auto reserve(std::array<uint8_t,8> const& system_title, uint32_t count) -> uint32_t;
+
+    /**
+     * Moves the next counter of a system title forward to at least next, e.g. to the value last
+     * accepted by a meter. It never moves a counter back.
+     */
+    void advance(std::array<uint8_t,8> const& system_title, uint32_t next);
+
+    /**
+     * Writes the mapped counters to disk and waits for it. Not needed for the counters to survive a
+     * crash, but keeps the counters skipped when the store is next opened to a minimum.
+     */
+    void sync();
+
+private:
+    class impl;
+    std::unique_ptr<impl> pimpl_;
+};
+
+}
+
+#endif //YADI_DLMS_COUNTER_STORE_H
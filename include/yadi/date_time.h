@@ -0,0 +1,64 @@
+/*
+ * This file is part of the yadi.cpp project.
+ *
+ * Copyright (C) 2017 Paulo Faco <paulofaco@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef YADI_DLMS_DATE_TIME_H
+#define YADI_DLMS_DATE_TIME_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dlms
+{
+
+/**
+ * Timestamp of a date-time that does not designate an instant, e.g. with wildcards
+ */
+static const int64_t NO_TIMESTAMP = INT64_MIN;
+
+/**
+ * Converts the 12 bytes of a DATE_TIME, year(2), month, day, day of week, hour, minute, second,
+ * hundredths, deviation(2) and clock status, to nanoseconds since the Unix epoch in UTC.
+ * The deviation is in minutes from local time to UTC; when not specified (0x8000) the date-time is
+ * taken as UTC. Unspecified hundredths count as 0 and the day of week is ignored.
+ * @return NO_TIMESTAMP if the year, month, day, hour, minute or second is not specified or out of
+ * range, if the clock status flags the value as invalid, or if the instant does not fit in 64 bits
+ */
+auto to_epoch_nanoseconds(const uint8_t *date_time) -> int64_t;
+
+/**
+ * Converts count date-times, stride bytes apart, e.g. the timestamp column of a compact array
+ */
+void to_epoch_nanoseconds(const uint8_t *data, size_t stride, size_t count, int64_t *out);
+
+/**
+ * Writes the 12 bytes of the DATE_TIME of an instant in local time, UTC being the local time plus
+ * deviation minutes, e.g. -60 for Central European Time. The clock status is 0. NO_TIMESTAMP is
+ * written as a date-time of wildcards.
+ */
+void from_epoch_nanoseconds(int64_t nanoseconds, uint8_t *date_time, int16_t deviation = 0);
+
+/**
+ * @return the DATE_TIME of an instant, e.g. the bounds of a range to encode as octet strings
+ */
+auto from_epoch_nanoseconds(int64_t nanoseconds, int16_t deviation = 0) -> std::vector<uint8_t>;
+
+}
+
+#endif //YADI_DLMS_DATE_TIME_H
@@ -1,10 +1,85 @@
 #include "hdlc.h"
 #include "wrapper.h"
 #include "cosem.h"
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <stdexcept>
 
 namespace dlms
 {
 
+namespace detail
+{
+
+/**
+ * Delivers a response to the consumer as it arrives, starting with its first APDU already read. A GBT
+ * response is acknowledged window by window, recovering lost blocks. An empty read is handled as a lost block.
+ */
+template<typename Write, typename Read>
+void receive(Cosem &cosem, std::vector<uint8_t> data, Write write, Read read, BlockConsumer const& consumer)
+{
+    static const auto MAX_RETRIES = 3;
+
+    if (!is_gbt(data)) {
+        consumer(data.data(), data.size());
+        return;
+    }
+
+    auto retries = 0;
+    while (true) {
+        auto status = data.empty() ? GbtStatus::WINDOW_COMPLETE : parse_gbt(cosem, data, consumer);
+        if (status == GbtStatus::LAST_BLOCK) {
+            return;
+        }
+        if (status == GbtStatus::WINDOW_COMPLETE) {
+            retries = data.empty() ? retries + 1 : 0;
+            if (retries > MAX_RETRIES) {
+                throw std::runtime_error("gbt: too many lost blocks");
+            }
+            write(serialize_gbt_ack(cosem));
+        }
+        data = read();
+    }
+}
+
+/**
+ * Sends an APDU and delivers the response to the consumer as it arrives. If general-block-transfer
+ * is enabled, large APDUs are sent in GBT windows, see receive for the response.
+ */
+template<typename Write, typename Read>
+void transfer(Cosem &cosem, const std::vector<uint8_t> &apdu, Write write, Read read, BlockConsumer const& consumer)
+{
+    cosem.context.gbt = GbtContext{};
+
+    if (cosem.parameters.gbt_window_size != 0 && apdu.size() > cosem.context.max_pdu_size) {
+        auto count = gbt_block_count(cosem, apdu);
+        auto next = size_t{0};
+        while (true) {
+            auto blocks = serialize_gbt(cosem, apdu, next);
+            for (auto const& block : blocks) {
+                write(block);
+            }
+            if (next + blocks.size() == count) {
+                break;
+            }
+            auto ack = read();
+            if (!is_gbt(ack)) {
+                consumer(ack.data(), ack.size());
+                return;
+            }
+            parse_gbt(cosem, ack, consumer);
+            next = cosem.context.gbt.peer_block_number_ack;
+        }
+    } else {
+        write(apdu);
+    }
+
+    receive(cosem, read(), write, read, consumer);
+}
+
+}
+
 template<typename T>
 struct CosemHdlcClient {
     Cosem cosem;
@@ -25,19 +100,59 @@ struct CosemHdlcClient {
         return hdlc::parse_disc_response(serial.read());
     }
 
+    /**
+     * Runs HLS pass 3 and pass 4, if the association uses a HLS mechanism
+     */
     bool authenticate(T& serial) {
-        serial.write(hdlc::serialize(hdlc_params, hdlc_ctx, serialize_action_request(cosem, {})));
-        return true;
+        if (cosem.parameters.authentication < AuthenticationMechanism::HLS) {
+            return true;
+        }
+        auto apdu = std::vector<uint8_t>{};
+        transfer(serial, serialize_reply_to_hls_authentication(cosem), [&apdu](const uint8_t *data, size_t size) {
+            apdu.insert(apdu.end(), data, data + size);
+        });
+        return parse_reply_to_hls_authentication(cosem, apdu);
     }
 
     Response get_request(T& serial, const Request &req) {
-        serial.write(hdlc::serialize(hdlc_params, hdlc_ctx, serialize_get_request(cosem, req)));
-        return parse_get_response(cosem, hdlc::parse(hdlc_params, hdlc_ctx, serial.read()));
+        auto apdu = std::vector<uint8_t>{};
+        transfer(serial, serialize_get_request(cosem, req), [&apdu](const uint8_t *data, size_t size) {
+            apdu.insert(apdu.end(), data, data + size);
+        });
+        return parse_get_response(cosem, apdu);
+    }
+
+    /**
+     * Streams the encoded Data of the response to the consumer block by block, as it is received
+     * @return the result of the response, see GetResponseStream::finish
+     */
+    Response get_request(T& serial, const Request &req, BlockConsumer const& consumer) {
+        auto stream = GetResponseStream{cosem, consumer};
+        transfer(serial, serialize_get_request(cosem, req), [&stream](const uint8_t *data, size_t size) {
+            stream(data, size);
+        });
+        return stream.finish();
     }
 
     Response set_request(T& serial, const Request &req) {
-        serial.write(hdlc::serialize(hdlc_params, hdlc_ctx, serialize_set_request(cosem, req)));
-        return parse_set_response(cosem, hdlc::parse(hdlc_params, hdlc_ctx, serial.read()));
+        auto apdu = std::vector<uint8_t>{};
+        transfer(serial, serialize_set_request(cosem, req), [&apdu](const uint8_t *data, size_t size) {
+            apdu.insert(apdu.end(), data, data + size);
+        });
+        return parse_set_response(cosem, apdu);
+    }
+
+private:
+    void transfer(T& serial, const std::vector<uint8_t> &apdu, BlockConsumer const& consumer) {
+        detail::transfer(cosem, apdu,
+            [&](const std::vector<uint8_t> &data) {
+                serial.write(hdlc::serialize(hdlc_params, hdlc_ctx, data));
+            },
+            [&]() {
+                auto frame = serial.read();
+                return frame.empty() ? frame : hdlc::parse(hdlc_params, hdlc_ctx, frame);
+            },
+            consumer);
     }
 };
 
@@ -55,16 +170,129 @@ struct CosemWrapperClient {
         return true;
     }
 
+    /**
+     * Runs HLS pass 3 and pass 4, if the association uses a HLS mechanism
+     */
+    bool authenticate(T& serial) {
+        if (cosem.parameters.authentication < AuthenticationMechanism::HLS) {
+            return true;
+        }
+        auto apdu = std::vector<uint8_t>{};
+        transfer(serial, serialize_reply_to_hls_authentication(cosem), [&apdu](const uint8_t *data, size_t size) {
+            apdu.insert(apdu.end(), data, data + size);
+        });
+        return parse_reply_to_hls_authentication(cosem, apdu);
+    }
+
     Response get_request(T& serial, const Request &req) {
-        serial.write(wrapper::serialize(wrapper_params, serialize_get_request(cosem, req)));
-        return parse_get_response(cosem, wrapper::parse(wrapper_params, serial.read()));
+        auto apdu = std::vector<uint8_t>{};
+        transfer(serial, serialize_get_request(cosem, req), [&apdu](const uint8_t *data, size_t size) {
+            apdu.insert(apdu.end(), data, data + size);
+        });
+        return parse_get_response(cosem, apdu);
+    }
+
+    /**
+     * Streams the encoded Data of the response to the consumer block by block, as it is received
+     * @return the result of the response, see GetResponseStream::finish
+     */
+    Response get_request(T& serial, const Request &req, BlockConsumer const& consumer) {
+        auto stream = GetResponseStream{cosem, consumer};
+        transfer(serial, serialize_get_request(cosem, req), [&stream](const uint8_t *data, size_t size) {
+            stream(data, size);
+        });
+        return stream.finish();
     }
 
     Response set_request(T& serial, const Request &req) {
-        serial.write(wrapper::serialize(wrapper_params, serialize_set_request(cosem, req)));
-        return parse_set_response(cosem, wrapper::parse(wrapper_params, serial.read()));
+        auto apdu = std::vector<uint8_t>{};
+        transfer(serial, serialize_set_request(cosem, req), [&apdu](const uint8_t *data, size_t size) {
+            apdu.insert(apdu.end(), data, data + size);
+        });
+        return parse_set_response(cosem, apdu);
+    }
+
+    /**
+     * Pipelines the requests, keeping up to max_pending_requests of them outstanding, and matches
+     * each response to its request by invoke-id. Requests must fit in a single APDU; responses sent
+     * with general-block-transfer are reassembled before they are matched.
+     * @return the responses, in the same order as the requests
+     */
+    std::vector<Response> get_requests(T& serial, const std::vector<Request> &reqs) {
+        static const auto NONE = std::numeric_limits<size_t>::max();
+        auto completion = std::array<size_t,16>{};
+        completion.fill(NONE);
+
+        //invoke-ids still outstanding when a read or a parse throws are released for the next calls
+        struct Release {
+            Cosem &cosem;
+            std::array<size_t,16> const& completion;
+            ~Release() {
+                for (size_t id = 0; id < completion.size(); ++id) {
+                    if (completion[id] != NONE) {
+                        release_invoke_id(cosem, static_cast<uint8_t>(id));
+                    }
+                }
+            }
+        } release{cosem, completion};
+
+        auto responses = std::vector<Response>(reqs.size());
+        auto max_pending = std::max(1U, std::min(16U, cosem.parameters.max_pending_requests));
+        auto sent = size_t{0};
+        auto pending = 0U;
+
+        while (sent < reqs.size() || pending != 0) {
+            while (sent < reqs.size() && pending < max_pending) {
+                auto invoke_id = allocate_invoke_id(cosem);
+                completion[invoke_id] = sent;
+                serial.write(wrapper::serialize(wrapper_params, serialize_get_request(cosem, reqs[sent++])));
+                ++pending;
+            }
+            auto apdu = std::vector<uint8_t>{};
+            cosem.context.gbt = GbtContext{};
+            detail::receive(cosem, read(serial),
+                [&](const std::vector<uint8_t> &data) {
+                    write(serial, data);
+                },
+                [&]() {
+                    return read(serial);
+                },
+                [&apdu](const uint8_t *data, size_t size) {
+                    apdu.insert(apdu.end(), data, data + size);
+                });
+            auto response = parse_get_response(cosem, apdu);
+            auto index = completion[response.invoke_id];
+            if (index == NONE) {
+                throw InvalidCosemFrame{};
+            }
+            completion[response.invoke_id] = NONE;
+            responses[index] = std::move(response);
+            --pending;
+        }
+
+        return responses;
+    }
+
+private:
+    void transfer(T& serial, const std::vector<uint8_t> &apdu, BlockConsumer const& consumer) {
+        detail::transfer(cosem, apdu,
+            [&](const std::vector<uint8_t> &data) {
+                write(serial, data);
+            },
+            [&]() {
+                return read(serial);
+            },
+            consumer);
+    }
+
+    void write(T& serial, const std::vector<uint8_t> &apdu) {
+        serial.write(wrapper::serialize(wrapper_params, apdu));
+    }
+
+    std::vector<uint8_t> read(T& serial) {
+        auto frame = serial.read();
+        return frame.empty() ? frame : wrapper::parse(wrapper_params, frame);
     }
 };
 
 }
-
@@ -0,0 +1,108 @@
+/*
+ * This file is part of the yadi.cpp project.
+ *
+ * Copyright (C) 2017 Paulo Faco <paulofaco@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+///@file
+
+#ifndef YADI_GCM_H
+#define YADI_GCM_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace dlms
+{
+
+struct GcmJob;
+
+/**
+ * AES-128-GCM, as used by security suite 0.
+ *
+ * The key schedule and the GHASH tables are computed once when the object is built, so a Gcm should
+ * live as long as its key. AES-NI and PCLMULQDQ are used when the CPU supports them, with a portable
+ * table based implementation otherwise. Data is always ciphered in place.
+ */
+class Gcm
+{
+public:
+    static const size_t KEY_SIZE = 16;
+    static const size_t IV_SIZE = 12;
+    static const size_t BLOCK_SIZE = 16;
+
+    Gcm() = default;
+    explicit Gcm(std::array<uint8_t,16> const& key, bool allow_hardware = true);
+
+    /**
+     * Encrypts size bytes of data in place and computes the authentication tag over aad and the ciphertext.
+     * With size 0 the result is the GMAC of aad.
+     * @param iv 12 bytes initialization vector
+     * @param tag receives the first tag_size (up to 16) bytes of the tag
+     */
+    void encrypt(const uint8_t *iv, const uint8_t *aad, size_t aad_size, uint8_t *data, size_t size,
+                 uint8_t *tag, size_t tag_size) const;
+
+    /**
+     * Verifies the tag and decrypts size bytes of data in place.
+     * @return false if the tag does not match, in which case the content of data is undefined
+     */
+    bool decrypt(const uint8_t *iv, const uint8_t *aad, size_t aad_size, uint8_t *data, size_t size,
+                 const uint8_t *tag, size_t tag_size) const;
+
+    /**
+     * Verifies and decrypts independent messages in place, each with its own Gcm. With AES-NI, messages
+     * of similar size are processed eight at a time, their AES rounds and GHASH steps interleaved so
+     * that short APDUs keep the AES pipeline busy. The result of each message is stored in its job.
+     */
+    static void decrypt_many(GcmJob *jobs, size_t count);
+
+    bool keyed() const { return keyed_; }
+    bool hardware_accelerated() const { return hardware_; }
+    static bool hardware_supported();
+
+private:
+    void crypt(const uint8_t *iv, const uint8_t *aad, size_t aad_size, uint8_t *data, size_t size,
+               uint8_t *tag, bool decrypting) const;
+
+    uint32_t rk_[44] = {0};                 ///< round keys, as big endian words
+    uint8_t round_keys_[176] = {0};         ///< round keys, as bytes, for AES-NI
+    uint8_t h_powers_[4][16] = {{0}};       ///< H, H^2, H^3 and H^4, byte reflected, for PCLMULQDQ
+    uint64_t hh_[16] = {0}, hl_[16] = {0};  ///< 4-bit multiplication table of H for the portable GHASH
+    bool hardware_ = false;
+    bool keyed_ = false;
+};
+
+/**
+ * One message of a batch decrypted with Gcm::decrypt_many. The arguments are those of Gcm::decrypt.
+ */
+struct GcmJob {
+    Gcm const* gcm;
+    const uint8_t *iv;
+    const uint8_t *aad;
+    size_t aad_size;
+    uint8_t *data;
+    size_t size;
+    const uint8_t *tag;
+    size_t tag_size;
+    bool valid; ///< set by decrypt_many: false if the tag does not match
+};
+
+}
+
+#endif //YADI_GCM_H
@@ -0,0 +1,135 @@
+/*
+ * This file is part of the yadi.cpp project.
+ *
+ * Copyright (C) 2017 Paulo Faco <paulofaco@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef YADI_DLMS_KEY_STORE_H
+#define YADI_DLMS_KEY_STORE_H
+
+#include <yadi/gcm.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace dlms
+{
+
+/**
+ * Keys of one server, with the key schedule of its global unicast key already expanded
+ */
+struct KeySet {
+    std::array<uint8_t,8> system_title{0};
+    std::array<uint8_t,16> guek{0};
+    std::array<uint8_t,16> ak{0};
+    Gcm cipher;
+};
+
+/**
+ * Keys of many servers, indexed by their system title, for deciphering pushed APDUs.
+ *
+ * The index is an open-addressing table whose slots hold the title inline and a pointer to an
+ * immutable KeySet. Lookups never lock. Writers serialize among themselves and publish a new
+ * KeySet (or a new table, when it grows) with an atomic store, copying instead of modifying.
+ * Replaced KeySets and tables stay allocated until reclaim() or the destruction of the store,
+ * so a pointer returned by find() remains valid until then.
+ */
+class KeyStore {
+public:
+    explicit KeyStore(size_t capacity = 1024);
+    ~KeyStore();
+    KeyStore(KeyStore const&) = delete;
+    KeyStore& operator=(KeyStore const&) = delete;
+
+    /**
+     * Adds the keys of a server, or replaces them
+     */
+    void insert(std::array<uint8_t,8> const& system_title, std::array<uint8_t,16> const& guek,
+                std::array<uint8_t,16> const& ak);
+
+    /**
+     * @return false if no keys were registered for the title
+     */
+    bool erase(std::array<uint8_t,8> const& system_title);
+
+    /**
+     * Lock-free lookup
+     * @return the keys of the server, or nullptr
+     */
+    auto find(std::array<uint8_t,8> const& system_title) const -> const KeySet*;
+
+    auto size() const -> size_t;
+
+    /**
+     * Frees replaced and erased KeySets and outgrown tables. Only call it while no thread uses a
+     * pointer returned by find(), e.g. between two bursts of notifications.
+     */
+    void reclaim();
+
+private:
+    struct Slot {
+        std::atomic<const KeySet*> keys{nullptr};
+        uint64_t title = 0; //written before keys is published, never changes afterwards
+    };
+
+    struct Table {
+        explicit Table(size_t capacity);
+        size_t mask;
+        unsigned shift;
+        std::unique_ptr<Slot[]> slots;
+    };
+
+    static auto probe_start(Table const& table, uint64_t title) -> size_t;
+    void grow();
+
+    std::atomic<Table*> table_; ///< owns the table and the live KeySets of its slots
+    mutable std::mutex writer_;
+    size_t used_ = 0;  ///< live and erased slots, counted for the load factor
+    size_t size_ = 0;
+    std::vector<std::unique_ptr<const KeySet>> retired_keys_;
+    std::vector<std::unique_ptr<Table>> retired_tables_;
+};
+
+/**
+ * Deciphers in place a general-glo-ciphering APDU pushed by a server, e.g. a ciphered data-notification,
+ * with the keys registered for the system title the APDU carries. The APDU is replaced by the plain one.
+ * @return the system title of the server
+ * @throw std::out_of_range if no keys are registered for the system title
+ * @throw InvalidCosemFrame or CosemAuthenticationError if the APDU cannot be deciphered
+ */
+auto decipher_general_glo(KeyStore const& store, std::vector<uint8_t> &apdu) -> std::array<uint8_t,8>;
+
+enum class DecipherStatus {
+    OK,
+    UNKNOWN_SYSTEM_TITLE,
+    INVALID_FRAME,
+    AUTHENTICATION_FAILED,
+};
+
+/**
+ * Deciphers in place a burst of general-glo-ciphering APDUs, e.g. the notifications pushed by many meters
+ * at the same time. Encrypted APDUs are deciphered in parallel lanes, see Gcm::decrypt_many. An APDU
+ * whose status is not OK is left in an unspecified state.
+ * @return the status of each APDU
+ */
+auto decipher_general_glo(KeyStore const& store, std::vector<std::vector<uint8_t>> &apdus) -> std::vector<DecipherStatus>;
+
+}
+
+#endif //YADI_DLMS_KEY_STORE_H
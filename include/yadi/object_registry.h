@@ -0,0 +1,117 @@
+/*
+ * This file is part of the yadi.cpp project.
+ *
+ * Copyright (C) 2017 Paulo Faco <paulofaco@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef YADI_DLMS_OBJECT_REGISTRY_H
+#define YADI_DLMS_OBJECT_REGISTRY_H
+
+#include <yadi/cosem.h>
+#include <yadi/parser.h>
+#include <cstdint>
+#include <vector>
+
+namespace dlms
+{
+
+/**
+ * attribute_access_mode of the association object list
+ */
+enum class AttributeAccess : uint8_t {
+    NO_ACCESS = 0,
+    READ_ONLY = 1,
+    WRITE_ONLY = 2,
+    READ_AND_WRITE = 3,
+    AUTHENTICATED_READ_ONLY = 4,
+    AUTHENTICATED_WRITE_ONLY = 5,
+    AUTHENTICATED_READ_AND_WRITE = 6,
+};
+
+struct AttributeInfo {
+    DataType type = DataType::NULL_DATA;
+    int8_t scaler = 0;
+    uint8_t unit = 0;
+    AttributeAccess access = AttributeAccess::NO_ACCESS;
+};
+
+/**
+ * An object of the model, with its attributes in order from attribute 1
+ */
+struct ObjectInfo {
+    ClassID class_id;
+    LogicalName logical_name;
+    std::vector<AttributeInfo> attributes;
+};
+
+/**
+ * Attribute metadata of the objects of a meter type, indexed by class id and logical name, e.g.
+ * built from the association object list of the first meter of that type.
+ *
+ * The index is built once with a perfect hash (hash and displace): a lookup hashes the key, reads
+ * the displacement of its bucket and lands on the only slot the key can be in. Slots are 16 bytes,
+ * four per cache line, and the attributes of all objects are packed in one array. The registry
+ * never changes once built, so any number of threads can share it, e.g. through a
+ * std::shared_ptr<const ObjectRegistry>, without locking.
+ */
+class ObjectRegistry {
+public:
+    /**
+     * @throw std::invalid_argument if an object appears twice, has no attributes or has class id 0
+     */
+    explicit ObjectRegistry(std::vector<ObjectInfo> const& objects);
+
+    /**
+     * Attributes of an object, in order from attribute 1
+     */
+    struct Attributes {
+        const AttributeInfo *data = nullptr;
+        size_t size = 0;
+    };
+
+    /**
+     * @return the attributes of the object, empty if the registry does not hold it
+     */
+    auto find(ClassID class_id, LogicalName const& logical_name) const -> Attributes;
+
+    /**
+     * @param index attribute index, from 1
+     * @return the attribute, or nullptr if the registry does not hold it
+     */
+    auto find(ClassID class_id, LogicalName const& logical_name, uint8_t index) const -> const AttributeInfo*;
+
+    auto size() const -> size_t { return size_; }
+
+private:
+    struct alignas(16) Slot {
+        uint64_t key = 0; ///< class id in the top 16 bits, logical name below; 0 marks an empty slot
+        uint32_t first = 0;
+        uint32_t count = 0;
+    };
+
+    auto slot(uint64_t key) const -> Slot const&;
+
+    std::vector<uint32_t> seeds_; ///< displacement of each bucket
+    std::vector<Slot> slots_;
+    std::vector<AttributeInfo> attributes_;
+    size_t bucket_mask_ = 0;
+    size_t slot_mask_ = 0;
+    size_t size_ = 0;
+};
+
+}
+
+#endif //YADI_DLMS_OBJECT_REGISTRY_H
@@ -3,9 +3,16 @@
 #ifndef YADI_DLMS_PARSER_H
 #define YADI_DLMS_PARSER_H
 
+#include <yadi/arena.h>
 #include <cstdint>
-#include <vector>
+#include <cstring>
+#include <initializer_list>
+#include <stdexcept>
 #include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace dlms
 {
@@ -27,21 +34,542 @@ enum class DataType : uint8_t
     INT16 = 16,
     UINT8 = 17,
     UINT16 = 18,
+    COMPACT_ARRAY = 19,
     INT64 = 20,
     UINT64 = 21,
+    ENUM = 22,
     FLOAT32 = 23,
     FLOAT64 = 24,
     DATE_TIME = 25,
     DATE = 26,
     TIME = 27,
+    DONT_CARE = 255,
+};
+
+/**
+ * A decoded A-XDR value. Nodes are 16 bytes and live, with their children and contents, in the arena
+ * they were decoded into.
+ */
+struct Value {
+    DataType type = DataType::NULL_DATA;
+    /**
+     * Children of an array, compact array or structure, bytes of an octet, visible or utf8 string, bits
+     * of a bit string and bytes of a date-time, date or time. 0 for other types.
+     */
+    uint32_t size = 0;
+    union {
+        int64_t integer = 0;        ///< INT8, INT16, INT32, INT64
+        uint64_t unsigned_integer;  ///< BOOLEAN, BCD, UINT8, UINT16, UINT32, UINT64, ENUM
+        double real;                ///< FLOAT32, FLOAT64
+        const uint8_t *bytes;       ///< strings, bit strings (most significant bit first), dates and times
+        const Value *items;         ///< ARRAY, STRUCTURE, COMPACT_ARRAY expanded to its elements
+    };
+
+    auto begin() const -> const Value* { return items; }
+    auto end() const -> const Value* { return items + size; }
+    auto operator[](size_t index) const -> Value const& { return items[index]; }
 };
 
 void write_size(std::vector<uint8_t> &buffer, size_t size);
+
+/**
+ * @return bytes of the length octets of size
+ */
+auto size_length(size_t size) -> size_t;
+
+/**
+ * Writes the length octets of size, which must fit in 32 bits, without bounds checks
+ * @return the end of the length octets
+ */
+auto write_size(uint8_t *out, size_t size) -> uint8_t*;
+auto read_size(std::vector<uint8_t> const& buffer, size_t &offset) -> size_t;
+auto read_size(const uint8_t *data, size_t size, size_t &offset) -> size_t;
+
+/**
+ * Converts a run of count big-endian values, stride bytes apart, to native values, e.g. the elements
+ * of an array of UINT32 (stride 5, one tag before each value) or of a compact array (stride equal to
+ * the width of the values). Uses AVX2 or SSSE3 byte shuffles where the processor has them.
+ */
+void convert_big_endian(const uint8_t *data, size_t stride, size_t count, uint16_t *out);
+void convert_big_endian(const uint8_t *data, size_t stride, size_t count, uint32_t *out);
+void convert_big_endian(const uint8_t *data, size_t stride, size_t count, uint64_t *out);
+void convert_big_endian(const uint8_t *data, size_t stride, size_t count, float *out);
+void convert_big_endian(const uint8_t *data, size_t stride, size_t count, double *out);
+
+/**
+ * Converts a run of integers of any integer type to int64, sign-extending the signed types
+ * @throw std::invalid_argument if type is not an integer type
+ */
+void convert_big_endian(DataType type, const uint8_t *data, size_t stride, size_t count, int64_t *out);
 auto from_string(std::string const& str, DataType tag = DataType::STRING) -> std::vector<uint8_t>;
 auto from_bytes(std::vector<uint8_t> const& data, DataType tag = DataType::OCTET_STRING) -> std::vector<uint8_t>;
 auto to_string(std::vector<uint8_t> const& buffer) -> std::string;
 auto to_bytes(std::vector<uint8_t> const& buffer) -> std::vector<uint8_t>;
 
+/**
+ * Decodes the A-XDR value at offset, and all values nested in it, into arena. The elements of a
+ * compact array are decoded from its type description and given as its children.
+ * @param offset moved past the value
+ * @throw std::underflow_error if the value is truncated
+ * @throw std::invalid_argument on an unknown tag, values nested too deep, or compact array contents
+ * that do not match their type description
+ */
+auto decode_value(const uint8_t *data, size_t size, size_t &offset, Arena &arena) -> Value const&;
+auto decode_value(std::vector<uint8_t> const& buffer, size_t &offset, Arena &arena) -> Value const&;
+
+/**
+ * @return bytes of the A-XDR encoding of value and all values nested in it, length octets included.
+ * The type description of a compact array is taken from its first element.
+ * @throw std::invalid_argument on an unknown type, a date or time whose size is not the size of its
+ * type, values nested too deep, a length beyond 32 bits, or a compact array that is empty, whose
+ * elements do not all have the shape of the first, or hold an empty structure or a null-data
+ */
+auto encoded_size(Value const& value) -> size_t;
+
+/**
+ * Writes value without bounds checks, e.g. a whole table of a Set request into a buffer sized once.
+ * The value must have passed encoded_size, and out have room for the size it returned.
+ * @return the end of the encoding
+ */
+auto encode_value(Value const& value, uint8_t *out) -> uint8_t*;
+
+/**
+ * Appends value to buffer, growing it once
+ * @throw std::invalid_argument see encoded_size
+ */
+void encode_value(Value const& value, std::vector<uint8_t> &buffer);
+
+/**
+ * Non-owning cursor on an encoded A-XDR value, e.g. in Response::data. Nothing is decoded up front:
+ * each call reads the tag and length it needs, and navigation skips over values without decoding
+ * them, so picking a few fields out of a large response touches only the bytes on the way and
+ * never allocates. The buffer must outlive the view.
+ *
+ * Reading past the buffer throws std::underflow_error; a getter on a value of another type throws
+ * std::invalid_argument.
+ */
+class DataView {
+public:
+    DataView() = default;
+    DataView(const uint8_t *data, size_t size, size_t offset = 0);
+    explicit DataView(std::vector<uint8_t> const& buffer, size_t offset = 0);
+
+    auto type() const -> DataType;
+
+    /**
+     * @return children of an array or structure, bytes of a string, date or time, bits of a bit string,
+     * 0 for other types
+     */
+    auto size() const -> size_t;
+
+    /**
+     * @return position of the tag of the value in the buffer
+     */
+    auto offset() const -> size_t { return offset_; }
+
+    /**
+     * @return false once the view has skipped past the last value of the buffer
+     */
+    bool valid() const { return offset_ < size_; }
+
+    /**
+     * Moves the view to the value that follows, skipping all values nested in the current one
+     */
+    void skip();
+
+    /**
+     * @return the first child of an array or structure
+     */
+    auto child() const -> DataView;
+
+    /**
+     * @return the child at index of an array or structure, reached by skipping its previous siblings
+     * @throw std::out_of_range if there are not so many children
+     */
+    auto operator[](size_t index) const -> DataView;
+
+    /**
+     * @return any integer type, BOOLEAN, BCD or ENUM
+     * @throw std::out_of_range if the value does not fit
+     */
+    auto to_int64() const -> int64_t;
+    auto to_uint64() const -> uint64_t;
+
+    /**
+     * @return a FLOAT32, FLOAT64 or integer value
+     */
+    auto to_double() const -> double;
+    auto to_bool() const -> bool;
+
+    /**
+     * @return the contents of a string, bit string, date-time, date or time, see size()
+     */
+    auto bytes() const -> const uint8_t*;
+
+    /**
+     * @return the contents of an octet, visible or utf8 string
+     */
+    auto to_string() const -> std::string;
+
+    /**
+     * Decodes the value and its children into arena, see decode_value
+     */
+    auto to_value(Arena &arena) const -> Value const&;
+
+private:
+    auto scalar() const -> Value;
+
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+    size_t offset_ = 0;
+};
+
+/**
+ * Receives the values found by a StreamParser, in the order they are encoded
+ */
+class DataHandler {
+public:
+    virtual ~DataHandler() = default;
+    virtual void begin_array(size_t count) = 0;
+    virtual void begin_structure(size_t count) = 0;
+
+    /**
+     * A value without children. A compact array is handed whole, its type description followed by its
+     * contents as encoded.
+     * @param bytes contents of the value as encoded, e.g. big-endian for numbers; empty for NULL_DATA
+     * @param size bytes at bytes, or the number of bits of a bit string
+     */
+    virtual void value(DataType type, const uint8_t *bytes, size_t size) = 0;
+
+    /**
+     * End of the innermost array or structure
+     */
+    virtual void end() = 0;
+};
+
+/**
+ * Event-driven A-XDR parser for values that arrive in blocks, e.g. a profile buffer received through
+ * a BlockConsumer. Blocks are parsed as they are fed; the parser only keeps the count of children
+ * left at each level of nesting and the bytes of a value split between two blocks, so its memory is
+ * bounded by the nesting depth and the largest single value, not by the size of the data.
+ * Values entirely within a block are handed to the handler without copy.
+ */
+class StreamParser {
+public:
+    explicit StreamParser(DataHandler &handler);
+
+    /**
+     * Parses the next block of the stream. The stream can hold any number of consecutive values.
+     * @throw std::invalid_argument on an unknown tag, or values nested too deep
+     */
+    void feed(const uint8_t *data, size_t size);
+
+    /**
+     * @return true when the data fed so far ends on the end of a value
+     */
+    bool complete() const;
+
+    /**
+     * Drops the state of a stream, e.g. one that was abandoned half-way
+     */
+    void reset();
+
+private:
+    void element(const uint8_t *data, size_t size);
+
+    DataHandler &handler_;
+    std::vector<size_t> remaining_; ///< children still to come at each level of nesting
+    std::vector<uint8_t> pending_;  ///< start of a value split between blocks
+};
+
+/**
+ * Value of an ENUM, for the typed encode and decode
+ */
+struct Enum {
+    uint8_t value;
+};
+
+namespace detail {
+
+template<typename U>
+inline auto load_big_endian(const uint8_t *data) -> U {
+    U value = 0;
+    for (size_t i = 0; i < sizeof(U); ++i) {
+        value = static_cast<U>(value << 8U | data[i]);
+    }
+    return value;
+}
+
+template<typename U>
+inline void store_big_endian(U value, uint8_t *data) {
+    for (size_t i = sizeof(U); i-- > 0; value = static_cast<U>(value >> 8U)) {
+        data[i] = static_cast<uint8_t>(value);
+    }
+}
+
+/**
+ * Checks the tag of the value at offset and that its contents are in the buffer, then moves offset
+ * to the contents
+ */
+inline void expect(const uint8_t *data, size_t size, size_t &offset, DataType tag, size_t width) {
+    if (offset >= size || size - offset < 1 + width) {
+        throw std::underflow_error{"not enough bytes"};
+    }
+    if (data[offset] != static_cast<uint8_t>(tag)) {
+        throw std::invalid_argument{"unexpected data type"};
+    }
+    ++offset;
+}
+
+/**
+ * Fixed-size types, stored as an unsigned integer U of the same width
+ */
+template<DataType Tag, typename T, typename U>
+struct FixedCodec {
+    static constexpr DataType tag = Tag;
+
+    static void encode(std::vector<uint8_t> &buffer, T value) {
+        U bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        uint8_t bytes[1 + sizeof(U)] = {static_cast<uint8_t>(Tag)};
+        store_big_endian(bits, bytes + 1);
+        buffer.insert(buffer.end(), bytes, bytes + sizeof(bytes));
+    }
+
+    static auto decode(const uint8_t *data, size_t size, size_t &offset) -> T {
+        expect(data, size, offset, Tag, sizeof(U));
+        auto bits = load_big_endian<U>(data + offset);
+        offset += sizeof(U);
+        T value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+};
+
+/**
+ * Element types of arrays converted in one run by convert_big_endian, and the type it writes them as
+ */
+template<typename T, typename Enable = void>
+struct RunType {
+};
+
+template<typename T>
+struct RunType<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value && (sizeof(T) > 1)>::type> {
+    using type = typename std::make_unsigned<T>::type;
+};
+
+template<> struct RunType<float> { using type = float; };
+template<> struct RunType<double> { using type = double; };
+
+template<typename T, typename = void>
+struct has_run_type : std::false_type {};
+
+template<typename T>
+struct has_run_type<T, decltype(void(sizeof(typename RunType<T>::type)))> : std::true_type {};
+
+template<DataType Tag, typename T>
+struct SequenceCodec {
+    static constexpr DataType tag = Tag;
+
+    static void encode(std::vector<uint8_t> &buffer, T const& value) {
+        buffer.push_back(static_cast<uint8_t>(Tag));
+        write_size(buffer, value.size());
+        buffer.insert(buffer.end(), value.begin(), value.end());
+    }
+
+    static auto decode(const uint8_t *data, size_t size, size_t &offset) -> T {
+        expect(data, size, offset, Tag, 1);
+        auto length = read_size(data, size, offset);
+        if (length > size - offset) {
+            throw std::underflow_error{"not enough bytes"};
+        }
+        offset += length;
+        return T(data + offset - length, data + offset);
+    }
+};
+
+}
+
+/**
+ * Maps a C++ type to its A-XDR encoding, for decode and encode:
+ *
+ * | C++ type                     | DataType                                       |
+ * |------------------------------|------------------------------------------------|
+ * | bool                         | BOOLEAN                                        |
+ * | int8_t ... int64_t           | INT8, INT16, INT32, INT64                      |
+ * | uint8_t ... uint64_t         | UINT8, UINT16, UINT32, UINT64                  |
+ * | float, double                | FLOAT32, FLOAT64                               |
+ * | Enum                         | ENUM                                           |
+ * | std::string                  | STRING                                         |
+ * | std::vector<uint8_t>         | OCTET_STRING                                   |
+ * | std::vector<T>               | ARRAY of T                                     |
+ * | std::tuple<T...>             | STRUCTURE of T...                              |
+ */
+template<typename T, typename Enable = void>
+struct Codec {
+    static_assert(sizeof(T) == 0, "type has no A-XDR encoding");
+};
+
+template<>
+struct Codec<bool> {
+    static constexpr DataType tag = DataType::BOOLEAN;
+
+    static void encode(std::vector<uint8_t> &buffer, bool value) {
+        buffer.insert(buffer.end(), {static_cast<uint8_t>(tag), static_cast<uint8_t>(value ? 1 : 0)});
+    }
+
+    static auto decode(const uint8_t *data, size_t size, size_t &offset) -> bool {
+        detail::expect(data, size, offset, tag, 1);
+        return data[offset++] != 0;
+    }
+};
+
+template<> struct Codec<int8_t> : detail::FixedCodec<DataType::INT8, int8_t, uint8_t> {};
+template<> struct Codec<int16_t> : detail::FixedCodec<DataType::INT16, int16_t, uint16_t> {};
+template<> struct Codec<int32_t> : detail::FixedCodec<DataType::INT32, int32_t, uint32_t> {};
+template<> struct Codec<int64_t> : detail::FixedCodec<DataType::INT64, int64_t, uint64_t> {};
+template<> struct Codec<uint8_t> : detail::FixedCodec<DataType::UINT8, uint8_t, uint8_t> {};
+template<> struct Codec<uint16_t> : detail::FixedCodec<DataType::UINT16, uint16_t, uint16_t> {};
+template<> struct Codec<uint32_t> : detail::FixedCodec<DataType::UINT32, uint32_t, uint32_t> {};
+template<> struct Codec<uint64_t> : detail::FixedCodec<DataType::UINT64, uint64_t, uint64_t> {};
+template<> struct Codec<float> : detail::FixedCodec<DataType::FLOAT32, float, uint32_t> {};
+template<> struct Codec<double> : detail::FixedCodec<DataType::FLOAT64, double, uint64_t> {};
+template<> struct Codec<Enum> : detail::FixedCodec<DataType::ENUM, Enum, uint8_t> {};
+template<> struct Codec<std::string> : detail::SequenceCodec<DataType::STRING, std::string> {};
+template<> struct Codec<std::vector<uint8_t>> : detail::SequenceCodec<DataType::OCTET_STRING, std::vector<uint8_t>> {};
+
+template<typename T>
+struct Codec<std::vector<T>, typename std::enable_if<!std::is_same<T, uint8_t>::value>::type> {
+    static constexpr DataType tag = DataType::ARRAY;
+
+    static void encode(std::vector<uint8_t> &buffer, std::vector<T> const& values) {
+        buffer.push_back(static_cast<uint8_t>(tag));
+        write_size(buffer, values.size());
+        for (auto const& value : values) {
+            Codec<T>::encode(buffer, value);
+        }
+    }
+
+    static auto decode(const uint8_t *data, size_t size, size_t &offset) -> std::vector<T> {
+        detail::expect(data, size, offset, tag, 1);
+        auto count = read_size(data, size, offset);
+        if (count > size - offset) {
+            throw std::underflow_error{"not enough bytes"};
+        }
+        std::vector<T> values;
+        if (decode_run(data, size, offset, count, values, detail::has_run_type<T>{})) {
+            return values;
+        }
+        values.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            values.push_back(Codec<T>::decode(data, size, offset));
+        }
+        return values;
+    }
+
+private:
+    /**
+     * Converts all elements at once when they all carry the tag of T
+     */
+    static bool decode_run(const uint8_t *data, size_t size, size_t &offset, size_t count, std::vector<T> &values,
+                           std::true_type) {
+        auto stride = 1 + sizeof(T);
+        if (count > (size - offset) / stride) {
+            return false;
+        }
+        auto mismatches = 0U;
+        for (size_t i = 0; i < count; ++i) {
+            mismatches |= data[offset + i * stride] ^ static_cast<uint8_t>(Codec<T>::tag);
+        }
+        if (mismatches != 0) {
+            return false;
+        }
+        values.resize(count);
+        convert_big_endian(data + offset + 1, stride, count, reinterpret_cast<typename detail::RunType<T>::type*>(values.data()));
+        offset += count * stride;
+        return true;
+    }
+
+    static bool decode_run(const uint8_t*, size_t, size_t&, size_t, std::vector<T>&, std::false_type) {
+        return false;
+    }
+};
+
+template<typename... T>
+struct Codec<std::tuple<T...>> {
+    static constexpr DataType tag = DataType::STRUCTURE;
+
+    static void encode(std::vector<uint8_t> &buffer, std::tuple<T...> const& values) {
+        buffer.push_back(static_cast<uint8_t>(tag));
+        buffer.push_back(static_cast<uint8_t>(sizeof...(T)));
+        encode_fields(buffer, values, std::index_sequence_for<T...>{});
+    }
+
+    static auto decode(const uint8_t *data, size_t size, size_t &offset) -> std::tuple<T...> {
+        detail::expect(data, size, offset, tag, 1);
+        if (data[offset++] != sizeof...(T)) {
+            throw std::invalid_argument{"unexpected structure size"};
+        }
+        return std::tuple<T...>{Codec<T>::decode(data, size, offset)...}; //braces decode the fields in order
+    }
+
+private:
+    static_assert(sizeof...(T) <= 0x80, "structure too large");
+
+    template<size_t... I>
+    static void encode_fields(std::vector<uint8_t> &buffer, std::tuple<T...> const& values, std::index_sequence<I...>) {
+        (void)std::initializer_list<int>{(Codec<T>::encode(buffer, std::get<I>(values)), 0)...};
+    }
+};
+
+template<typename T>
+constexpr DataType data_type_of = Codec<T>::tag;
+
+/**
+ * Decodes consecutive values of known types, e.g. decode<uint32_t, std::tuple<int8_t, Enum>> for the value
+ * and scaler_unit of a register
+ * @param offset moved past the values
+ * @throw std::invalid_argument if a value has another type
+ * @throw std::underflow_error if the values are truncated
+ */
+template<typename... T>
+auto decode(const uint8_t *data, size_t size, size_t &offset) -> std::tuple<T...> {
+    return std::tuple<T...>{Codec<T>::decode(data, size, offset)...};
+}
+
+template<typename... T>
+auto decode(std::vector<uint8_t> const& buffer) -> std::tuple<T...> {
+    auto offset = size_t{0};
+    return decode<T...>(buffer.data(), buffer.size(), offset);
+}
+
+/**
+ * Decodes consecutive values of the types T... into the fields of an aggregate, in order
+ */
+template<typename Aggregate, typename... T>
+auto decode_as(std::vector<uint8_t> const& buffer) -> Aggregate {
+    auto offset = size_t{0};
+    return Aggregate{Codec<T>::decode(buffer.data(), buffer.size(), offset)...};
+}
+
+/**
+ * Appends the encoded values to buffer
+ */
+template<typename... T>
+void encode_into(std::vector<uint8_t> &buffer, T const&... values) {
+    (void)std::initializer_list<int>{(Codec<T>::encode(buffer, values), 0)...};
+}
+
+/**
+ * Encodes values of known types one after the other, the counterpart of decode
+ */
+template<typename... T>
+auto encode(T const&... values) -> std::vector<uint8_t> {
+    std::vector<uint8_t> buffer;
+    encode_into(buffer, values...);
+    return buffer;
+}
+
 }
 
 #endif //YADI_DLMS_PARSER_H
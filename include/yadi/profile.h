@@ -0,0 +1,96 @@
+/*
+ * This file is part of the yadi.cpp project.
+ *
+ * Copyright (C) 2017 Paulo Faco <paulofaco@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef YADI_DLMS_PROFILE_H
+#define YADI_DLMS_PROFILE_H
+
+#include <yadi/date_time.h>
+#include <yadi/parser.h>
+#include <yadi/tape.h>
+#include <cstdint>
+#include <vector>
+
+namespace dlms
+{
+
+enum class ColumnType : uint8_t {
+    TIMESTAMP, ///< DATE_TIME, or OCTET_STRING of 12 bytes, as seconds since the Unix epoch in UTC
+    INT64,     ///< signed integers, and unsigned integers wider than 8 bits
+    DOUBLE,    ///< FLOAT32, FLOAT64
+    UINT8,     ///< UINT8, ENUM, BOOLEAN, BCD, e.g. a status
+};
+
+/**
+ * One captured object of a profile, a value per row. Only the vector of its type is filled.
+ */
+struct Column {
+    ColumnType type = ColumnType::INT64;
+    DataType tag = DataType::NULL_DATA; ///< encoding of the column in the buffer
+    std::vector<int64_t> integers;      ///< TIMESTAMP and INT64
+    std::vector<double> reals;          ///< DOUBLE
+    std::vector<uint8_t> bytes;         ///< UINT8
+};
+
+/**
+ * A profile-generic buffer decoded column by column. Decoding into the same instance again reuses
+ * the capacity of its columns, e.g. one instance per thread for the meters it reads.
+ */
+struct ProfileColumns {
+    std::vector<Column> columns;
+    size_t rows = 0;
+};
+
+/**
+ * Decodes a profile buffer, an array of structures of the same shape, into columns. The shape is taken
+ * from the first row; the fields of the next rows must have the same types, or be NULL_DATA as in a
+ * compressed buffer: a null value repeats the value of the previous row and a null timestamp follows
+ * the previous one by the interval between the two rows before.
+ * The buffer can also be a compact array, whose shape is given by its type description.
+ * @param offset position of the array, moved past it
+ * @throw std::invalid_argument if the buffer is not an array of structures or a row does not match the first
+ * @throw std::underflow_error if the buffer is truncated
+ */
+void decode_profile(const uint8_t *data, size_t size, size_t &offset, ProfileColumns &profile);
+void decode_profile(std::vector<uint8_t> const& buffer, ProfileColumns &profile);
+
+/**
+ * Decodes the profile buffer at an entry of a tape, see decode_profile, with its rows split between
+ * threads, e.g. for the large buffers of a data concentrator. Each thread decodes its slice of rows
+ * into its own range of the columns, sized up front, so the threads share nothing they write; null
+ * values, which depend on the rows before, are filled once all slices are done. Buffers of a few
+ * thousand rows are decoded on the calling thread.
+ * @param threads at most that many threads are used, the calling one included; 0 for one per processor
+ * @throw std::out_of_range if the tape has no such entry
+ * @throw std::invalid_argument if the buffer is not an array of structures or a row does not match the first
+ */
+void decode_profile(Tape const& tape, size_t entry, ProfileColumns &profile, unsigned threads = 0);
+
+/**
+ * Appends the rows of a profile to buffer, each field encoded as the tag of its column. A compact
+ * array drops the tags of the fields and of the rows, e.g. for a server whose clients read it over
+ * slow links. Timestamps are written in UTC.
+ * @param encoding ARRAY or COMPACT_ARRAY
+ * @throw std::invalid_argument if the tag of a column does not match its type, a column does not
+ * have a value per row, or a compact array has no column
+ */
+void encode_profile(ProfileColumns const& profile, std::vector<uint8_t> &buffer, DataType encoding = DataType::ARRAY);
+
+}
+
+#endif //YADI_DLMS_PROFILE_H
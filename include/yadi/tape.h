@@ -0,0 +1,103 @@
+/*
+ * This file is part of the yadi.cpp project.
+ *
+ * Copyright (C) 2017 Paulo Faco <paulofaco@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef YADI_DLMS_TAPE_H
+#define YADI_DLMS_TAPE_H
+
+#include <yadi/parser.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dlms
+{
+
+/**
+ * A value of an indexed buffer. The entries of the children of an array or structure follow it.
+ */
+struct TapeEntry {
+    DataType type = DataType::NULL_DATA;
+    uint32_t header = 0;   ///< bytes of the tag and length octets, and of the type description of a compact array
+    uint32_t offset = 0;   ///< position of the tag in the buffer
+    uint32_t length = 0;   ///< bytes of the value, nested values included
+    uint32_t children = 0; ///< children of an array or structure
+    uint32_t next = 0;     ///< index of the entry after the value and all values nested in it
+};
+
+/**
+ * Flat index of the values of an A-XDR buffer, built in one pass, in the order of the buffer. Once
+ * indexed, a value is reached, skipped, decoded or copied out without reading its length octets nor
+ * walking its nested values again, e.g. to hand the fields of a response to several consumers, or
+ * split a profile buffer between threads.
+ *
+ * The elements of a compact array have no tags and are not indexed; the compact array is one entry
+ * whose contents follow its header. The buffer must outlive the tape. Indexing again reuses the
+ * capacity of the tape.
+ */
+class Tape {
+public:
+    Tape() = default;
+
+    /**
+     * Indexes the values of a buffer, which can hold any number of consecutive values
+     * @throw std::underflow_error if the buffer ends within a value
+     * @throw std::invalid_argument on an unknown tag, values nested too deep, or a buffer of 4 GiB or more
+     */
+    void index(const uint8_t *data, size_t size);
+    void index(std::vector<uint8_t> const& buffer);
+
+    auto size() const -> size_t { return entries_.size(); }
+    auto begin() const -> std::vector<TapeEntry>::const_iterator { return entries_.begin(); }
+    auto end() const -> std::vector<TapeEntry>::const_iterator { return entries_.end(); }
+    auto operator[](size_t entry) const -> TapeEntry const& { return entries_[entry]; }
+
+    /**
+     * @return the entry of the child at index of an array or structure, reached through the next
+     * entry of its previous siblings
+     * @throw std::out_of_range if there are not so many children
+     */
+    auto child(size_t entry, size_t index) const -> size_t;
+
+    /**
+     * @return the contents of a value, past its header
+     */
+    auto contents(size_t entry) const -> const uint8_t* { return data_ + entries_[entry].offset + entries_[entry].header; }
+
+    /**
+     * @return the encoded value, e.g. to copy it to another buffer as is
+     */
+    auto bytes(size_t entry) const -> const uint8_t* { return data_ + entries_[entry].offset; }
+
+    auto view(size_t entry) const -> DataView;
+
+private:
+    struct Open {
+        size_t entry;
+        size_t remaining; ///< children not indexed yet
+    };
+
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+    std::vector<TapeEntry> entries_;
+    std::vector<Open> open_; ///< arrays and structures being indexed, kept for its capacity
+};
+
+}
+
+#endif //YADI_DLMS_TAPE_H
@@ -0,0 +1,68 @@
+/*
+ * This file is part of the yadi.cpp project.
+ *
+ * Copyright (C) 2017 Paulo Faco <paulofaco@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+///@file
+
+#include <yadi/arena.h>
+#include <algorithm>
+
+namespace dlms
+{
+
+    Arena::Arena(size_t block_size) :
+        block_size_{block_size}
+    {
+    }
+
+    /**
+     * Takes the next block that fits once the current one is full. A block of the default size, or
+     * larger for an oversized request, is added when none is left.
+     */
+    auto Arena::allocate(size_t size, size_t alignment) -> void* {
+        for (; current_ < blocks_.size(); ++current_, used_ = 0) {
+            auto &block = blocks_[current_];
+            auto address = reinterpret_cast<uintptr_t>(block.data.get()) + used_;
+            auto padding = (alignment - address % alignment) % alignment;
+            if (used_ + padding + size <= block.size) {
+                used_ += padding + size;
+                return block.data.get() + used_ - size;
+            }
+        }
+        auto block_size = std::max(block_size_, size + alignment);
+        blocks_.push_back(Block{std::unique_ptr<uint8_t[]>{new uint8_t[block_size]}, block_size});
+        current_ = blocks_.size() - 1;
+        used_ = 0;
+        return allocate(size, alignment);
+    }
+
+    void Arena::reset() {
+        current_ = 0;
+        used_ = 0;
+    }
+
+    auto Arena::capacity() const -> size_t {
+        size_t capacity = 0;
+        for (auto const& block : blocks_) {
+            capacity += block.size;
+        }
+        return capacity;
+    }
+
+}
@@ -22,6 +22,9 @@
 #include <yadi/cosem.h>
 #include <yadi/parser.h>
 #include "security.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
 
 namespace dlms
 {
@@ -42,6 +45,10 @@ enum AARQ : unsigned int {
 enum AARE : unsigned int {
     AARE_APPLICATION_1 = 97,
     AARE_APP_CONTEXT_NAME = 1,
+    AARE_RESULT = 2,
+    AARE_RESPONDING_AP_TITLE = 4,
+    AARE_RESPONDING_AUTHENTICATION_VALUE = 10,
+    AARE_USER_INFORMATION = 30,
 };
 
 enum BER : unsigned int {
@@ -73,9 +80,18 @@ enum XDLMS : unsigned int {
     XDLMS_GLOBAL_CIPHERING_SET_RESPONSE = 205,
     XDLMS_GLOBAL_CIPHERING_ACTION_RESPONSE = 207,
 
+    XDLMS_DEDICATED_CIPHERING_GET_REQUEST = 208,
+    XDLMS_DEDICATED_CIPHERING_SET_REQUEST = 209,
+    XDLMS_DEDICATED_CIPHERING_ACTION_REQUEST = 211,
+    XDLMS_DEDICATED_CIPHERING_GET_RESPONSE = 212,
+    XDLMS_DEDICATED_CIPHERING_SET_RESPONSE = 213,
+    XDLMS_DEDICATED_CIPHERING_ACTION_RESPONSE = 215,
+
+    XDLMS_GENERAL_BLOCK_TRANSFER = 224,
+
     XDLMS_HIGH_PRIORITY = 128,
     XDLMS_SERVICE_CONFIRMED = 64,
-    XDLMS_INVOKE_ID = 1
+    XDLMS_INVOKE_ID_MASK = 15
 };
 
 /**
@@ -83,6 +99,7 @@ enum XDLMS : unsigned int {
  */
 enum ConformanceBlock : unsigned int {
     TAG = 95,
+    GENERAL_BLOCK_TRANSFER = 1u << 2u,
     //READ = 1u << 3u,
     //WRITE = 1u << 4u,
     //UNCONFIRMED_WRITE = 1u << 5u,
@@ -102,7 +119,54 @@ enum ConformanceBlock : unsigned int {
     ACTION = 1u << 23u,
 };
 
-static void serialize_invoke_id_and_cosem_descriptor(std::vector<uint8_t> &buffer, Request const& req);
+/*
+ * Normal request layout: tag, choice, invoke-id-and-priority, class-id(2), logical name(6), attribute or method,
+ * access selection or parameters flag, data
+ */
+static const auto REQUEST_INVOKE_ID_OFFSET = size_t{2};
+static const auto REQUEST_DATA_OFFSET = size_t{13};
+
+static void serialize_invoke_id_and_cosem_descriptor(std::vector<uint8_t> &buffer, uint8_t invoke_id, Request const& req);
+static auto serialize_plain_request(RequestType type, uint8_t invoke_id, Request const& req) -> std::vector<uint8_t>;
+static void parse_initiate_response(Cosem &cosem, std::vector<uint8_t> const& data);
+
+/**
+ * Ciphers the request if the association is secured, with the dedicated key if one was agreed in the AARQ
+ */
+static void protect(Cosem &cosem, uint8_t glo_tag, uint8_t ded_tag, std::vector<uint8_t> &apdu)
+{
+    if (cosem.parameters.security != SecurityContext::NONE) {
+        Security::cipher(cosem, cosem.parameters.dedicated_key ? ded_tag : glo_tag, apdu);
+    }
+}
+
+/**
+ * Reserves a free invoke-id for a new confirmed request, so several requests can be outstanding in the same
+ * association and their responses matched by invoke-id. The reserved id is used by the next serialized request
+ * and is released when its response is parsed.
+ *
+ * Requests serialized without calling this function keep reusing the current invoke-id.
+ *
+ * @return the reserved invoke-id
+ */
+auto allocate_invoke_id(Cosem &cosem) -> uint8_t
+{
+    auto &ctx = cosem.context;
+    for (auto i = 1U; i <= XDLMS_INVOKE_ID_MASK + 1; ++i) {
+        auto id = static_cast<uint8_t>((ctx.invoke_id + i) & XDLMS_INVOKE_ID_MASK);
+        if ((ctx.pending_invoke_ids & (1U << id)) == 0) {
+            ctx.pending_invoke_ids |= static_cast<uint16_t>(1U << id);
+            ctx.invoke_id = id;
+            return id;
+        }
+    }
+    throw std::runtime_error("no invoke-id available");
+}
+
+void release_invoke_id(Cosem &cosem, uint8_t invoke_id)
+{
+    cosem.context.pending_invoke_ids &= static_cast<uint16_t>(~(1U << (invoke_id & XDLMS_INVOKE_ID_MASK)));
+}
 
 /*
  * Application Association Request - AARQ
@@ -145,6 +209,9 @@ auto serialize_aarq(Cosem &cosem) -> std::vector<uint8_t>
 	auto buffer = std::vector<uint8_t>{};
     CosemParameters& params_ = cosem.parameters;
 
+    //a new association has no outstanding request
+    cosem.context.pending_invoke_ids = 0;
+
     buffer.push_back(BER_CONSTRUCTED | BER_CLASS_APPLICATION);
     buffer.push_back(0); //aarq size, will be updated later
 
@@ -170,7 +237,8 @@ auto serialize_aarq(Cosem &cosem) -> std::vector<uint8_t>
     //called-AP-invocation-id      [4]          AP-invocation-identifier OPTIONAL,
     //called-AE-invocation-id      [5]          AE-invocation-identifier OPTIONAL,
 
-    if (params_.security != SecurityContext::NONE || params_.authentication == AuthenticationMechanism::HLS_GMAC) {
+    if (params_.security != SecurityContext::NONE || params_.authentication == AuthenticationMechanism::HLS_GMAC ||
+        params_.authentication == AuthenticationMechanism::HLS_SHA256) {
         //calling-AP-title             [6]          AP-title OPTIONAL,
         buffer.push_back(BER_CLASS_CONTEXT | BER_CONSTRUCTED | AARQ_CALLING_AP_TITLE);
         buffer.push_back(static_cast<uint8_t>(params_.system_title.size() + 2));
@@ -209,7 +277,10 @@ auto serialize_aarq(Cosem &cosem) -> std::vector<uint8_t>
             buffer.push_back(static_cast<uint8_t>(params_.challenger_size + 2));
             buffer.push_back(BER_CLASS_CONTEXT);
             buffer.push_back(static_cast<uint8_t>(params_.challenger_size));
-            Security::generate_challenger(params_.challenger_size, buffer);
+            auto offset = buffer.size();
+            buffer.resize(offset + params_.challenger_size);
+            Security::generate_challenger(buffer.data() + offset, params_.challenger_size);
+            cosem.context.client_challenger.assign(buffer.begin() + offset, buffer.end());
         }
     }
 
@@ -224,25 +295,43 @@ auto serialize_aarq(Cosem &cosem) -> std::vector<uint8_t>
     conformance_block |= ConformanceBlock::BLOCK_TRANSFER_WITH_GET_OR_READ;
     conformance_block |= ConformanceBlock::BLOCK_TRANSFER_WITH_SET_OR_WRITE;
     conformance_block |= ConformanceBlock::BLOCK_TRANSFER_WITH_ACTION;
+    if (params_.gbt_window_size != 0) {
+        conformance_block |= ConformanceBlock::GENERAL_BLOCK_TRANSFER;
+    }
+
+    //xDLMS InitiateRequest, glo-ciphered if the association is secured
+    auto initiate_request = std::vector<uint8_t>{};
+    initiate_request.push_back(XDLMS_NO_CIPHERING_INITIATE_REQUEST);
+    if (params_.dedicated_key && params_.security != SecurityContext::NONE) {
+        Security::generate_dedicated_key(cosem);
+        initiate_request.push_back(1U); //Dedicated key
+        initiate_request.push_back(static_cast<uint8_t>(cosem.context.dek.size()));
+        initiate_request.insert(initiate_request.end(), cosem.context.dek.begin(), cosem.context.dek.end());
+    } else {
+        initiate_request.push_back(0U); //Dedicated key
+    }
+    initiate_request.push_back(0U); //Response-allowed
+    initiate_request.push_back(0U); //Proposed quality of service
+    initiate_request.push_back(XDLMS_VERSION);
+    initiate_request.push_back(ConformanceBlock::TAG);
+    initiate_request.push_back(4U); //conformance block size
+    initiate_request.push_back(static_cast<uint8_t>(conformance_block >> 24U));
+    initiate_request.push_back(static_cast<uint8_t>(conformance_block >> 16U));
+    initiate_request.push_back(static_cast<uint8_t>(conformance_block >> 8U));
+    initiate_request.push_back(static_cast<uint8_t>(conformance_block));
+    initiate_request.push_back(0xFFU); //max-pdu size MSB
+    initiate_request.push_back(0xFFU); //max-pdu size LSB
+    if (params_.security != SecurityContext::NONE) {
+        Security::expand_keys(cosem);
+        Security::cipher(cosem, XDLMS_GLOBAL_CIPHERING_INITIATE_REQUEST, initiate_request);
+    }
 
     //user-information             [30] EXPLICIT Association-information OPTIONAL
     buffer.push_back(BER_CLASS_CONTEXT | BER_CONSTRUCTED | AARQ_USER_INFORMATION);
-    buffer.push_back(15U);
+    buffer.push_back(static_cast<uint8_t>(initiate_request.size() + 2));
     buffer.push_back(BER_OCTET_STRING);
-    buffer.push_back(13U);
-    buffer.push_back(XDLMS_NO_CIPHERING_INITIATE_REQUEST);
-    buffer.push_back(0U); //Dedicated key
-    buffer.push_back(0U); //Response-allowed
-    buffer.push_back(0U); //Proposed quality of service
-    buffer.push_back(XDLMS_VERSION);
-    buffer.push_back(ConformanceBlock::TAG);
-    buffer.push_back(4U); //conformance block size
-    buffer.push_back(static_cast<uint8_t>(conformance_block >> 24U));
-    buffer.push_back(static_cast<uint8_t>(conformance_block >> 16U));
-    buffer.push_back(static_cast<uint8_t>(conformance_block >> 8U));
-    buffer.push_back(static_cast<uint8_t>(conformance_block));
-    buffer.push_back(0xFFU); //max-pdu size MSB
-    buffer.push_back(0xFFU); //max-pdu size LSB
+    buffer.push_back(static_cast<uint8_t>(initiate_request.size()));
+    buffer.insert(buffer.end(), initiate_request.begin(), initiate_request.end());
 
     // Add correct frame size
     buffer[1] = static_cast<uint8_t>(buffer.size() - 2);
@@ -284,12 +373,8 @@ auto serialize_aarq(Cosem &cosem) -> std::vector<uint8_t>
  */
 auto serialize_get_request(Cosem &cosem, const Request& req) -> std::vector<uint8_t>
 {
-	auto buffer = std::vector<uint8_t>{};
-    buffer.push_back(XDLMS_NO_CIPHERING_GET_REQUEST);
-    buffer.push_back(1);
-    serialize_invoke_id_and_cosem_descriptor(buffer, req);
-    buffer.push_back(req.data.empty() ? static_cast<uint8_t>(0U) : static_cast<uint8_t>(1U));
-    buffer.insert(buffer.end(), req.data.begin(), req.data.end());
+    auto buffer = serialize_plain_request(RequestType::GET, cosem.context.invoke_id, req);
+    protect(cosem, XDLMS_GLOBAL_CIPHERING_GET_REQUEST, XDLMS_DEDICATED_CIPHERING_GET_REQUEST, buffer);
     return buffer;
 }
 
@@ -346,12 +431,8 @@ auto serialize_get_request(Cosem &cosem, const Request& req) -> std::vector<uint
  */
 auto serialize_set_request(Cosem &cosem, const Request& req) -> std::vector<uint8_t>
 {
-	auto buffer = std::vector<uint8_t>{};
-    buffer.push_back(XDLMS_NO_CIPHERING_SET_REQUEST);
-    buffer.push_back(1);
-    serialize_invoke_id_and_cosem_descriptor(buffer, req);
-    buffer.push_back(0);
-    buffer.insert(buffer.end(), req.data.begin(), req.data.end());
+    auto buffer = serialize_plain_request(RequestType::SET, cosem.context.invoke_id, req);
+    protect(cosem, XDLMS_GLOBAL_CIPHERING_SET_REQUEST, XDLMS_DEDICATED_CIPHERING_SET_REQUEST, buffer);
     return buffer;
 }
 
@@ -413,12 +494,8 @@ auto serialize_set_request(Cosem &cosem, const Request& req) -> std::vector<uint
  */
  auto serialize_action_request(Cosem &cosem, const Request& req) -> std::vector<uint8_t>
  {
-	 auto buffer = std::vector<uint8_t>{};
-     buffer.push_back(XDLMS_NO_CIPHERING_ACTION_REQUEST);
-     buffer.push_back(1);
-     serialize_invoke_id_and_cosem_descriptor(buffer, req);
-     buffer.push_back(req.data.empty() ? static_cast<uint8_t>(0U) : static_cast<uint8_t>(1U));
-     buffer.insert(buffer.end(), req.data.begin(), req.data.end());
+     auto buffer = serialize_plain_request(RequestType::ACTION, cosem.context.invoke_id, req);
+     protect(cosem, XDLMS_GLOBAL_CIPHERING_ACTION_REQUEST, XDLMS_DEDICATED_CIPHERING_ACTION_REQUEST, buffer);
      return buffer;
  }
 
@@ -458,7 +535,117 @@ auto serialize_set_request(Cosem &cosem, const Request& req) -> std::vector<uint
  */
 auto parse_aare(Cosem &cosem, const std::vector<uint8_t>& data) -> AssociationResult
 {
-    return AssociationResult::ACCEPTED;
+    auto read_length = [&data](size_t &offset) -> size_t {
+        if (offset >= data.size()) {
+            throw InvalidCosemFrame{};
+        }
+        size_t length = data[offset++];
+        if (length & 0x80U) {
+            auto octets = length & 0x7FU;
+            if (octets > 2 || offset + octets > data.size()) {
+                throw InvalidCosemFrame{};
+            }
+            length = 0;
+            while (octets-- != 0) {
+                length = length << 8U | data[offset++];
+            }
+        }
+        if (offset + length > data.size()) {
+            throw InvalidCosemFrame{};
+        }
+        return length;
+    };
+
+    if (data.size() < 2 || data[0] != (BER_CONSTRUCTED | AARE_APPLICATION_1)) {
+        throw InvalidCosemFrame{};
+    }
+
+    auto offset = size_t{1};
+    auto end = offset + read_length(offset);
+    auto result = -1;
+
+    while (offset < end) {
+        auto tag = data[offset++];
+        auto length = read_length(offset);
+        auto value = data.begin() + offset;
+
+        switch (tag) {
+        case BER_CLASS_CONTEXT | BER_CONSTRUCTED | AARE_RESULT:
+            //result [2] Association-result ::= INTEGER
+            if (length < 3) {
+                throw InvalidCosemFrame{};
+            }
+            result = value[2];
+            break;
+
+        case BER_CLASS_CONTEXT | BER_CONSTRUCTED | AARE_RESPONDING_AP_TITLE:
+            //responding-AP-title [4] AP-title ::= OCTET STRING
+            if (length == cosem.context.server_system_title.size() + 2) {
+                std::copy_n(value + 2, cosem.context.server_system_title.size(), cosem.context.server_system_title.begin());
+            }
+            break;
+
+        case BER_CLASS_CONTEXT | BER_CONSTRUCTED | AARE_RESPONDING_AUTHENTICATION_VALUE:
+            //responding-authentication-value [10] Authentication-value ::= CHOICE { charstring [0] ... }
+            if (length >= 2 && value[1] + 2U <= length) {
+                cosem.context.server_challenger.assign(value + 2, value + 2 + value[1]);
+            }
+            break;
+
+        case BER_CLASS_CONTEXT | BER_CONSTRUCTED | AARE_USER_INFORMATION:
+            //user-information [30] Association-information ::= OCTET STRING
+            if (length > 2 && value[0] == BER_OCTET_STRING) {
+                auto initiate_response = std::vector<uint8_t>(value + 2, value + length);
+                if (initiate_response[0] == XDLMS_GLOBAL_CIPHERING_INITIATE_RESPONSE) {
+                    Security::decipher(cosem, initiate_response);
+                }
+                parse_initiate_response(cosem, initiate_response);
+            }
+            break;
+        }
+
+        offset += length;
+    }
+
+    if (result < 0) {
+        throw InvalidCosemFrame{};
+    }
+    return static_cast<AssociationResult>(result);
+}
+
+/**
+ * InitiateResponse ::= SEQUENCE
+ * {
+ *     negotiated-quality-of-service   [0] IMPLICIT Integer8 OPTIONAL,
+ *     negotiated-dlms-version-number      Unsigned8,
+ *     negotiated-conformance              Conformance, -- Shall be encoded in BER
+ *     server-max-receive-pdu-size         Unsigned16,
+ *     vaa-name                            ObjectName
+ * }
+ *
+ * Only the max pdu size is kept, it limits the size of the requests sent to the server.
+ */
+static void parse_initiate_response(Cosem &cosem, std::vector<uint8_t> const& data)
+{
+    if (data.size() < 2 || data[0] != XDLMS_NO_CIPHERING_INITIATE_RESPONSE) {
+        return;
+    }
+    auto offset = size_t{data[1] != 0 ? 3U : 2U};
+    offset += 1; //dlms version
+    if (offset + 2 > data.size() || data[offset] != ConformanceBlock::TAG) {
+        return;
+    }
+    offset += (data[offset + 1] == 0x1F) ? 2 : 1;
+    if (offset >= data.size()) {
+        return;
+    }
+    offset += 1 + data[offset];
+    if (offset + 2 <= data.size()) {
+        auto max_pdu_size = static_cast<uint16_t>(data[offset] << 8U | data[offset + 1]);
+        if (max_pdu_size != 0) {
+            cosem.context.max_pdu_size = max_pdu_size;
+        }
+    }
 }
 
 /**
@@ -468,12 +655,20 @@ auto parse_aare(Cosem &cosem, const std::vector<uint8_t>& data) -> AssociationRe
  */
 auto parse_get_response(Cosem &cosem, const std::vector<uint8_t>& data) -> Response
 {
+    if (!data.empty() && (data[0] == XDLMS_GLOBAL_CIPHERING_GET_RESPONSE || data[0] == XDLMS_DEDICATED_CIPHERING_GET_RESPONSE)) {
+        auto plain = data;
+        Security::decipher(cosem, plain);
+        return parse_get_response(cosem, plain);
+    }
+
     if (data.size() < 4 || data[0] != XDLMS_NO_CIPHERING_GET_RESPONSE || data[1] != 0x01) {
         throw InvalidCosemFrame{};
     }
 
     Response response;
     response.result = static_cast<DataAccessResult>(data[3]);
+    response.invoke_id = data[2] & XDLMS_INVOKE_ID_MASK;
+    release_invoke_id(cosem, response.invoke_id);
     auto begin = std::begin(data) + 4;
     auto end = std::end(data);
     if (end > begin) {
@@ -483,6 +678,420 @@ auto parse_get_response(Cosem &cosem, const std::vector<uint8_t>& data) -> Respo
     return response;
 }
 
+/**
+ * Parses a Set-Response
+ *
+ * Set-Response-Normal ::= SEQUENCE
+ * {
+ *     invoke-id-and-priority      Invoke-Id-And-Priority,
+ *     result                      Data-Access-Result
+ * }
+ *
+ * @param data
+ * @return
+ */
+auto parse_set_response(Cosem &cosem, const std::vector<uint8_t>& data) -> Response
+{
+    if (!data.empty() && (data[0] == XDLMS_GLOBAL_CIPHERING_SET_RESPONSE || data[0] == XDLMS_DEDICATED_CIPHERING_SET_RESPONSE)) {
+        auto plain = data;
+        Security::decipher(cosem, plain);
+        return parse_set_response(cosem, plain);
+    }
+
+    if (data.size() < 4 || data[0] != XDLMS_NO_CIPHERING_SET_RESPONSE || data[1] != 0x01) {
+        throw InvalidCosemFrame{};
+    }
+
+    Response response;
+    response.result = static_cast<DataAccessResult>(data[3]);
+    response.invoke_id = data[2] & XDLMS_INVOKE_ID_MASK;
+    release_invoke_id(cosem, response.invoke_id);
+    return response;
+}
+
+/**
+ * Parses an Action-Response
+ *
+ * Action-Response-Normal ::= SEQUENCE
+ * {
+ *     invoke-id-and-priority      Invoke-Id-And-Priority,
+ *     single-response             Action-Response-With-Optional-Data
+ * }
+ *
+ * Action-Response-With-Optional-Data ::= SEQUENCE
+ * {
+ *     result                      Action-Result,
+ *     return-parameters           Get-Data-Result OPTIONAL
+ * }
+ *
+ * @param data
+ * @return a Response whose data holds the return parameters, if any
+ */
+auto parse_action_response(Cosem &cosem, const std::vector<uint8_t>& data) -> Response
+{
+    if (!data.empty() && (data[0] == XDLMS_GLOBAL_CIPHERING_ACTION_RESPONSE || data[0] == XDLMS_DEDICATED_CIPHERING_ACTION_RESPONSE)) {
+        auto plain = data;
+        Security::decipher(cosem, plain);
+        return parse_action_response(cosem, plain);
+    }
+
+    if (data.size() < 4 || data[0] != XDLMS_NO_CIPHERING_ACTION_RESPONSE || data[1] != 0x01) {
+        throw InvalidCosemFrame{};
+    }
+
+    Response response;
+    response.result = static_cast<DataAccessResult>(data[3]);
+    response.invoke_id = data[2] & XDLMS_INVOKE_ID_MASK;
+    release_invoke_id(cosem, response.invoke_id);
+    if (data.size() > 6 && data[4] == 0x01 && data[5] == 0x00) {
+        response.data.insert(response.data.end(), data.begin() + 6, data.end());
+    }
+    return response;
+}
+
+/**
+ * HLS pass 3: the client answers the server challenge (StoC) by invoking the reply_to_HLS_authentication
+ * method (1) of the current Association LN object, with f(StoC) as parameter.
+ */
+auto serialize_reply_to_hls_authentication(Cosem &cosem) -> std::vector<uint8_t>
+{
+    auto request = Request{ClassID::ASSOCIATION_LN, {0, 0, 40, 0, 0, 255}, 1, from_bytes(Security::process_challenger(cosem))};
+    return serialize_action_request(cosem, request);
+}
+
+/**
+ * HLS pass 3 for many associations, e.g. when a poller connects to a batch of meters. The answers are
+ * computed together, which lets challenges of the same hash mechanism share the hashing work.
+ * Sessions without HLS get an empty request, so requests stay aligned with sessions.
+ */
+auto serialize_reply_to_hls_authentication(std::vector<Cosem*> const& sessions) -> std::vector<std::vector<uint8_t>>
+{
+    auto answers = Security::process_challengers(sessions);
+    auto requests = std::vector<std::vector<uint8_t>>{};
+    requests.reserve(sessions.size());
+    for (size_t i = 0; i < sessions.size(); ++i) {
+        if (answers[i].empty()) {
+            requests.emplace_back();
+            continue;
+        }
+        auto request = Request{ClassID::ASSOCIATION_LN, {0, 0, 40, 0, 0, 255}, 1, from_bytes(answers[i])};
+        requests.push_back(serialize_action_request(*sessions[i], request));
+    }
+    return requests;
+}
+
+/**
+ * HLS pass 4: the server answers with f(CtoS), which authenticates the server to the client.
+ * @return true if the server accepted f(StoC) and its f(CtoS) is valid
+ */
+auto parse_reply_to_hls_authentication(Cosem &cosem, const std::vector<uint8_t>& data) -> bool
+{
+    auto response = parse_action_response(cosem, data);
+    if (response.result != DataAccessResult::SUCCESS) {
+        return false;
+    }
+    auto offset = size_t{1};
+    if (response.data.size() < 2 || response.data[0] != static_cast<uint8_t>(DataType::OCTET_STRING)) {
+        return false;
+    }
+    auto size = read_size(response.data, offset);
+    if (offset + size != response.data.size()) {
+        return false;
+    }
+    return Security::verify_challenger(cosem, std::vector<uint8_t>(response.data.begin() + offset, response.data.end()));
+}
+
+/**
+ * General-Block-Transfer - GBT
+ *
+ * GBT carries any xDLMS APDU split in blocks. With streaming the sender transmits a whole window of blocks
+ * without waiting for an acknowledgement; the receiver only acknowledges the last block of each window.
+ * Lost blocks are recovered by acknowledging the last block received in sequence, the peer then resends
+ * every block after it.
+ *
+ * General-Block-Transfer ::= [224] IMPLICIT SEQUENCE
+ * {
+ *     block-control       Unsigned8,  -- bit 7: last-block, bit 6: streaming, bits 0-5: window
+ *     block-number        Unsigned16,
+ *     block-number-ack    Unsigned16,
+ *     block-data          OCTET STRING
+ * }
+ */
+static const auto GBT_LAST_BLOCK = uint8_t{0x80};
+static const auto GBT_STREAMING = uint8_t{0x40};
+static const auto GBT_WINDOW_MASK = uint8_t{0x3F};
+static const auto GBT_HEADER_SIZE = size_t{9}; // tag, control, block numbers and up to 3 length octets
+
+static void serialize_gbt_block(std::vector<uint8_t> &buffer, uint8_t control, uint16_t block_number,
+                                uint16_t block_number_ack, const uint8_t *data, size_t size)
+{
+    buffer.push_back(XDLMS_GENERAL_BLOCK_TRANSFER);
+    buffer.push_back(control);
+    buffer.push_back(static_cast<uint8_t>(block_number >> 8U));
+    buffer.push_back(static_cast<uint8_t>(block_number));
+    buffer.push_back(static_cast<uint8_t>(block_number_ack >> 8U));
+    buffer.push_back(static_cast<uint8_t>(block_number_ack));
+    write_size(buffer, size);
+    buffer.insert(buffer.end(), data, data + size);
+}
+
+auto is_gbt(const std::vector<uint8_t>& data) -> bool
+{
+    return !data.empty() && data[0] == XDLMS_GENERAL_BLOCK_TRANSFER;
+}
+
+static auto gbt_block_size(Cosem const& cosem) -> size_t
+{
+    return cosem.context.max_pdu_size > GBT_HEADER_SIZE ? cosem.context.max_pdu_size - GBT_HEADER_SIZE : size_t{1};
+}
+
+/**
+ * @return the number of GBT blocks an APDU is split in to fit in the negotiated max-pdu-size
+ */
+auto gbt_block_count(Cosem const& cosem, const std::vector<uint8_t>& apdu) -> size_t
+{
+    auto block_size = gbt_block_size(cosem);
+    return std::max<size_t>((apdu.size() + block_size - 1) / block_size, 1U);
+}
+
+/**
+ * Serializes the window of GBT blocks of an APDU starting at block index first, block first + 1 on the wire.
+ * The window is as large as the last one announced by the server: every block of it but the last is flagged
+ * as streaming, so the window is sent without waiting for acknowledgements, and the last block of the APDU
+ * is flagged as last. The flags are set per window sent, so they follow the window of the server once its
+ * first acknowledgement is parsed, and blocks resent after a loss start a new window.
+ * @return the serialized blocks, in order
+ */
+auto serialize_gbt(Cosem &cosem, const std::vector<uint8_t>& apdu, size_t first) -> std::vector<std::vector<uint8_t>>
+{
+    auto &gbt = cosem.context.gbt;
+    auto block_size = gbt_block_size(cosem);
+    auto count = gbt_block_count(cosem, apdu);
+    auto window = static_cast<uint8_t>(cosem.parameters.gbt_window_size & GBT_WINDOW_MASK);
+    auto end = std::min(count, first + std::max<size_t>(gbt.peer_window, 1U));
+    auto blocks = std::vector<std::vector<uint8_t>>{};
+
+    for (auto i = first; i < end; ++i) {
+        auto offset = i * block_size;
+        auto size = std::min(block_size, apdu.size() - offset);
+        auto control = window;
+        if (i + 1 == count) {
+            control |= GBT_LAST_BLOCK;
+        } else if (i + 1 != end) {
+            control |= GBT_STREAMING;
+        }
+        gbt.block_number = static_cast<uint16_t>(i + 1);
+        blocks.emplace_back();
+        serialize_gbt_block(blocks.back(), control, gbt.block_number, gbt.block_number_ack, apdu.data() + offset, size);
+    }
+
+    return blocks;
+}
+
+/**
+ * Serializes an empty GBT block acknowledging the last block received in sequence. It is sent at the end of
+ * each window, or after a lost block, in which case the server resends the blocks following the acknowledged one.
+ */
+auto serialize_gbt_ack(Cosem &cosem) -> std::vector<uint8_t>
+{
+    auto &gbt = cosem.context.gbt;
+    auto buffer = std::vector<uint8_t>{};
+    auto control = static_cast<uint8_t>((cosem.parameters.gbt_window_size & GBT_WINDOW_MASK) | GBT_LAST_BLOCK);
+    serialize_gbt_block(buffer, control, ++gbt.block_number, gbt.block_number_ack, nullptr, 0);
+    return buffer;
+}
+
+/**
+ * Parses a GBT block received from the server. The block data is handed to the consumer only if it is the next
+ * block in sequence, duplicated and out of order blocks are dropped and recovered by the next acknowledgement.
+ * @return what the client has to do next
+ */
+auto parse_gbt(Cosem &cosem, const std::vector<uint8_t>& data, BlockConsumer const& consumer) -> GbtStatus
+{
+    if (data.size() < 7 || data[0] != XDLMS_GENERAL_BLOCK_TRANSFER) {
+        throw InvalidCosemFrame{};
+    }
+
+    auto &gbt = cosem.context.gbt;
+    auto control = data[1];
+    auto block_number = static_cast<uint16_t>(data[2] << 8U | data[3]);
+    auto block_number_ack = static_cast<uint16_t>(data[4] << 8U | data[5]);
+    auto offset = size_t{6};
+    auto size = read_size(data, offset);
+    if (offset + size > data.size()) {
+        throw InvalidCosemFrame{};
+    }
+
+    if ((control & GBT_WINDOW_MASK) != 0) {
+        gbt.peer_window = control & GBT_WINDOW_MASK;
+    }
+    gbt.peer_block_number_ack = block_number_ack;
+
+    if (block_number != static_cast<uint16_t>(gbt.block_number_ack + 1)) {
+        return (control & GBT_STREAMING) ? GbtStatus::RECEIVING : GbtStatus::WINDOW_COMPLETE;
+    }
+
+    gbt.block_number_ack = block_number;
+    if (size != 0 && consumer) {
+        consumer(data.data() + offset, size);
+    }
+
+    if (control & GBT_LAST_BLOCK) {
+        return GbtStatus::LAST_BLOCK;
+    }
+    return (control & GBT_STREAMING) ? GbtStatus::RECEIVING : GbtStatus::WINDOW_COMPLETE;
+}
+
+static const auto GET_RESPONSE_HEADER_SIZE = size_t{4}; // tag, type, invoke-id-and-priority and result choice
+
+GetResponseStream::GetResponseStream(Cosem &cosem, BlockConsumer consumer) :
+    cosem_(cosem), consumer_{std::move(consumer)}
+{
+}
+
+void GetResponseStream::operator()(const uint8_t *data, size_t size)
+{
+    if (!ciphered_.empty() || (header_.empty() && size != 0 && (data[0] == XDLMS_GLOBAL_CIPHERING_GET_RESPONSE ||
+                                                               data[0] == XDLMS_DEDICATED_CIPHERING_GET_RESPONSE))) {
+        ciphered_.insert(ciphered_.end(), data, data + size);
+        return;
+    }
+    if (header_.size() < GET_RESPONSE_HEADER_SIZE) {
+        auto count = std::min(size, GET_RESPONSE_HEADER_SIZE - header_.size());
+        header_.insert(header_.end(), data, data + count);
+        data += count;
+        size -= count;
+        if (header_.size() < GET_RESPONSE_HEADER_SIZE) {
+            return;
+        }
+        if (header_[0] != XDLMS_NO_CIPHERING_GET_RESPONSE || header_[1] != 0x01) {
+            throw InvalidCosemFrame{};
+        }
+    }
+    if (size == 0) {
+        return;
+    }
+    if (header_[3] == static_cast<uint8_t>(DataAccessResult::SUCCESS)) {
+        consumer_(data, size);
+    } else {
+        result_.insert(result_.end(), data, data + size);
+    }
+}
+
+auto GetResponseStream::finish() -> Response
+{
+    if (!ciphered_.empty()) {
+        auto plain = std::move(ciphered_);
+        ciphered_.clear();
+        Security::decipher(cosem_, plain);
+        (*this)(plain.data(), plain.size());
+    }
+    if (header_.size() < GET_RESPONSE_HEADER_SIZE) {
+        throw InvalidCosemFrame{};
+    }
+    Response response;
+    response.result = static_cast<DataAccessResult>(header_[3]);
+    response.invoke_id = header_[2] & XDLMS_INVOKE_ID_MASK;
+    release_invoke_id(cosem_, response.invoke_id);
+    response.data = result_;
+    return response;
+}
+
+/**
+ * Normal get, set or action request, not ciphered. The access selection of a get request and the
+ * invocation parameters of an action are taken from Request::data, and are optional.
+ */
+static auto serialize_plain_request(RequestType type, uint8_t invoke_id, Request const& req) -> std::vector<uint8_t>
+{
+    auto buffer = std::vector<uint8_t>{};
+    buffer.reserve(REQUEST_DATA_OFFSET + req.data.size());
+    switch (type) {
+        case RequestType::GET:
+            buffer.push_back(XDLMS_NO_CIPHERING_GET_REQUEST);
+            break;
+        case RequestType::SET:
+            buffer.push_back(XDLMS_NO_CIPHERING_SET_REQUEST);
+            break;
+        case RequestType::ACTION:
+            buffer.push_back(XDLMS_NO_CIPHERING_ACTION_REQUEST);
+            break;
+    }
+    buffer.push_back(1);
+    serialize_invoke_id_and_cosem_descriptor(buffer, invoke_id, req);
+    if (type == RequestType::SET) {
+        buffer.push_back(0);
+    } else {
+        buffer.push_back(req.data.empty() ? static_cast<uint8_t>(0U) : static_cast<uint8_t>(1U));
+    }
+    buffer.insert(buffer.end(), req.data.begin(), req.data.end());
+    return buffer;
+}
+
+/*
+ * The template keeps the plain APDU serialized with invoke-id 0. Framing it copies the APDU after room
+ * for the ciphering header, then stores the invoke-id and the field values, and ciphers it in place.
+ */
+RequestTemplate::RequestTemplate(RequestType type, Request const& request) :
+    plain_{serialize_plain_request(type, 0, request)}
+{
+    switch (type) {
+        case RequestType::GET:
+            glo_tag_ = XDLMS_GLOBAL_CIPHERING_GET_REQUEST;
+            ded_tag_ = XDLMS_DEDICATED_CIPHERING_GET_REQUEST;
+            break;
+        case RequestType::SET:
+            glo_tag_ = XDLMS_GLOBAL_CIPHERING_SET_REQUEST;
+            ded_tag_ = XDLMS_DEDICATED_CIPHERING_SET_REQUEST;
+            break;
+        case RequestType::ACTION:
+            glo_tag_ = XDLMS_GLOBAL_CIPHERING_ACTION_REQUEST;
+            ded_tag_ = XDLMS_DEDICATED_CIPHERING_ACTION_REQUEST;
+            break;
+    }
+}
+
+auto RequestTemplate::add_field(size_t offset, size_t size) -> size_t
+{
+    if (REQUEST_DATA_OFFSET + offset + size > plain_.size()) {
+        throw std::out_of_range("field outside of the request data");
+    }
+    fields_.push_back(Field{REQUEST_DATA_OFFSET + offset, size});
+    return fields_.size() - 1;
+}
+
+void RequestTemplate::serialize(Cosem &cosem, std::vector<uint8_t> &apdu, std::initializer_list<const uint8_t*> values) const
+{
+    if (values.size() != fields_.size()) {
+        throw std::invalid_argument("one value is needed per request template field");
+    }
+
+    auto secured = cosem.parameters.security != SecurityContext::NONE;
+    auto header = size_t{0};
+    auto trailer = size_t{0};
+    if (secured) {
+        Security::framing(cosem, plain_.size(), header, trailer);
+    }
+    apdu.resize(header + plain_.size() + trailer);
+    auto plain = apdu.data() + header;
+    std::memcpy(plain, plain_.data(), plain_.size());
+    plain[REQUEST_INVOKE_ID_OFFSET] = static_cast<uint8_t>(XDLMS_HIGH_PRIORITY | XDLMS_SERVICE_CONFIRMED |
+                                                           (cosem.context.invoke_id & XDLMS_INVOKE_ID_MASK));
+    auto value = values.begin();
+    for (auto const& field : fields_) {
+        std::memcpy(plain + field.offset, *value++, field.size);
+    }
+    if (secured) {
+        Security::cipher(cosem, cosem.parameters.dedicated_key ? ded_tag_ : glo_tag_, apdu.data(), plain_.size());
+    }
+}
+
+auto RequestTemplate::serialize(Cosem &cosem, std::initializer_list<const uint8_t*> values) const -> std::vector<uint8_t>
+{
+    auto apdu = std::vector<uint8_t>{};
+    serialize(cosem, apdu, values);
+    return apdu;
+}
+
 /**
  *
  * Get-Request-Normal ::= SEQUENCE
@@ -507,13 +1116,13 @@ auto parse_get_response(Cosem &cosem, const std::vector<uint8_t>& data) -> Respo
  *     method-invocation-parameters    Data OPTIONAL
  * }
  *
+ * @param buffer
+ * @param invoke_id
  * @param req
- * @param tag
- * @return
  */
-static void serialize_invoke_id_and_cosem_descriptor(std::vector<uint8_t> &buffer, Request const& req)
+static void serialize_invoke_id_and_cosem_descriptor(std::vector<uint8_t> &buffer, uint8_t invoke_id, Request const& req)
 {
-    buffer.push_back(static_cast<uint8_t>(XDLMS_HIGH_PRIORITY | XDLMS_SERVICE_CONFIRMED | XDLMS_INVOKE_ID));
+    buffer.push_back(static_cast<uint8_t>(XDLMS_HIGH_PRIORITY | XDLMS_SERVICE_CONFIRMED | (invoke_id & XDLMS_INVOKE_ID_MASK)));
     buffer.push_back(static_cast<uint8_t>(static_cast<uint16_t>(req.class_id) >> 8U));
     buffer.push_back(static_cast<uint8_t>(req.class_id));
     buffer.insert(buffer.end(), req.logical_name.begin(), req.logical_name.end());
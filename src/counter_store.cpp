@@ -0,0 +1,285 @@
+/*
+ * This file is part of the yadi.cpp project.
+ *
+ * Copyright (C) 2017 Paulo Faco <paulofaco@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+///@file
+
+#include <yadi/counter_store.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+#include <cerrno>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace dlms
+{
+
+    static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+                  "counters shared through a mapped file need address-free atomics");
+
+    static const uint64_t STORE_MAGIC = 0x3130434943444159ULL; //"YADCIC01"
+    static const uint64_t COUNTER_LIMIT = uint64_t{1} << 32U;
+
+    enum SlotState : uint32_t {
+        SLOT_EMPTY = 0,
+        SLOT_CLAIMED = 1, //title being written by the inserting thread, whose pid is in the upper bits
+        SLOT_READY = 2,
+        SLOT_STATE_MASK = 3,
+    };
+
+    /**
+     * One system title per cache line, so sessions of different titles do not contend
+     */
+    struct alignas(64) Slot {
+        std::atomic<uint32_t> state;
+        uint8_t system_title[8];
+        std::atomic<uint64_t> next; //next invocation counter to hand out
+        std::atomic<uint64_t> limit; //counters below it may be handed out once it is on disk
+        std::atomic<uint64_t> durable; //part of limit known to be on disk
+    };
+
+    static auto raise(std::atomic<uint64_t> &counter, uint64_t value) -> uint64_t
+    {
+        auto current = counter.load(std::memory_order_relaxed);
+        while (current < value && !counter.compare_exchange_weak(current, value, std::memory_order_acq_rel)) {
+        }
+        return current < value ? value : current;
+    }
+
+    /**
+     * A claimed slot is abandoned when the process writing its title is gone. Slots claimed
+     * before the pid was recorded carry none and are abandoned too.
+     */
+    static auto abandoned(uint32_t state) -> bool
+    {
+        auto pid = static_cast<pid_t>(state >> 2U);
+        return pid == 0 || (::kill(pid, 0) != 0 && errno == ESRCH);
+    }
+
+    struct alignas(64) StoreHeader {
+        uint64_t magic;
+        uint64_t capacity;
+    };
+
+    class InvocationCounterStore::impl {
+    public:
+        impl(std::string const& path, size_t capacity, uint32_t margin) : margin_{margin} {
+            fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0600);
+            if (fd_ < 0) {
+                throw std::runtime_error("cannot open invocation counter store " + path);
+            }
+            //held while the file is created or checked, so another process never sees it half written
+            if (::flock(fd_, LOCK_EX) != 0) {
+                close_file();
+                throw std::runtime_error("cannot lock invocation counter store " + path);
+            }
+
+            struct stat st{};
+            if (::fstat(fd_, &st) != 0) {
+                close_file();
+                throw std::runtime_error("cannot open invocation counter store " + path);
+            }
+            if (st.st_size == 0) {
+                auto slots = size_t{1};
+                while (slots < capacity) {
+                    slots <<= 1U;
+                }
+                size_ = sizeof(StoreHeader) + slots * sizeof(Slot);
+                if (::ftruncate(fd_, static_cast<off_t>(size_)) != 0) {
+                    close_file();
+                    throw std::runtime_error("cannot size invocation counter store " + path);
+                }
+                map();
+                header()->capacity = slots;
+                std::atomic_thread_fence(std::memory_order_release);
+                header()->magic = STORE_MAGIC;
+                if (::fsync(fd_) != 0) {
+                    unmap();
+                    close_file();
+                    throw std::runtime_error("cannot sync invocation counter store " + path);
+                }
+            } else {
+                size_ = static_cast<size_t>(st.st_size);
+                if (size_ < sizeof(StoreHeader)) {
+                    close_file();
+                    throw std::runtime_error("not an invocation counter store: " + path);
+                }
+                map();
+            }
+
+            auto h = header();
+            if (h->magic != STORE_MAGIC || h->capacity == 0 ||
+                (h->capacity & (h->capacity - 1)) != 0 || sizeof(StoreHeader) + h->capacity * sizeof(Slot) != size_) {
+                unmap();
+                close_file();
+                throw std::runtime_error("not an invocation counter store: " + path);
+            }
+            mask_ = h->capacity - 1;
+            slots_ = reinterpret_cast<Slot*>(static_cast<uint8_t*>(map_) + sizeof(StoreHeader));
+
+            //counters handed out past the last limit on disk may have been lost with a crash
+            for (size_t i = 0; i <= mask_; ++i) {
+                auto &slot = slots_[i];
+                if (slot.state.load(std::memory_order_acquire) == SLOT_READY) {
+                    raise(slot.next, slot.limit.load(std::memory_order_relaxed));
+                }
+            }
+            ::flock(fd_, LOCK_UN);
+        }
+
+        ~impl() {
+            unmap();
+            close_file();
+        }
+
+        /**
+         * Linear probing from the hash of the title. A free slot is claimed with a CAS; readers only
+         * wait on a slot while another thread is writing its title, and free it again if the process
+         * of that thread died before finishing.
+         */
+        auto find(std::array<uint8_t,8> const& system_title) -> Slot& {
+            uint64_t key;
+            std::memcpy(&key, system_title.data(), sizeof(key));
+            auto index = static_cast<size_t>((key * 0x9E3779B97F4A7C15ULL) >> 32U) & mask_;
+            for (size_t probe = 0; probe <= mask_; ++probe, index = (index + 1) & mask_) {
+                auto &slot = slots_[index];
+                auto state = slot.state.load(std::memory_order_acquire);
+                for (unsigned spins = 1; state != SLOT_READY; ++spins) {
+                    if (state == SLOT_EMPTY) {
+                        auto claim = static_cast<uint32_t>(::getpid()) << 2U | SLOT_CLAIMED;
+                        if (slot.state.compare_exchange_strong(state, claim, std::memory_order_acq_rel)) {
+                            std::memcpy(slot.system_title, system_title.data(), system_title.size());
+                            slot.state.store(SLOT_READY, std::memory_order_release);
+                            return slot;
+                        }
+                    } else if (spins % 1024 == 0 && abandoned(state)) {
+                        if (slot.state.compare_exchange_strong(state, SLOT_EMPTY, std::memory_order_acq_rel)) {
+                            state = SLOT_EMPTY;
+                        }
+                    } else {
+                        std::this_thread::yield();
+                        state = slot.state.load(std::memory_order_acquire);
+                    }
+                }
+                if (std::memcmp(slot.system_title, system_title.data(), system_title.size()) == 0) {
+                    return slot;
+                }
+            }
+            throw std::length_error("invocation counter store is full");
+        }
+
+        void sync() {
+            if (::msync(map_, size_, MS_SYNC) != 0) {
+                throw std::runtime_error("cannot sync invocation counter store");
+            }
+        }
+
+        /**
+         * Makes sure the limit of a slot on disk covers the counters below end before they are used,
+         * moving it margin counters further so only one reservation in margin waits for the disk
+         */
+        void secure(Slot &slot, uint64_t end) {
+            if (end <= slot.durable.load(std::memory_order_acquire)) {
+                return;
+            }
+            auto limit = raise(slot.limit, end + margin_);
+            auto page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+            auto offset = static_cast<size_t>(reinterpret_cast<uint8_t*>(&slot) - static_cast<uint8_t*>(map_)) / page * page;
+            if (::msync(static_cast<uint8_t*>(map_) + offset, std::min(page, size_ - offset), MS_SYNC) != 0) {
+                throw std::runtime_error("cannot sync invocation counter store");
+            }
+            raise(slot.durable, limit);
+        }
+
+    private:
+        void map() {
+            map_ = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+            if (map_ == MAP_FAILED) {
+                map_ = nullptr;
+                close_file();
+                throw std::runtime_error("cannot map invocation counter store");
+            }
+        }
+
+        void unmap() {
+            if (map_ != nullptr) {
+                ::munmap(map_, size_);
+                map_ = nullptr;
+            }
+        }
+
+        void close_file() {
+            if (fd_ >= 0) {
+                ::close(fd_);
+                fd_ = -1;
+            }
+        }
+
+        auto header() -> StoreHeader* {
+            return static_cast<StoreHeader*>(map_);
+        }
+
+        uint32_t margin_;
+        int fd_ = -1;
+        void *map_ = nullptr;
+        size_t size_ = 0;
+        size_t mask_ = 0;
+        Slot *slots_ = nullptr;
+    };
+
+    InvocationCounterStore::InvocationCounterStore(std::string const& path, size_t capacity, uint32_t margin) :
+        pimpl_{std::make_unique<impl>(path, capacity, margin)}
+    {
+    }
+
+    InvocationCounterStore::~InvocationCounterStore() = default;
+
+    auto InvocationCounterStore::reserve(std::array<uint8_t,8> const& system_title, uint32_t count) -> uint32_t
+    {
+        auto &slot = pimpl_->find(system_title);
+        auto first = slot.next.fetch_add(count, std::memory_order_relaxed);
+        if (first + count > COUNTER_LIMIT) {
+            throw std::overflow_error("invocation counters exhausted");
+        }
+        pimpl_->secure(slot, first + count);
+        return static_cast<uint32_t>(first);
+    }
+
+    void InvocationCounterStore::advance(std::array<uint8_t,8> const& system_title, uint32_t next)
+    {
+        auto &slot = pimpl_->find(system_title);
+        auto current = slot.next.load(std::memory_order_relaxed);
+        while (current < next && !slot.next.compare_exchange_weak(current, next, std::memory_order_relaxed)) {
+        }
+    }
+
+    void InvocationCounterStore::sync()
+    {
+        pimpl_->sync();
+    }
+
+}
@@ -0,0 +1,102 @@
+/*
+ * This file is part of the yadi.cpp project.
+ *
+ * Copyright (C) 2017 Paulo Faco <paulofaco@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cpu.h"
+
+#if defined(YADI_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace dlms
+{
+namespace cpu
+{
+
+    struct Features {
+        bool ssse3 = false;
+        bool sse41 = false;
+        bool avx2 = false;
+        bool aesni = false;
+        bool pclmul = false;
+        bool sha = false;
+
+        Features() {
+#if defined(YADI_X86)
+            unsigned int regs1[4] = {0};
+            unsigned int regs7[4] = {0};
+#if defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 0);
+            auto max_leaf = static_cast<unsigned int>(info[0]);
+            __cpuid(info, 1);
+            for (auto i = 0; i < 4; ++i) regs1[i] = static_cast<unsigned int>(info[i]);
+            if (max_leaf >= 7) {
+                __cpuidex(info, 7, 0);
+                for (auto i = 0; i < 4; ++i) regs7[i] = static_cast<unsigned int>(info[i]);
+            }
+#else
+            auto max_leaf = __get_cpuid_max(0, nullptr);
+            __cpuid(1, regs1[0], regs1[1], regs1[2], regs1[3]);
+            if (max_leaf >= 7) {
+                __cpuid_count(7, 0, regs7[0], regs7[1], regs7[2], regs7[3]);
+            }
+#endif
+            auto ecx1 = regs1[2];
+            auto ebx7 = regs7[1];
+            ssse3 = (ecx1 & (1U << 9U)) != 0;
+            sse41 = (ecx1 & (1U << 19U)) != 0;
+            pclmul = (ecx1 & (1U << 1U)) != 0;
+            aesni = (ecx1 & (1U << 25U)) != 0;
+            sha = (ebx7 & (1U << 29U)) != 0;
+
+            // AVX2 also needs the OS to save the YMM registers
+            auto osxsave = (ecx1 & (1U << 27U)) != 0;
+            auto avx = (ecx1 & (1U << 28U)) != 0;
+            if (osxsave && avx) {
+#if defined(_MSC_VER)
+                auto xcr0 = _xgetbv(0);
+#else
+                unsigned int eax, edx;
+                __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+                auto xcr0 = eax;
+#endif
+                avx2 = (xcr0 & 0x6U) == 0x6U && (ebx7 & (1U << 5U)) != 0;
+            }
+#endif
+        }
+    };
+
+    static const Features& features() {
+        static const Features f;
+        return f;
+    }
+
+    bool has_ssse3() { return features().ssse3; }
+    bool has_sse41() { return features().sse41; }
+    bool has_avx2() { return features().avx2; }
+    bool has_aesni() { return features().aesni; }
+    bool has_pclmul() { return features().pclmul; }
+    bool has_sha() { return features().sha; }
+
+} //namespace cpu
+} //namespace dlms
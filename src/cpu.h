@@ -0,0 +1,52 @@
+/*
+ * This file is part of the yadi.cpp project.
+ *
+ * Copyright (C) 2017 Paulo Faco <paulofaco@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef YADI_DLMS_CPU_H
+#define YADI_DLMS_CPU_H
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define YADI_X86 1
+#endif
+
+/**
+ * Marks a function as compiled for an instruction set extension. It must only be called after
+ * checking the matching cpu::has_* function.
+ */
+#if defined(YADI_X86) && (defined(__GNUC__) || defined(__clang__))
+#define YADI_TARGET(features) __attribute__((target(features)))
+#else
+#define YADI_TARGET(features)
+#endif
+
+namespace dlms
+{
+namespace cpu
+{
+
+bool has_ssse3();
+bool has_sse41();
+bool has_avx2();
+bool has_aesni();
+bool has_pclmul();
+bool has_sha();
+
+} //namespace cpu
+} //namespace dlms
+
+#endif //YADI_DLMS_CPU_H
@@ -1,34 +1,248 @@
 
 #include <yadi/parser.h>
+#include "data_type.h"
+#include "cpu.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <new>
 #include <stdexcept>
 
+#if defined(YADI_X86)
+#include <immintrin.h>
+#endif
+
 namespace dlms
 {
+    auto size_length(size_t size) -> size_t
+    {
+        if (size <= 0x80) {
+            return 1;
+        }
+        if (size <= 0xFF) {
+            return 2;
+        }
+        if (size <= 0xFFFF) {
+            return 3;
+        }
+        return size <= 0xFFFFFF ? 4 : 5;
+    }
+
+    auto write_size(uint8_t *out, size_t size) -> uint8_t*
+    {
+        auto length = size_length(size);
+        if (length == 1) {
+            *out++ = static_cast<uint8_t>(size);
+            return out;
+        }
+        *out++ = static_cast<uint8_t>(0x80 + length - 1);
+        for (auto i = length - 1; i-- > 0;) {
+            *out++ = static_cast<uint8_t>(size >> (8 * i));
+        }
+        return out;
+    }
+
     void write_size(std::vector<uint8_t> &buffer, size_t size)
     {
 		if (size > 0xFFFFFFFFLL) {
 			throw std::runtime_error{ "size os too big" };
 		}
-        if (size <= 0x80) {
-            buffer.push_back(static_cast<uint8_t>(size));
-        } else if (size <= 0xFF) {
-            buffer.push_back(0x81);
-            buffer.push_back(static_cast<uint8_t>(size));
-        } else if (size <= 0xFFFF) {
-            buffer.push_back(0x82);
-            buffer.push_back(static_cast<uint8_t>(size >> 8));
-            buffer.push_back(static_cast<uint8_t>(size));
-        } else if (size <= 0xFFFFFF) {
-            buffer.push_back(0x83);
-            buffer.push_back(static_cast<uint8_t>(size >> 16));
-            buffer.push_back(static_cast<uint8_t>(size >> 8));
-            buffer.push_back(static_cast<uint8_t>(size));
-        } else {
-            buffer.push_back(0x84);
-            buffer.push_back(static_cast<uint8_t>(size >> 24));
-            buffer.push_back(static_cast<uint8_t>(size >> 16));
-            buffer.push_back(static_cast<uint8_t>(size >> 8));
-            buffer.push_back(static_cast<uint8_t>(size));
+        auto position = buffer.size();
+        buffer.resize(position + size_length(size));
+        write_size(&buffer[position], size);
+    }
+
+    auto read_size(const uint8_t *data, size_t size, size_t &offset) -> size_t
+    {
+        if (offset >= size) {
+            throw std::underflow_error{"not enough bytes"};
+        }
+        size_t value = data[offset++];
+        if (value <= 0x80) {
+            return value;
+        }
+        auto len = value & 0x7FU;
+        if (len > 4 || offset + len > size) {
+            throw std::underflow_error{"not enough bytes"};
+        }
+        value = 0;
+        while (len-- != 0) {
+            value <<= 8U;
+            value |= data[offset++];
+        }
+        return value;
+    }
+
+    auto read_size(std::vector<uint8_t> const& buffer, size_t &offset) -> size_t
+    {
+        return read_size(buffer.data(), buffer.size(), offset);
+    }
+
+    /**
+     * Writes the low out_width bytes of value in native byte order
+     */
+    static inline void store_native(uint64_t value, uint8_t *out, size_t out_width)
+    {
+        switch (out_width) {
+            case 2: {
+                auto v = static_cast<uint16_t>(value);
+                std::memcpy(out, &v, sizeof(v));
+                break;
+            }
+            case 4: {
+                auto v = static_cast<uint32_t>(value);
+                std::memcpy(out, &v, sizeof(v));
+                break;
+            }
+            default:
+                std::memcpy(out, &value, sizeof(value));
+                break;
+        }
+    }
+
+    static void swap_scalar(const uint8_t *data, size_t stride, size_t width, size_t count, uint8_t *out,
+                            size_t out_width, size_t from)
+    {
+        for (auto i = from; i < count; ++i) {
+            store_native(read_big_endian(data + i * stride, width), out + i * out_width, out_width);
+        }
+    }
+
+#if defined(YADI_X86)
+    /**
+     * Shuffle of a 16-byte window that reverses the bytes of each value and zero-extends it to out_width
+     * @return the number of values the window holds, at most as many as fit in 16 output bytes
+     */
+    static auto swap_shuffle(size_t stride, size_t width, size_t out_width, uint8_t shuffle[16]) -> size_t
+    {
+        auto values = std::min((16 - width) / stride + 1, 16 / out_width);
+        std::fill(shuffle, shuffle + 16, 0x80);
+        for (size_t j = 0; j < values; ++j) {
+            for (size_t b = 0; b < width; ++b) {
+                shuffle[j * out_width + b] = static_cast<uint8_t>(j * stride + width - 1 - b);
+            }
+        }
+        return values;
+    }
+
+    /**
+     * Each step stores 16 bytes of which only the converted values are kept, so steps stop while a
+     * whole window is still inside both the input and the output
+     */
+    YADI_TARGET("ssse3")
+    static auto swap_ssse3(const uint8_t *data, size_t stride, size_t width, size_t count, uint8_t *out,
+                           size_t out_width) -> size_t
+    {
+        uint8_t bytes[16];
+        auto step = swap_shuffle(stride, width, out_width, bytes);
+        auto shuffle = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes));
+        auto input_end = (count - 1) * stride + width;
+        auto output_end = count * out_width;
+        size_t i = 0;
+        for (; i * stride + 16 <= input_end && i * out_width + 16 <= output_end; i += step) {
+            auto window = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * stride));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * out_width), _mm_shuffle_epi8(window, shuffle));
+        }
+        return i;
+    }
+
+    YADI_TARGET("avx2")
+    static auto swap_avx2(const uint8_t *data, size_t stride, size_t width, size_t count, uint8_t *out,
+                          size_t out_width) -> size_t
+    {
+        uint8_t bytes[16];
+        auto step = swap_shuffle(stride, width, out_width, bytes);
+        auto shuffle = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes)));
+        auto input_end = (count - 1) * stride + width;
+        auto output_end = count * out_width;
+        size_t i = 0;
+        for (; (i + step) * stride + 16 <= input_end && (i + step) * out_width + 16 <= output_end; i += 2 * step) {
+            auto low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * stride));
+            auto high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + (i + step) * stride));
+            auto swapped = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1), shuffle);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * out_width), _mm256_castsi256_si128(swapped));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + (i + step) * out_width), _mm256_extracti128_si256(swapped, 1));
+        }
+        return i;
+    }
+#endif
+
+    static void swap_run(const uint8_t *data, size_t stride, size_t width, size_t count, uint8_t *out, size_t out_width)
+    {
+        if (stride < width) {
+            throw std::invalid_argument{"values overlap"};
+        }
+        if (count == 0) {
+            return;
+        }
+        size_t done = 0;
+#if defined(YADI_X86)
+        if (cpu::has_avx2()) {
+            done = swap_avx2(data, stride, width, count, out, out_width);
+        } else if (cpu::has_ssse3()) {
+            done = swap_ssse3(data, stride, width, count, out, out_width);
+        }
+#endif
+        swap_scalar(data, stride, width, count, out, out_width, done);
+    }
+
+    void convert_big_endian(const uint8_t *data, size_t stride, size_t count, uint16_t *out)
+    {
+        swap_run(data, stride, sizeof(*out), count, reinterpret_cast<uint8_t*>(out), sizeof(*out));
+    }
+
+    void convert_big_endian(const uint8_t *data, size_t stride, size_t count, uint32_t *out)
+    {
+        swap_run(data, stride, sizeof(*out), count, reinterpret_cast<uint8_t*>(out), sizeof(*out));
+    }
+
+    void convert_big_endian(const uint8_t *data, size_t stride, size_t count, uint64_t *out)
+    {
+        swap_run(data, stride, sizeof(*out), count, reinterpret_cast<uint8_t*>(out), sizeof(*out));
+    }
+
+    void convert_big_endian(const uint8_t *data, size_t stride, size_t count, float *out)
+    {
+        static_assert(sizeof(float) == 4, "FLOAT32 is a 4-byte IEEE 754 value");
+        swap_run(data, stride, sizeof(*out), count, reinterpret_cast<uint8_t*>(out), sizeof(*out));
+    }
+
+    void convert_big_endian(const uint8_t *data, size_t stride, size_t count, double *out)
+    {
+        static_assert(sizeof(double) == 8, "FLOAT64 is an 8-byte IEEE 754 value");
+        swap_run(data, stride, sizeof(*out), count, reinterpret_cast<uint8_t*>(out), sizeof(*out));
+    }
+
+    void convert_big_endian(DataType type, const uint8_t *data, size_t stride, size_t count, int64_t *out)
+    {
+        size_t width;
+        bool is_signed = false;
+        switch (type) {
+            case DataType::INT8:
+            case DataType::INT16:
+            case DataType::INT32:
+            case DataType::INT64:
+                is_signed = true;
+                width = fixed_width(type);
+                break;
+            case DataType::UINT8:
+            case DataType::UINT16:
+            case DataType::UINT32:
+            case DataType::UINT64:
+            case DataType::BOOLEAN:
+            case DataType::BCD:
+            case DataType::ENUM:
+                width = fixed_width(type);
+                break;
+            default:
+                throw std::invalid_argument{"not an integer type"};
+        }
+        swap_run(data, stride, width, count, reinterpret_cast<uint8_t*>(out), sizeof(*out));
+        if (is_signed && width < 8) {
+            auto shift = 64 - 8 * width;
+            for (size_t i = 0; i < count; ++i) {
+                out[i] = static_cast<int64_t>(static_cast<uint64_t>(out[i]) << shift) >> shift;
+            }
         }
     }
 
@@ -36,6 +250,7 @@ namespace dlms
     static auto pack_sized_type(uint8_t tag, const T& value) -> std::vector<uint8_t>
     {
 		auto buffer = std::vector<uint8_t>{};
+        buffer.reserve(1 + size_length(value.size()) + value.size());
         buffer.push_back(tag);
         write_size(buffer, value.size());
         buffer.insert(buffer.end(), value.begin(), value.end());
@@ -62,44 +277,964 @@ namespace dlms
         return {};
     }
 
-    auto to_string(const std::vector<uint8_t> &buffer) -> std::string
+    bool has_bytes(DataType type)
     {
-        auto retval = std::string{};
+        switch (type) {
+            case DataType::BIT_STRING:
+            case DataType::OCTET_STRING:
+            case DataType::STRING:
+            case DataType::UTF8_STRING:
+            case DataType::DATE_TIME:
+            case DataType::DATE:
+            case DataType::TIME:
+                return true;
+            default:
+                return false;
+        }
+    }
 
-        if (buffer.size() < 2) {
-            return retval;
+    auto fixed_width(DataType type) -> size_t
+    {
+        switch (type) {
+            case DataType::NULL_DATA:
+            case DataType::DONT_CARE:
+                return 0;
+            case DataType::BOOLEAN:
+            case DataType::BCD:
+            case DataType::INT8:
+            case DataType::UINT8:
+            case DataType::ENUM:
+                return 1;
+            case DataType::INT16:
+            case DataType::UINT16:
+                return 2;
+            case DataType::INT32:
+            case DataType::UINT32:
+            case DataType::FLOAT32:
+            case DataType::TIME:
+                return 4;
+            case DataType::DATE:
+                return 5;
+            case DataType::INT64:
+            case DataType::UINT64:
+            case DataType::FLOAT64:
+                return 8;
+            case DataType::DATE_TIME:
+                return 12;
+            case DataType::ARRAY:
+            case DataType::STRUCTURE:
+            case DataType::COMPACT_ARRAY:
+            case DataType::BIT_STRING:
+            case DataType::OCTET_STRING:
+            case DataType::STRING:
+            case DataType::UTF8_STRING:
+                return VARIABLE_WIDTH;
+            default:
+                throw std::invalid_argument{"unknown data type"};
+        }
+    }
+
+    void read_contents(DataType type, const uint8_t *data, size_t size, size_t &offset, Value &value)
+    {
+        auto length = fixed_width(type);
+        auto position = offset;
+        uint32_t count = 0;
+        if (type == DataType::BIT_STRING) {
+            auto bits = read_size(data, size, position);
+            count = static_cast<uint32_t>(bits);
+            length = (bits + 7) / 8;
+        } else if (type == DataType::OCTET_STRING || type == DataType::STRING || type == DataType::UTF8_STRING) {
+            length = read_size(data, size, position);
+            count = static_cast<uint32_t>(length);
+        } else if (length == VARIABLE_WIDTH) {
+            throw std::invalid_argument{"value has children"};
+        } else if (has_bytes(type)) {
+            count = static_cast<uint32_t>(length);
+        }
+        if (length > size - position) {
+            throw std::underflow_error{"not enough bytes"};
         }
 
-        switch (buffer[0]) {
-        case 0x06:
-        {
-            if (buffer.size() < 5) {
-                throw std::underflow_error{"not enough bytes"};
+        auto content = data + position;
+        value.type = type;
+        value.size = count;
+        switch (type) {
+            case DataType::INT8:
+                value.integer = static_cast<int8_t>(content[0]);
+                break;
+            case DataType::INT16:
+                value.integer = static_cast<int16_t>(read_big_endian(content, 2));
+                break;
+            case DataType::INT32:
+                value.integer = static_cast<int32_t>(read_big_endian(content, 4));
+                break;
+            case DataType::INT64:
+                value.integer = static_cast<int64_t>(read_big_endian(content, 8));
+                break;
+            case DataType::FLOAT32: {
+                auto bits = static_cast<uint32_t>(read_big_endian(content, 4));
+                float real;
+                std::memcpy(&real, &bits, sizeof(real));
+                value.real = real;
+                break;
             }
-            uint32_t value = buffer[1];
-            value <<= 8U;
-            value |= buffer[2];
-            value <<= 8U;
-            value |= buffer[3];
-            value <<= 8U;
-            value |= buffer[4];
-            return std::to_string(value);
+            case DataType::FLOAT64: {
+                auto bits = read_big_endian(content, 8);
+                std::memcpy(&value.real, &bits, sizeof(value.real));
+                break;
+            }
+            default:
+                if (has_bytes(type)) {
+                    value.bytes = content;
+                } else {
+                    value.unsigned_integer = read_big_endian(content, length);
+                }
+                break;
+        }
+        offset = position + length;
+    }
+
+    static bool has_children(DataType type)
+    {
+        return type == DataType::ARRAY || type == DataType::STRUCTURE || type == DataType::COMPACT_ARRAY;
+    }
+
+    bool read_scalar(const uint8_t *data, size_t size, size_t &offset, Value &value)
+    {
+        if (offset >= size) {
+            throw std::underflow_error{"not enough bytes"};
+        }
+        auto type = static_cast<DataType>(data[offset]);
+        if (has_children(type)) {
+            return false;
+        }
+        auto position = offset + 1;
+        read_contents(type, data, size, position, value);
+        offset = position;
+        return true;
+    }
+
+    void skip_type_description(const uint8_t *data, size_t size, size_t &offset, unsigned depth)
+    {
+        if (offset >= size) {
+            throw std::underflow_error{"not enough bytes"};
+        }
+        if (depth == MAX_DEPTH) {
+            throw std::invalid_argument{"values nested too deep"};
+        }
+        auto type = static_cast<DataType>(data[offset++]);
+        switch (type) {
+            case DataType::ARRAY:
+                if (2 > size - offset) {
+                    throw std::underflow_error{"not enough bytes"};
+                }
+                if (data[offset] == 0 && data[offset + 1] == 0) {
+                    throw std::invalid_argument{"array without elements in a type description"};
+                }
+                offset += 2;
+                skip_type_description(data, size, offset, depth + 1);
+                break;
+            case DataType::STRUCTURE: {
+                auto count = read_size(data, size, offset);
+                if (count > size - offset) {
+                    throw std::underflow_error{"not enough bytes"};
+                }
+                if (count == 0) {
+                    throw std::invalid_argument{"structure without fields in a type description"};
+                }
+                for (size_t i = 0; i < count; ++i) {
+                    skip_type_description(data, size, offset, depth + 1);
+                }
+                break;
+            }
+            case DataType::COMPACT_ARRAY:
+                throw std::invalid_argument{"compact array nested in a type description"};
+            default:
+                if (fixed_width(type) == 0) {
+                    throw std::invalid_argument{"type without contents in a type description"};
+                }
+                break;
+        }
+    }
+
+    /**
+     * Reads the type description and the length of the contents of the compact array at offset
+     * @param offset moved to the contents
+     * @return bytes of the contents
+     */
+    static auto read_compact_header(const uint8_t *data, size_t size, size_t &offset, size_t &description) -> size_t
+    {
+        description = ++offset;
+        skip_type_description(data, size, offset);
+        auto length = read_size(data, size, offset);
+        if (length > size - offset) {
+            throw std::underflow_error{"not enough bytes"};
+        }
+        return length;
+    }
+
+    /**
+     * Moves offset past the untagged element of a compact array described at description, and
+     * description past its type description
+     */
+    static void skip_element(const uint8_t *types, size_t &description, const uint8_t *data, size_t size, size_t &offset)
+    {
+        auto type = static_cast<DataType>(types[description++]);
+        if (type == DataType::ARRAY) {
+            auto count = static_cast<size_t>(types[description] << 8U | types[description + 1]);
+            description += 2;
+            auto element = description;
+            for (size_t i = 0; i < count; ++i) {
+                description = element;
+                skip_element(types, description, data, size, offset);
+            }
+        } else if (type == DataType::STRUCTURE) {
+            auto count = read_size(types, SIZE_MAX, description);
+            for (size_t i = 0; i < count; ++i) {
+                skip_element(types, description, data, size, offset);
+            }
+        } else {
+            Value value;
+            read_contents(type, data, size, offset, value);
+        }
+    }
+
+    static auto contents_bytes(Value const& value) -> size_t
+    {
+        return value.type == DataType::BIT_STRING ? (value.size + size_t{7}) / 8 : size_t{value.size};
+    }
+
+    static void keep_bytes(Arena &arena, Value &value)
+    {
+        if (has_bytes(value.type)) {
+            auto length = contents_bytes(value);
+            auto bytes = arena.allocate<uint8_t>(length);
+            std::copy(value.bytes, value.bytes + length, bytes);
+            value.bytes = bytes;
         }
+    }
 
-        case 0x0A:
-            auto size = buffer[1];
-            for (auto i = 0; i < size; ++i) {
-                retval += buffer[i];
+    static void decode_element(const uint8_t *types, size_t &description, const uint8_t *data, size_t size,
+                               size_t &offset, Arena &arena, Value &value)
+    {
+        auto type = static_cast<DataType>(types[description++]);
+        if (type == DataType::ARRAY || type == DataType::STRUCTURE) {
+            size_t count;
+            if (type == DataType::ARRAY) {
+                count = static_cast<size_t>(types[description] << 8U | types[description + 1]);
+                description += 2;
+            } else {
+                count = read_size(types, SIZE_MAX, description);
+            }
+            auto items = arena.allocate<Value>(count);
+            auto element = description;
+            for (size_t i = 0; i < count; ++i) {
+                if (type == DataType::ARRAY) {
+                    description = element;
+                }
+                new (items + i) Value{};
+                decode_element(types, description, data, size, offset, arena, items[i]);
             }
-            break;
+            value.type = type;
+            value.size = static_cast<uint32_t>(count);
+            value.items = items;
+        } else {
+            read_contents(type, data, size, offset, value);
+            keep_bytes(arena, value);
+        }
+    }
+
+    /**
+     * The contents of a compact array are walked once to count its elements, then decoded into the
+     * children allocated for them. The type description was checked by read_compact_header and is
+     * read without bounds. As it holds no empty array or structure and no type without contents,
+     * every node of an element takes at least one byte of the contents below it, so the walk and
+     * the children allocated stay linear in the length of the contents.
+     */
+    static void decode_compact_array(const uint8_t *data, size_t size, size_t &offset, Arena &arena, Value &value)
+    {
+        size_t description;
+        auto length = read_compact_header(data, size, offset, description);
+        auto end = offset + length;
+        size_t count = 0;
+        for (auto position = offset; position < end; ++count) {
+            auto types = description;
+            auto start = position;
+            try {
+                skip_element(data, types, data, end, position);
+            } catch (std::underflow_error const&) {
+                throw std::invalid_argument{"compact array contents do not match their type description"};
+            }
+            if (position == start) {
+                throw std::invalid_argument{"compact array of empty elements"};
+            }
+        }
+        auto items = arena.allocate<Value>(count);
+        for (size_t i = 0; i < count; ++i) {
+            auto types = description;
+            new (items + i) Value{};
+            decode_element(data, types, data, end, offset, arena, items[i]);
+        }
+        value.type = DataType::COMPACT_ARRAY;
+        value.size = static_cast<uint32_t>(count);
+        value.items = items;
+    }
+
+    static void decode_node(const uint8_t *data, size_t size, size_t &offset, Arena &arena, Value &value, unsigned depth)
+    {
+        if (read_scalar(data, size, offset, value)) {
+            keep_bytes(arena, value);
+            return;
+        }
+        if (data[offset] == static_cast<uint8_t>(DataType::COMPACT_ARRAY)) {
+            decode_compact_array(data, size, offset, arena, value);
+            return;
+        }
+        if (depth == MAX_DEPTH) {
+            throw std::invalid_argument{"values nested too deep"};
+        }
+        auto type = static_cast<DataType>(data[offset++]);
+        auto count = read_size(data, size, offset);
+        if (count > size - offset) {
+            throw std::underflow_error{"not enough bytes"}; //every child takes at least its tag
+        }
+        auto items = arena.allocate<Value>(count);
+        for (size_t i = 0; i < count; ++i) {
+            new (items + i) Value{};
+            decode_node(data, size, offset, arena, items[i], depth + 1);
+        }
+        value.type = type;
+        value.size = static_cast<uint32_t>(count);
+        value.items = items;
+    }
+
+    auto decode_value(const uint8_t *data, size_t size, size_t &offset, Arena &arena) -> Value const&
+    {
+        auto value = new (arena.allocate<Value>(1)) Value{};
+        decode_node(data, size, offset, arena, *value, 0);
+        return *value;
+    }
+
+    auto decode_value(std::vector<uint8_t> const& buffer, size_t &offset, Arena &arena) -> Value const&
+    {
+        return decode_value(buffer.data(), buffer.size(), offset, arena);
+    }
+
+    /**
+     * Bytes of the contents of a value without children, length octets included
+     */
+    static auto scalar_size(Value const& value) -> size_t
+    {
+        auto width = fixed_width(value.type);
+        if (width == VARIABLE_WIDTH) {
+            return size_length(value.size) + contents_bytes(value);
+        }
+        if (has_bytes(value.type) && value.size != width) {
+            throw std::invalid_argument{"date or time of the wrong size"};
         }
+        return width;
+    }
 
-        return retval;
+    static bool same_shape(Value const& first, Value const& other)
+    {
+        if (first.type != other.type) {
+            return false;
+        }
+        if (first.type != DataType::ARRAY && first.type != DataType::STRUCTURE) {
+            return true;
+        }
+        if (first.size != other.size) {
+            return false;
+        }
+        for (uint32_t i = 0; i < first.size; ++i) {
+            if (!same_shape(first.items[i], other.items[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Bytes of the type description of an element of a compact array, checking that the elements
+     * of its arrays all have the same shape
+     */
+    static auto description_size(Value const& value, unsigned depth) -> size_t
+    {
+        if (depth == MAX_DEPTH) {
+            throw std::invalid_argument{"values nested too deep"};
+        }
+        switch (value.type) {
+            case DataType::ARRAY:
+                if (value.size == 0 || value.size > 0xFFFF) {
+                    throw std::invalid_argument{"array in a compact array without elements or with too many"};
+                }
+                for (uint32_t i = 1; i < value.size; ++i) {
+                    if (!same_shape(value.items[0], value.items[i])) {
+                        throw std::invalid_argument{"elements of an array in a compact array of different shapes"};
+                    }
+                }
+                return 3 + description_size(value.items[0], depth + 1);
+            case DataType::STRUCTURE: {
+                if (value.size == 0) {
+                    throw std::invalid_argument{"structure in a compact array without fields"};
+                }
+                auto size = 1 + size_length(value.size);
+                for (auto const& item : value) {
+                    size += description_size(item, depth + 1);
+                }
+                return size;
+            }
+            case DataType::COMPACT_ARRAY:
+                throw std::invalid_argument{"compact array nested in a compact array"};
+            default:
+                if (fixed_width(value.type) == 0) {
+                    throw std::invalid_argument{"value without contents in a compact array"};
+                }
+                return 1;
+        }
+    }
+
+    /**
+     * Bytes of a value as an element of a compact array, without tags nor counts
+     */
+    static auto untagged_size(Value const& value) -> size_t
+    {
+        if (value.type != DataType::ARRAY && value.type != DataType::STRUCTURE) {
+            return scalar_size(value);
+        }
+        auto size = size_t{0};
+        for (auto const& item : value) {
+            size += untagged_size(item);
+        }
+        return size;
+    }
+
+    static auto compact_contents_size(Value const& value) -> size_t
+    {
+        auto size = size_t{0};
+        for (auto const& item : value) {
+            size += untagged_size(item);
+        }
+        return size;
+    }
+
+    static auto tagged_size(Value const& value, unsigned depth) -> size_t
+    {
+        if (depth == MAX_DEPTH) {
+            throw std::invalid_argument{"values nested too deep"};
+        }
+        switch (value.type) {
+            case DataType::ARRAY:
+            case DataType::STRUCTURE: {
+                auto size = 1 + size_length(value.size);
+                for (auto const& item : value) {
+                    size += tagged_size(item, depth + 1);
+                }
+                return size;
+            }
+            case DataType::COMPACT_ARRAY: {
+                if (value.size == 0) {
+                    throw std::invalid_argument{"empty compact array has no type description"};
+                }
+                auto description = description_size(value.items[0], depth + 1);
+                for (uint32_t i = 1; i < value.size; ++i) {
+                    if (!same_shape(value.items[0], value.items[i])) {
+                        throw std::invalid_argument{"elements of a compact array of different shapes"};
+                    }
+                }
+                auto contents = compact_contents_size(value);
+                if (contents > 0xFFFFFFFF) {
+                    throw std::invalid_argument{"compact array too large"};
+                }
+                return 1 + description + size_length(contents) + contents;
+            }
+            default:
+                return 1 + scalar_size(value);
+        }
+    }
+
+    auto encoded_size(Value const& value) -> size_t
+    {
+        return tagged_size(value, 0);
+    }
+
+    static auto write_big_endian(uint64_t value, size_t width, uint8_t *out) -> uint8_t*
+    {
+        for (auto i = width; i-- > 0; value >>= 8U) {
+            out[i] = static_cast<uint8_t>(value);
+        }
+        return out + width;
+    }
+
+    static auto write_scalar(Value const& value, uint8_t *out) -> uint8_t*
+    {
+        switch (value.type) {
+            case DataType::NULL_DATA:
+            case DataType::DONT_CARE:
+                return out;
+            case DataType::INT8:
+            case DataType::INT16:
+            case DataType::INT32:
+            case DataType::INT64:
+                return write_big_endian(static_cast<uint64_t>(value.integer), fixed_width(value.type), out);
+            case DataType::FLOAT32: {
+                auto real = static_cast<float>(value.real);
+                uint32_t bits;
+                std::memcpy(&bits, &real, sizeof(bits));
+                return write_big_endian(bits, 4, out);
+            }
+            case DataType::FLOAT64: {
+                uint64_t bits;
+                std::memcpy(&bits, &value.real, sizeof(bits));
+                return write_big_endian(bits, 8, out);
+            }
+            case DataType::BIT_STRING:
+            case DataType::OCTET_STRING:
+            case DataType::STRING:
+            case DataType::UTF8_STRING:
+                out = write_size(out, value.size);
+                // fall through
+            case DataType::DATE_TIME:
+            case DataType::DATE:
+            case DataType::TIME: {
+                auto length = contents_bytes(value);
+                if (length != 0) {
+                    std::memcpy(out, value.bytes, length);
+                }
+                return out + length;
+            }
+            default:
+                return write_big_endian(value.unsigned_integer, fixed_width(value.type), out);
+        }
+    }
+
+    static auto write_description(Value const& value, uint8_t *out) -> uint8_t*
+    {
+        *out++ = static_cast<uint8_t>(value.type);
+        if (value.type == DataType::ARRAY) {
+            out = write_big_endian(value.size, 2, out);
+            return write_description(value.items[0], out);
+        }
+        if (value.type == DataType::STRUCTURE) {
+            out = write_size(out, value.size);
+            for (auto const& item : value) {
+                out = write_description(item, out);
+            }
+        }
+        return out;
+    }
+
+    static auto write_untagged(Value const& value, uint8_t *out) -> uint8_t*
+    {
+        if (value.type != DataType::ARRAY && value.type != DataType::STRUCTURE) {
+            return write_scalar(value, out);
+        }
+        for (auto const& item : value) {
+            out = write_untagged(item, out);
+        }
+        return out;
+    }
+
+    /**
+     * The lengths were all checked by encoded_size; a compact array is walked once more for the
+     * length of its contents, which precedes them
+     */
+    auto encode_value(Value const& value, uint8_t *out) -> uint8_t*
+    {
+        *out++ = static_cast<uint8_t>(value.type);
+        switch (value.type) {
+            case DataType::ARRAY:
+            case DataType::STRUCTURE:
+                out = write_size(out, value.size);
+                for (auto const& item : value) {
+                    out = encode_value(item, out);
+                }
+                return out;
+            case DataType::COMPACT_ARRAY:
+                out = write_description(value.items[0], out);
+                out = write_size(out, compact_contents_size(value));
+                for (auto const& item : value) {
+                    out = write_untagged(item, out);
+                }
+                return out;
+            default:
+                return write_scalar(value, out);
+        }
+    }
+
+    void encode_value(Value const& value, std::vector<uint8_t> &buffer)
+    {
+        auto position = buffer.size();
+        buffer.resize(position + encoded_size(value));
+        encode_value(value, &buffer[position]);
+    }
+
+    void skip_value(const uint8_t *data, size_t size, size_t &offset, unsigned depth)
+    {
+        Value value;
+        if (read_scalar(data, size, offset, value)) {
+            return;
+        }
+        if (data[offset] == static_cast<uint8_t>(DataType::COMPACT_ARRAY)) {
+            size_t description;
+            offset += read_compact_header(data, size, offset, description);
+            return;
+        }
+        if (depth == MAX_DEPTH) {
+            throw std::invalid_argument{"values nested too deep"};
+        }
+        ++offset;
+        auto count = read_size(data, size, offset);
+        if (count > size - offset) {
+            throw std::underflow_error{"not enough bytes"};
+        }
+        for (size_t i = 0; i < count; ++i) {
+            skip_value(data, size, offset, depth + 1);
+        }
+    }
+
+    DataView::DataView(const uint8_t *data, size_t size, size_t offset) :
+        data_{data}, size_{size}, offset_{offset}
+    {
+    }
+
+    DataView::DataView(std::vector<uint8_t> const& buffer, size_t offset) :
+        DataView{buffer.data(), buffer.size(), offset}
+    {
+    }
+
+    auto DataView::type() const -> DataType
+    {
+        if (offset_ >= size_) {
+            throw std::underflow_error{"not enough bytes"};
+        }
+        return static_cast<DataType>(data_[offset_]);
+    }
+
+    auto DataView::size() const -> size_t
+    {
+        auto type = this->type();
+        if (type == DataType::ARRAY || type == DataType::STRUCTURE) {
+            auto offset = offset_ + 1;
+            return read_size(data_, size_, offset);
+        }
+        return scalar().size;
+    }
+
+    void DataView::skip()
+    {
+        skip_value(data_, size_, offset_);
+    }
+
+    auto DataView::child() const -> DataView
+    {
+        auto type = this->type();
+        if (type != DataType::ARRAY && type != DataType::STRUCTURE) {
+            throw std::invalid_argument{"not an array or structure"};
+        }
+        auto offset = offset_ + 1;
+        read_size(data_, size_, offset);
+        return {data_, size_, offset};
+    }
+
+    auto DataView::operator[](size_t index) const -> DataView
+    {
+        if (index >= size()) {
+            throw std::out_of_range{"no such child"};
+        }
+        auto view = child();
+        while (index-- != 0) {
+            view.skip();
+        }
+        return view;
+    }
+
+    auto DataView::scalar() const -> Value
+    {
+        auto offset = offset_;
+        Value value;
+        if (!read_scalar(data_, size_, offset, value)) {
+            throw std::invalid_argument{"not a simple value"};
+        }
+        return value;
+    }
+
+    auto DataView::to_int64() const -> int64_t
+    {
+        auto value = scalar();
+        switch (value.type) {
+            case DataType::INT8:
+            case DataType::INT16:
+            case DataType::INT32:
+            case DataType::INT64:
+                return value.integer;
+            case DataType::BOOLEAN:
+            case DataType::BCD:
+            case DataType::UINT8:
+            case DataType::UINT16:
+            case DataType::UINT32:
+            case DataType::UINT64:
+            case DataType::ENUM:
+                if (value.unsigned_integer > static_cast<uint64_t>(INT64_MAX)) {
+                    throw std::out_of_range{"value does not fit"};
+                }
+                return static_cast<int64_t>(value.unsigned_integer);
+            default:
+                throw std::invalid_argument{"not an integer"};
+        }
+    }
+
+    auto DataView::to_uint64() const -> uint64_t
+    {
+        auto value = scalar();
+        switch (value.type) {
+            case DataType::INT8:
+            case DataType::INT16:
+            case DataType::INT32:
+            case DataType::INT64:
+                if (value.integer < 0) {
+                    throw std::out_of_range{"value does not fit"};
+                }
+                return static_cast<uint64_t>(value.integer);
+            case DataType::BOOLEAN:
+            case DataType::BCD:
+            case DataType::UINT8:
+            case DataType::UINT16:
+            case DataType::UINT32:
+            case DataType::UINT64:
+            case DataType::ENUM:
+                return value.unsigned_integer;
+            default:
+                throw std::invalid_argument{"not an integer"};
+        }
+    }
+
+    auto DataView::to_double() const -> double
+    {
+        auto value = scalar();
+        switch (value.type) {
+            case DataType::FLOAT32:
+            case DataType::FLOAT64:
+                return value.real;
+            case DataType::INT8:
+            case DataType::INT16:
+            case DataType::INT32:
+            case DataType::INT64:
+                return static_cast<double>(value.integer);
+            case DataType::UINT8:
+            case DataType::UINT16:
+            case DataType::UINT32:
+            case DataType::UINT64:
+                return static_cast<double>(value.unsigned_integer);
+            default:
+                throw std::invalid_argument{"not a number"};
+        }
+    }
+
+    auto DataView::to_bool() const -> bool
+    {
+        auto value = scalar();
+        if (value.type != DataType::BOOLEAN) {
+            throw std::invalid_argument{"not a boolean"};
+        }
+        return value.unsigned_integer != 0;
+    }
+
+    auto DataView::bytes() const -> const uint8_t*
+    {
+        auto value = scalar();
+        if (!has_bytes(value.type)) {
+            throw std::invalid_argument{"not a string, date or time"};
+        }
+        return value.bytes;
+    }
+
+    auto DataView::to_string() const -> std::string
+    {
+        auto value = scalar();
+        if (value.type != DataType::OCTET_STRING && value.type != DataType::STRING && value.type != DataType::UTF8_STRING) {
+            throw std::invalid_argument{"not a string"};
+        }
+        return std::string(value.bytes, value.bytes + value.size);
+    }
+
+    auto DataView::to_value(Arena &arena) const -> Value const&
+    {
+        auto offset = offset_;
+        return decode_value(data_, size_, offset, arena);
+    }
+
+    StreamParser::StreamParser(DataHandler &handler) :
+        handler_{handler}
+    {
+    }
+
+    /**
+     * @return the size of the element at data: the whole value, or the tag and count of an array or
+     * structure. When the size cannot be known yet, the number of bytes needed to learn more of it.
+     */
+    static auto element_size(const uint8_t *data, size_t size) -> size_t
+    {
+        auto type = static_cast<DataType>(data[0]);
+        auto width = fixed_width(type);
+        if (width != VARIABLE_WIDTH) {
+            return 1 + width;
+        }
+        if (type == DataType::COMPACT_ARRAY) {
+            auto offset = size_t{1};
+            try {
+                skip_type_description(data, size, offset);
+                auto length = read_size(data, size, offset);
+                return offset + length;
+            } catch (std::underflow_error const&) {
+                return size + 1; //the type description goes on in the next block
+            }
+        }
+        if (size < 2) {
+            return 2;
+        }
+        auto header = size_t{2};
+        if (data[1] > 0x80) {
+            auto len = data[1] & 0x7FU;
+            if (len > 4) {
+                throw std::invalid_argument{"invalid length"};
+            }
+            header += len;
+            if (size < header) {
+                return header;
+            }
+        }
+        auto offset = size_t{1};
+        auto count = read_size(data, size, offset);
+        if (type == DataType::ARRAY || type == DataType::STRUCTURE) {
+            return header;
+        }
+        return header + (type == DataType::BIT_STRING ? (count + 7) / 8 : count);
+    }
+
+    void StreamParser::element(const uint8_t *data, size_t size)
+    {
+        if (!remaining_.empty()) {
+            --remaining_.back();
+        }
+        auto type = static_cast<DataType>(data[0]);
+        if (type == DataType::ARRAY || type == DataType::STRUCTURE) {
+            if (remaining_.size() == MAX_DEPTH) {
+                throw std::invalid_argument{"values nested too deep"};
+            }
+            auto offset = size_t{1};
+            auto count = read_size(data, size, offset);
+            if (type == DataType::ARRAY) {
+                handler_.begin_array(count);
+            } else {
+                handler_.begin_structure(count);
+            }
+            remaining_.push_back(count);
+        } else if (type == DataType::COMPACT_ARRAY) {
+            handler_.value(type, data + 1, size - 1);
+        } else {
+            auto offset = size_t{0};
+            Value value;
+            read_scalar(data, size, offset, value);
+            if (fixed_width(type) != VARIABLE_WIDTH) {
+                handler_.value(type, data + 1, size - 1);
+            } else {
+                handler_.value(type, value.bytes, value.size);
+            }
+        }
+        while (!remaining_.empty() && remaining_.back() == 0) {
+            remaining_.pop_back();
+            handler_.end();
+        }
+    }
+
+    /**
+     * A value cut by the end of a block is gathered in pending_, growing it to the size the bytes
+     * gathered so far announce, and parsed once complete.
+     */
+    void StreamParser::feed(const uint8_t *data, size_t size)
+    {
+        auto position = size_t{0};
+        while (!pending_.empty() && position < size) {
+            auto needed = element_size(pending_.data(), pending_.size());
+            auto take = std::min(needed - pending_.size(), size - position);
+            pending_.insert(pending_.end(), data + position, data + position + take);
+            position += take;
+            if (element_size(pending_.data(), pending_.size()) == pending_.size()) {
+                element(pending_.data(), pending_.size());
+                pending_.clear();
+            }
+        }
+
+        while (position < size) {
+            auto available = size - position;
+            auto needed = element_size(data + position, available);
+            if (needed > available) {
+                pending_.assign(data + position, data + size);
+                return;
+            }
+            element(data + position, needed);
+            position += needed;
+        }
+    }
+
+    bool StreamParser::complete() const
+    {
+        return remaining_.empty() && pending_.empty();
+    }
+
+    void StreamParser::reset()
+    {
+        remaining_.clear();
+        pending_.clear();
+    }
+
+    auto to_string(const std::vector<uint8_t> &buffer) -> std::string
+    {
+        if (buffer.size() < 2) {
+            return {};
+        }
+
+        auto offset = size_t{0};
+        Value value;
+        if (!read_scalar(buffer.data(), buffer.size(), offset, value)) {
+            return {};
+        }
+        switch (value.type) {
+            case DataType::OCTET_STRING:
+            case DataType::STRING:
+            case DataType::UTF8_STRING:
+                return std::string(value.bytes, value.bytes + value.size);
+            case DataType::INT8:
+            case DataType::INT16:
+            case DataType::INT32:
+            case DataType::INT64:
+                return std::to_string(value.integer);
+            case DataType::BOOLEAN:
+            case DataType::BCD:
+            case DataType::UINT8:
+            case DataType::UINT16:
+            case DataType::UINT32:
+            case DataType::UINT64:
+            case DataType::ENUM:
+                return std::to_string(value.unsigned_integer);
+            case DataType::FLOAT32:
+            case DataType::FLOAT64:
+                return std::to_string(value.real);
+            default:
+                return {};
+        }
     }
 
     auto to_bytes(std::vector<uint8_t> const& buffer) -> std::vector<uint8_t>
     {
-        return {};
+        auto offset = size_t{0};
+        Value value;
+        if (buffer.empty() || !read_scalar(buffer.data(), buffer.size(), offset, value) || !has_bytes(value.type)) {
+            return {};
+        }
+        auto length = value.type == DataType::BIT_STRING ? (value.size + size_t{7}) / 8 : size_t{value.size};
+        return {value.bytes, value.bytes + length};
     }
 
 }
@@ -0,0 +1,98 @@
+/*
+ * This file is part of the yadi.cpp project.
+ *
+ * Copyright (C) 2017 Paulo Faco <paulofaco@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef YADI_DLMS_DATA_TYPE_H
+#define YADI_DLMS_DATA_TYPE_H
+
+#include <yadi/parser.h>
+#include <cstddef>
+#include <cstdint>
+
+namespace dlms
+{
+
+/**
+ * Values nested deeper than this are rejected rather than risking the stack on a hostile buffer
+ */
+static const unsigned MAX_DEPTH = 32;
+
+static const size_t VARIABLE_WIDTH = SIZE_MAX;
+
+inline auto read_big_endian(const uint8_t *data, size_t size) -> uint64_t
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; ++i) {
+        value = value << 8U | data[i];
+    }
+    return value;
+}
+
+/**
+ * @return true for the types whose contents are kept as bytes: strings, bit strings, dates and times
+ */
+bool has_bytes(DataType type);
+
+/**
+ * @return bytes of the contents of a value of a fixed-size type, VARIABLE_WIDTH for strings,
+ * arrays and structures
+ * @throw std::invalid_argument on an unknown tag
+ */
+auto fixed_width(DataType type) -> size_t;
+
+/**
+ * Reads a value without children. The bytes of strings, dates and times point into data.
+ * @return false, with offset unchanged, on an array, compact array or structure
+ */
+bool read_scalar(const uint8_t *data, size_t size, size_t &offset, Value &value);
+
+/**
+ * Reads the untagged contents of a value without children, e.g. an element of a compact array
+ * @param offset position of the contents, moved past them
+ */
+void read_contents(DataType type, const uint8_t *data, size_t size, size_t &offset, Value &value);
+
+/**
+ * Moves offset past the type description of a compact array, a tag followed for an array by its
+ * number of elements on two bytes and the description of an element, for a structure by its number
+ * of fields and their descriptions
+ * @throw std::invalid_argument on an unknown tag, a description nested too deep, or one with an
+ *        empty array or structure or a type without contents, whose elements could be expanded
+ *        without consuming any byte
+ */
+void skip_type_description(const uint8_t *data, size_t size, size_t &offset, unsigned depth = 0);
+
+/**
+ * @return seconds since the Unix epoch in UTC of the 12 bytes of a DATE_TIME, or NO_TIMESTAMP,
+ * see to_epoch_nanoseconds
+ */
+auto epoch_seconds(const uint8_t *date_time) -> int64_t;
+
+/**
+ * Writes the 12 bytes of a DATE_TIME, see from_epoch_nanoseconds
+ */
+void write_date_time(int64_t seconds, unsigned hundredths, int16_t deviation, uint8_t *date_time);
+
+/**
+ * Moves offset past the value at offset and all values nested in it
+ */
+void skip_value(const uint8_t *data, size_t size, size_t &offset, unsigned depth = 0);
+
+}
+
+#endif //YADI_DLMS_DATA_TYPE_H
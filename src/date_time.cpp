@@ -0,0 +1,155 @@
+/*
+ * This file is part of the yadi.cpp project.
+ *
+ * Copyright (C) 2017 Paulo Faco <paulofaco@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+///@file
+
+#include <yadi/date_time.h>
+#include "data_type.h"
+#include <cstring>
+
+namespace dlms
+{
+
+    /**
+     * Days from 1970-01-01 to a date of the proleptic Gregorian calendar
+     */
+    static inline auto days_from_civil(int64_t year, unsigned month, unsigned day) -> int64_t
+    {
+        year -= month <= 2;
+        auto era = (year >= 0 ? year : year - 399) / 400;
+        auto year_of_era = static_cast<unsigned>(year - era * 400);
+        auto day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+        auto day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+        return era * 146097 + static_cast<int64_t>(day_of_era) - 719468;
+    }
+
+    /**
+     * Date of the proleptic Gregorian calendar that is days from 1970-01-01
+     */
+    static void civil_from_days(int64_t days, int64_t &year, unsigned &month, unsigned &day)
+    {
+        days += 719468;
+        auto era = (days >= 0 ? days : days - 146096) / 146097;
+        auto day_of_era = static_cast<unsigned>(days - era * 146097);
+        auto year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+        auto day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+        auto month_index = (5 * day_of_year + 2) / 153;
+        day = day_of_year - (153 * month_index + 2) / 5 + 1;
+        month = month_index < 10 ? month_index + 3 : month_index - 9;
+        year = static_cast<int64_t>(year_of_era) + era * 400 + (month <= 2);
+    }
+
+    /**
+     * The fields are checked together, with a single branch on the result, since timestamps of a
+     * profile are nearly always valid
+     */
+    auto epoch_seconds(const uint8_t *date_time) -> int64_t
+    {
+        auto year = static_cast<unsigned>(date_time[0] << 8U | date_time[1]);
+        unsigned month = date_time[2];
+        unsigned day = date_time[3];
+        unsigned hour = date_time[5];
+        unsigned minute = date_time[6];
+        unsigned second = date_time[7];
+        unsigned status = date_time[11];
+        auto valid = (year != 0xFFFF) & (month - 1 < 12) & (day - 1 < 31) & (hour < 24) & (minute < 60) & (second < 60) &
+                     ((status == 0xFF) | ((status & 0x01U) == 0));
+        if (!valid) {
+            return NO_TIMESTAMP;
+        }
+        auto deviation = static_cast<int16_t>(date_time[9] << 8U | date_time[10]);
+        auto time = static_cast<int64_t>(hour * 3600 + minute * 60 + second) + (deviation == INT16_MIN ? 0 : deviation) * 60;
+        return days_from_civil(year, month, day) * 86400 + time;
+    }
+
+    void write_date_time(int64_t seconds, unsigned hundredths, int16_t deviation, uint8_t *date_time)
+    {
+        if (seconds == NO_TIMESTAMP) {
+            std::memset(date_time, 0xFF, 12);
+            date_time[9] = 0x80;
+            date_time[10] = 0x00;
+            return;
+        }
+        auto local = seconds - (deviation == INT16_MIN ? 0 : deviation) * 60;
+        auto days = (local >= 0 ? local : local - 86399) / 86400;
+        auto time = local - days * 86400;
+        int64_t year;
+        unsigned month;
+        unsigned day;
+        civil_from_days(days, year, month, day);
+        date_time[0] = static_cast<uint8_t>(year >> 8);
+        date_time[1] = static_cast<uint8_t>(year);
+        date_time[2] = static_cast<uint8_t>(month);
+        date_time[3] = static_cast<uint8_t>(day);
+        date_time[4] = static_cast<uint8_t>((days % 7 + 10) % 7 + 1); //1970-01-01 was a Thursday, Monday is 1
+        date_time[5] = static_cast<uint8_t>(time / 3600);
+        date_time[6] = static_cast<uint8_t>(time / 60 % 60);
+        date_time[7] = static_cast<uint8_t>(time % 60);
+        date_time[8] = static_cast<uint8_t>(hundredths);
+        date_time[9] = static_cast<uint8_t>(static_cast<uint16_t>(deviation) >> 8U);
+        date_time[10] = static_cast<uint8_t>(deviation);
+        date_time[11] = 0;
+    }
+
+    /**
+     * Seconds whose nanoseconds, with up to 99 hundredths added, fit in an int64_t
+     */
+    static const int64_t MAX_SECONDS = INT64_MAX / 1000000000 - 1;
+
+    auto to_epoch_nanoseconds(const uint8_t *date_time) -> int64_t
+    {
+        auto seconds = epoch_seconds(date_time);
+        if (seconds < -MAX_SECONDS || seconds > MAX_SECONDS) {
+            return NO_TIMESTAMP;
+        }
+        auto hundredths = date_time[8] < 100 ? date_time[8] : 0;
+        return seconds * 1000000000 + hundredths * 10000000;
+    }
+
+    void to_epoch_nanoseconds(const uint8_t *data, size_t stride, size_t count, int64_t *out)
+    {
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = to_epoch_nanoseconds(data + i * stride);
+        }
+    }
+
+    void from_epoch_nanoseconds(int64_t nanoseconds, uint8_t *date_time, int16_t deviation)
+    {
+        if (nanoseconds == NO_TIMESTAMP) {
+            write_date_time(NO_TIMESTAMP, 0, deviation, date_time);
+            return;
+        }
+        auto seconds = nanoseconds / 1000000000;
+        auto rest = nanoseconds % 1000000000;
+        if (rest < 0) {
+            --seconds;
+            rest += 1000000000;
+        }
+        write_date_time(seconds, static_cast<unsigned>(rest / 10000000), deviation, date_time);
+    }
+
+    auto from_epoch_nanoseconds(int64_t nanoseconds, int16_t deviation) -> std::vector<uint8_t>
+    {
+        std::vector<uint8_t> date_time(12);
+        from_epoch_nanoseconds(nanoseconds, date_time.data(), deviation);
+        return date_time;
+    }
+
+}
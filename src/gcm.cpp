@@ -0,0 +1,656 @@
+/*
+ * This file is part of the yadi.cpp project.
+ *
+ * Copyright (C) 2017 Paulo Faco <paulofaco@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+///@file
+
+#include <yadi/gcm.h>
+#include "cpu.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if defined(YADI_X86)
+#include <immintrin.h>
+#endif
+
+namespace dlms
+{
+
+    static const uint8_t SBOX[256] = {
+        0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+        0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+        0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+        0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+        0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+        0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+        0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+        0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+        0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+        0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+        0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+        0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+        0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+        0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+        0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+        0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+    };
+
+    /**
+     * Encryption T-table: column (2s, s, s, 3s) of the MixColumns matrix applied to each S-box output.
+     * The other three tables are byte rotations of this one.
+     */
+    struct AesTable {
+        uint32_t te[256];
+
+        AesTable() {
+            for (auto i = 0; i < 256; ++i) {
+                uint32_t s = SBOX[i];
+                uint32_t s2 = ((s << 1U) ^ ((s & 0x80U) ? 0x1BU : 0U)) & 0xFFU;
+                te[i] = (s2 << 24U) | (s << 16U) | (s << 8U) | (s2 ^ s);
+            }
+        }
+    };
+
+    static const AesTable& aes_table() {
+        static const AesTable table;
+        return table;
+    }
+
+    static inline uint32_t ror(uint32_t x, unsigned n) {
+        return (x >> n) | (x << (32U - n));
+    }
+
+    static inline uint32_t load_be32(const uint8_t *p) {
+        return static_cast<uint32_t>(p[0]) << 24U | static_cast<uint32_t>(p[1]) << 16U |
+               static_cast<uint32_t>(p[2]) << 8U | p[3];
+    }
+
+    static inline void store_be32(uint8_t *p, uint32_t v) {
+        p[0] = static_cast<uint8_t>(v >> 24U);
+        p[1] = static_cast<uint8_t>(v >> 16U);
+        p[2] = static_cast<uint8_t>(v >> 8U);
+        p[3] = static_cast<uint8_t>(v);
+    }
+
+    static inline uint64_t load_be64(const uint8_t *p) {
+        return static_cast<uint64_t>(load_be32(p)) << 32U | load_be32(p + 4);
+    }
+
+    static inline void store_be64(uint8_t *p, uint64_t v) {
+        store_be32(p, static_cast<uint32_t>(v >> 32U));
+        store_be32(p + 4, static_cast<uint32_t>(v));
+    }
+
+    static void aes_expand_key(const uint8_t *key, uint32_t *rk) {
+        static const uint32_t RCON[10] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36};
+        for (auto i = 0; i < 4; ++i) {
+            rk[i] = load_be32(key + 4 * i);
+        }
+        for (auto i = 4; i < 44; ++i) {
+            auto temp = rk[i - 1];
+            if (i % 4 == 0) {
+                temp = (static_cast<uint32_t>(SBOX[(temp >> 16U) & 0xFFU]) << 24U) |
+                       (static_cast<uint32_t>(SBOX[(temp >> 8U) & 0xFFU]) << 16U) |
+                       (static_cast<uint32_t>(SBOX[temp & 0xFFU]) << 8U) |
+                       (static_cast<uint32_t>(SBOX[temp >> 24U])) ;
+                temp ^= RCON[i / 4 - 1] << 24U;
+            }
+            rk[i] = rk[i - 4] ^ temp;
+        }
+    }
+
+    static void aes_encrypt_block(const uint32_t *rk, const uint8_t *in, uint8_t *out) {
+        auto const& te = aes_table().te;
+        auto s0 = load_be32(in) ^ rk[0];
+        auto s1 = load_be32(in + 4) ^ rk[1];
+        auto s2 = load_be32(in + 8) ^ rk[2];
+        auto s3 = load_be32(in + 12) ^ rk[3];
+
+        for (auto round = 1; round < 10; ++round) {
+            rk += 4;
+            auto t0 = te[s0 >> 24U] ^ ror(te[(s1 >> 16U) & 0xFFU], 8) ^ ror(te[(s2 >> 8U) & 0xFFU], 16) ^ ror(te[s3 & 0xFFU], 24) ^ rk[0];
+            auto t1 = te[s1 >> 24U] ^ ror(te[(s2 >> 16U) & 0xFFU], 8) ^ ror(te[(s3 >> 8U) & 0xFFU], 16) ^ ror(te[s0 & 0xFFU], 24) ^ rk[1];
+            auto t2 = te[s2 >> 24U] ^ ror(te[(s3 >> 16U) & 0xFFU], 8) ^ ror(te[(s0 >> 8U) & 0xFFU], 16) ^ ror(te[s1 & 0xFFU], 24) ^ rk[2];
+            auto t3 = te[s3 >> 24U] ^ ror(te[(s0 >> 16U) & 0xFFU], 8) ^ ror(te[(s1 >> 8U) & 0xFFU], 16) ^ ror(te[s2 & 0xFFU], 24) ^ rk[3];
+            s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+        }
+
+        rk += 4;
+        auto last = [](uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+            return static_cast<uint32_t>(SBOX[a >> 24U]) << 24U | static_cast<uint32_t>(SBOX[(b >> 16U) & 0xFFU]) << 16U |
+                   static_cast<uint32_t>(SBOX[(c >> 8U) & 0xFFU]) << 8U | SBOX[d & 0xFFU];
+        };
+        store_be32(out, last(s0, s1, s2, s3) ^ rk[0]);
+        store_be32(out + 4, last(s1, s2, s3, s0) ^ rk[1]);
+        store_be32(out + 8, last(s2, s3, s0, s1) ^ rk[2]);
+        store_be32(out + 12, last(s3, s0, s1, s2) ^ rk[3]);
+    }
+
+    /**
+     * GHASH multiplication by H with Shoup's 4-bit tables
+     */
+    static void ghash_mult(const uint64_t *hh, const uint64_t *hl, uint8_t *x) {
+        static const uint64_t LAST4[16] = {
+            0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+            0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+        };
+
+        auto lo = x[15] & 0x0FU;
+        auto zh = hh[lo];
+        auto zl = hl[lo];
+
+        for (auto i = 15; i >= 0; --i) {
+            lo = x[i] & 0x0FU;
+            auto hi = (x[i] >> 4U) & 0x0FU;
+
+            if (i != 15) {
+                auto rem = static_cast<unsigned>(zl & 0x0FU);
+                zl = (zh << 60U) | (zl >> 4U);
+                zh = (zh >> 4U) ^ (LAST4[rem] << 48U);
+                zh ^= hh[lo];
+                zl ^= hl[lo];
+            }
+
+            auto rem = static_cast<unsigned>(zl & 0x0FU);
+            zl = (zh << 60U) | (zl >> 4U);
+            zh = (zh >> 4U) ^ (LAST4[rem] << 48U);
+            zh ^= hh[hi];
+            zl ^= hl[hi];
+        }
+
+        store_be64(x, zh);
+        store_be64(x + 8, zl);
+    }
+
+    static void ghash_update(const uint64_t *hh, const uint64_t *hl, uint8_t *x, const uint8_t *data, size_t size) {
+        while (size > 0) {
+            auto n = size < 16 ? size : size_t{16};
+            for (size_t i = 0; i < n; ++i) {
+                x[i] ^= data[i];
+            }
+            ghash_mult(hh, hl, x);
+            data += n;
+            size -= n;
+        }
+    }
+
+    static inline void increment_counter(uint8_t *counter) {
+        store_be32(counter + 12, load_be32(counter + 12) + 1);
+    }
+
+#if defined(YADI_X86)
+
+#define GCM_HW_TARGET YADI_TARGET("aes,pclmul,ssse3,sse4.1")
+
+    GCM_HW_TARGET static inline __m128i byte_swap(__m128i x) {
+        return _mm_shuffle_epi8(x, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    }
+
+    /**
+     * Carry-less multiplication of two byte reflected blocks, without reduction
+     */
+    GCM_HW_TARGET static inline void clmul(__m128i a, __m128i b, __m128i &lo, __m128i &hi) {
+        auto t0 = _mm_clmulepi64_si128(a, b, 0x00);
+        auto t1 = _mm_clmulepi64_si128(a, b, 0x10);
+        auto t2 = _mm_clmulepi64_si128(a, b, 0x01);
+        auto t3 = _mm_clmulepi64_si128(a, b, 0x11);
+        t1 = _mm_xor_si128(t1, t2);
+        lo = _mm_xor_si128(t0, _mm_slli_si128(t1, 8));
+        hi = _mm_xor_si128(t3, _mm_srli_si128(t1, 8));
+    }
+
+    /**
+     * Reduction of a 256-bit carry-less product modulo x^128 + x^7 + x^2 + x + 1 (bit reflected)
+     */
+    GCM_HW_TARGET static inline __m128i reduce(__m128i lo, __m128i hi) {
+        auto t7 = _mm_srli_epi32(lo, 31);
+        auto t8 = _mm_srli_epi32(hi, 31);
+        lo = _mm_slli_epi32(lo, 1);
+        hi = _mm_slli_epi32(hi, 1);
+        auto t9 = _mm_srli_si128(t7, 12);
+        t8 = _mm_slli_si128(t8, 4);
+        t7 = _mm_slli_si128(t7, 4);
+        lo = _mm_or_si128(lo, t7);
+        hi = _mm_or_si128(hi, t8);
+        hi = _mm_or_si128(hi, t9);
+
+        t7 = _mm_slli_epi32(lo, 31);
+        t8 = _mm_slli_epi32(lo, 30);
+        t9 = _mm_slli_epi32(lo, 25);
+        t7 = _mm_xor_si128(t7, t8);
+        t7 = _mm_xor_si128(t7, t9);
+        t8 = _mm_srli_si128(t7, 4);
+        t7 = _mm_slli_si128(t7, 12);
+        lo = _mm_xor_si128(lo, t7);
+
+        auto t2 = _mm_srli_epi32(lo, 1);
+        auto t4 = _mm_srli_epi32(lo, 2);
+        auto t5 = _mm_srli_epi32(lo, 7);
+        t2 = _mm_xor_si128(t2, t4);
+        t2 = _mm_xor_si128(t2, t5);
+        t2 = _mm_xor_si128(t2, t8);
+        lo = _mm_xor_si128(lo, t2);
+        return _mm_xor_si128(hi, lo);
+    }
+
+    GCM_HW_TARGET static inline __m128i gfmul(__m128i a, __m128i b) {
+        __m128i lo, hi;
+        clmul(a, b, lo, hi);
+        return reduce(lo, hi);
+    }
+
+    /**
+     * Folds four blocks into the GHASH state with a single reduction: X = (X + C1)H^4 + C2H^3 + C3H^2 + C4H
+     */
+    GCM_HW_TARGET static inline __m128i ghash4(__m128i x, const __m128i *h, __m128i c0, __m128i c1, __m128i c2, __m128i c3) {
+        __m128i lo, hi, l, r;
+        clmul(_mm_xor_si128(x, byte_swap(c0)), h[3], lo, hi);
+        clmul(byte_swap(c1), h[2], l, r);
+        lo = _mm_xor_si128(lo, l);
+        hi = _mm_xor_si128(hi, r);
+        clmul(byte_swap(c2), h[1], l, r);
+        lo = _mm_xor_si128(lo, l);
+        hi = _mm_xor_si128(hi, r);
+        clmul(byte_swap(c3), h[0], l, r);
+        lo = _mm_xor_si128(lo, l);
+        hi = _mm_xor_si128(hi, r);
+        return reduce(lo, hi);
+    }
+
+    GCM_HW_TARGET static inline __m128i ghash_partial(__m128i x, __m128i h, const uint8_t *data, size_t size) {
+        uint8_t block[16] = {0};
+        std::memcpy(block, data, size);
+        return gfmul(_mm_xor_si128(x, byte_swap(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block)))), h);
+    }
+
+    GCM_HW_TARGET static inline __m128i aes_encrypt(__m128i block, const __m128i *rk) {
+        block = _mm_xor_si128(block, rk[0]);
+        for (auto i = 1; i < 10; ++i) {
+            block = _mm_aesenc_si128(block, rk[i]);
+        }
+        return _mm_aesenclast_si128(block, rk[10]);
+    }
+
+    GCM_HW_TARGET static inline __m128i counter_block(__m128i j0, uint32_t n) {
+        n = (n >> 24U) | ((n >> 8U) & 0xFF00U) | ((n << 8U) & 0xFF0000U) | (n << 24U);
+        return _mm_insert_epi32(j0, static_cast<int>(n), 3);
+    }
+
+    GCM_HW_TARGET static void hw_compute_h_powers(const uint8_t *round_keys, uint8_t (*h_powers)[16]) {
+        __m128i rk[11];
+        for (auto i = 0; i < 11; ++i) {
+            rk[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(round_keys + 16 * i));
+        }
+        auto h = byte_swap(aes_encrypt(_mm_setzero_si128(), rk));
+        auto power = h;
+        for (auto i = 0; i < 4; ++i) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(h_powers[i]), power);
+            power = gfmul(power, h);
+        }
+    }
+
+    GCM_HW_TARGET static void hw_crypt(const uint8_t *round_keys, const uint8_t (*h_powers)[16], const uint8_t *iv,
+                                       const uint8_t *aad, size_t aad_size, uint8_t *data, size_t size,
+                                       uint8_t *tag, bool decrypting)
+    {
+        __m128i rk[11];
+        for (auto i = 0; i < 11; ++i) {
+            rk[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(round_keys + 16 * i));
+        }
+        __m128i h[4];
+        for (auto i = 0; i < 4; ++i) {
+            h[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h_powers[i]));
+        }
+
+        uint8_t j0_bytes[16] = {0};
+        std::memcpy(j0_bytes, iv, Gcm::IV_SIZE);
+        auto j0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(j0_bytes));
+        auto x = _mm_setzero_si128();
+
+        auto a = aad;
+        auto remaining = aad_size;
+        for (; remaining >= 64; remaining -= 64, a += 64) {
+            auto p = reinterpret_cast<const __m128i*>(a);
+            x = ghash4(x, h, _mm_loadu_si128(p), _mm_loadu_si128(p + 1), _mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3));
+        }
+        for (; remaining >= 16; remaining -= 16, a += 16) {
+            x = gfmul(_mm_xor_si128(x, byte_swap(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a)))), h[0]);
+        }
+        if (remaining > 0) {
+            x = ghash_partial(x, h[0], a, remaining);
+        }
+
+        auto counter = uint32_t{2};
+
+        auto d = data;
+        remaining = size;
+        for (; remaining >= 64; remaining -= 64, d += 64, counter += 4) {
+            auto k0 = _mm_xor_si128(counter_block(j0, counter), rk[0]);
+            auto k1 = _mm_xor_si128(counter_block(j0, counter + 1), rk[0]);
+            auto k2 = _mm_xor_si128(counter_block(j0, counter + 2), rk[0]);
+            auto k3 = _mm_xor_si128(counter_block(j0, counter + 3), rk[0]);
+            for (auto i = 1; i < 10; ++i) {
+                k0 = _mm_aesenc_si128(k0, rk[i]);
+                k1 = _mm_aesenc_si128(k1, rk[i]);
+                k2 = _mm_aesenc_si128(k2, rk[i]);
+                k3 = _mm_aesenc_si128(k3, rk[i]);
+            }
+            k0 = _mm_aesenclast_si128(k0, rk[10]);
+            k1 = _mm_aesenclast_si128(k1, rk[10]);
+            k2 = _mm_aesenclast_si128(k2, rk[10]);
+            k3 = _mm_aesenclast_si128(k3, rk[10]);
+
+            auto p = reinterpret_cast<__m128i*>(d);
+            auto b0 = _mm_loadu_si128(p);
+            auto b1 = _mm_loadu_si128(p + 1);
+            auto b2 = _mm_loadu_si128(p + 2);
+            auto b3 = _mm_loadu_si128(p + 3);
+            auto c0 = _mm_xor_si128(b0, k0);
+            auto c1 = _mm_xor_si128(b1, k1);
+            auto c2 = _mm_xor_si128(b2, k2);
+            auto c3 = _mm_xor_si128(b3, k3);
+            _mm_storeu_si128(p, c0);
+            _mm_storeu_si128(p + 1, c1);
+            _mm_storeu_si128(p + 2, c2);
+            _mm_storeu_si128(p + 3, c3);
+            x = decrypting ? ghash4(x, h, b0, b1, b2, b3) : ghash4(x, h, c0, c1, c2, c3);
+        }
+        for (; remaining >= 16; remaining -= 16, d += 16, ++counter) {
+            auto p = reinterpret_cast<__m128i*>(d);
+            auto b = _mm_loadu_si128(p);
+            auto c = _mm_xor_si128(b, aes_encrypt(counter_block(j0, counter), rk));
+            _mm_storeu_si128(p, c);
+            x = gfmul(_mm_xor_si128(x, byte_swap(decrypting ? b : c)), h[0]);
+        }
+        if (remaining > 0) {
+            uint8_t keystream[16];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(keystream), aes_encrypt(counter_block(j0, counter), rk));
+            if (decrypting) {
+                x = ghash_partial(x, h[0], d, remaining);
+            }
+            for (size_t i = 0; i < remaining; ++i) {
+                d[i] ^= keystream[i];
+            }
+            if (!decrypting) {
+                x = ghash_partial(x, h[0], d, remaining);
+            }
+        }
+
+        auto lengths = _mm_set_epi64x(static_cast<long long>(aad_size * 8), static_cast<long long>(size * 8));
+        x = gfmul(_mm_xor_si128(x, lengths), h[0]);
+        auto t = _mm_xor_si128(byte_swap(x), aes_encrypt(counter_block(j0, 1), rk));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(tag), t);
+    }
+
+    static const size_t LANES = 8;
+
+    /**
+     * Inputs of one lane of hw_decrypt_lanes. Unused lanes repeat lane 0 with no data.
+     */
+    struct Lane {
+        const uint8_t *round_keys;
+        const uint8_t *h;
+        const uint8_t *iv;
+        const uint8_t *aad;
+        size_t aad_size;
+        uint8_t *data;
+        size_t size;
+        uint8_t *tag;
+    };
+
+    GCM_HW_TARGET static inline __m128i lane_round_key(Lane const& lane, int round) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(lane.round_keys + 16 * round));
+    }
+
+    /**
+     * Encrypts one block per lane, the rounds of the lanes interleaved
+     */
+    GCM_HW_TARGET static inline void aes_encrypt_lanes(const Lane *lanes, __m128i *blocks) {
+        for (size_t l = 0; l < LANES; ++l) {
+            blocks[l] = _mm_xor_si128(blocks[l], lane_round_key(lanes[l], 0));
+        }
+        for (auto r = 1; r < 10; ++r) {
+            for (size_t l = 0; l < LANES; ++l) {
+                blocks[l] = _mm_aesenc_si128(blocks[l], lane_round_key(lanes[l], r));
+            }
+        }
+        for (size_t l = 0; l < LANES; ++l) {
+            blocks[l] = _mm_aesenclast_si128(blocks[l], lane_round_key(lanes[l], 10));
+        }
+    }
+
+    /**
+     * Decrypts up to eight messages in lock step, one block of each per step, and writes their tags
+     */
+    GCM_HW_TARGET static void hw_decrypt_lanes(const Lane *lanes) {
+        __m128i h[LANES], j0[LANES], x[LANES], ks[LANES];
+        auto longest = size_t{0};
+        for (size_t l = 0; l < LANES; ++l) {
+            auto const& lane = lanes[l];
+            h[l] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lane.h));
+            uint8_t j0_bytes[16] = {0};
+            std::memcpy(j0_bytes, lane.iv, Gcm::IV_SIZE);
+            j0[l] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(j0_bytes));
+
+            x[l] = _mm_setzero_si128();
+            auto a = lane.aad;
+            auto remaining = lane.aad_size;
+            for (; remaining >= 16; remaining -= 16, a += 16) {
+                x[l] = gfmul(_mm_xor_si128(x[l], byte_swap(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a)))), h[l]);
+            }
+            if (remaining > 0) {
+                x[l] = ghash_partial(x[l], h[l], a, remaining);
+            }
+            longest = std::max(longest, lane.size);
+        }
+
+        auto counter = uint32_t{2};
+        for (size_t offset = 0; offset < longest; offset += 16, ++counter) {
+            for (size_t l = 0; l < LANES; ++l) {
+                ks[l] = counter_block(j0[l], counter);
+            }
+            aes_encrypt_lanes(lanes, ks);
+            for (size_t l = 0; l < LANES; ++l) {
+                auto const& lane = lanes[l];
+                if (offset >= lane.size) {
+                    continue;
+                }
+                auto p = lane.data + offset;
+                auto n = lane.size - offset;
+                if (n >= 16) {
+                    auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+                    x[l] = gfmul(_mm_xor_si128(x[l], byte_swap(b)), h[l]);
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_xor_si128(b, ks[l]));
+                } else {
+                    x[l] = ghash_partial(x[l], h[l], p, n);
+                    uint8_t keystream[16];
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(keystream), ks[l]);
+                    for (size_t i = 0; i < n; ++i) {
+                        p[i] ^= keystream[i];
+                    }
+                }
+            }
+        }
+
+        for (size_t l = 0; l < LANES; ++l) {
+            auto lengths = _mm_set_epi64x(static_cast<long long>(lanes[l].aad_size * 8), static_cast<long long>(lanes[l].size * 8));
+            x[l] = gfmul(_mm_xor_si128(x[l], lengths), h[l]);
+            ks[l] = counter_block(j0[l], 1);
+        }
+        aes_encrypt_lanes(lanes, ks);
+        for (size_t l = 0; l < LANES; ++l) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes[l].tag), _mm_xor_si128(byte_swap(x[l]), ks[l]));
+        }
+    }
+
+#endif
+
+    bool Gcm::hardware_supported()
+    {
+#if defined(YADI_X86)
+        return cpu::has_aesni() && cpu::has_pclmul() && cpu::has_ssse3() && cpu::has_sse41();
+#else
+        return false;
+#endif
+    }
+
+    Gcm::Gcm(std::array<uint8_t,16> const& key, bool allow_hardware) :
+        hardware_{allow_hardware && hardware_supported()},
+        keyed_{true}
+    {
+        aes_expand_key(key.data(), rk_);
+        for (auto i = 0; i < 44; ++i) {
+            store_be32(round_keys_ + 4 * i, rk_[i]);
+        }
+
+        uint8_t h[16] = {0};
+        aes_encrypt_block(rk_, h, h);
+
+        auto vh = load_be64(h);
+        auto vl = load_be64(h + 8);
+        hl_[8] = vl;
+        hh_[8] = vh;
+        for (auto i = 4; i > 0; i >>= 1) {
+            auto t = (vl & 1U) * 0xE1000000U;
+            vl = (vh << 63U) | (vl >> 1U);
+            vh = (vh >> 1U) ^ (static_cast<uint64_t>(t) << 32U);
+            hl_[i] = vl;
+            hh_[i] = vh;
+        }
+        for (auto i = 2; i <= 8; i *= 2) {
+            for (auto j = 1; j < i; ++j) {
+                hh_[i + j] = hh_[i] ^ hh_[j];
+                hl_[i + j] = hl_[i] ^ hl_[j];
+            }
+        }
+
+#if defined(YADI_X86)
+        if (hardware_) {
+            hw_compute_h_powers(round_keys_, h_powers_);
+        }
+#endif
+    }
+
+    void Gcm::crypt(const uint8_t *iv, const uint8_t *aad, size_t aad_size, uint8_t *data, size_t size,
+                    uint8_t *tag, bool decrypting) const
+    {
+#if defined(YADI_X86)
+        if (hardware_) {
+            hw_crypt(round_keys_, h_powers_, iv, aad, aad_size, data, size, tag, decrypting);
+            return;
+        }
+#endif
+        uint8_t x[16] = {0};
+        uint8_t counter[16] = {0};
+        uint8_t keystream[16];
+
+        ghash_update(hh_, hl_, x, aad, aad_size);
+
+        std::memcpy(counter, iv, IV_SIZE);
+        counter[15] = 2;
+        for (size_t offset = 0; offset < size; offset += BLOCK_SIZE) {
+            auto n = size - offset < BLOCK_SIZE ? size - offset : BLOCK_SIZE;
+            if (decrypting) {
+                ghash_update(hh_, hl_, x, data + offset, n);
+            }
+            aes_encrypt_block(rk_, counter, keystream);
+            increment_counter(counter);
+            for (size_t i = 0; i < n; ++i) {
+                data[offset + i] ^= keystream[i];
+            }
+            if (!decrypting) {
+                ghash_update(hh_, hl_, x, data + offset, n);
+            }
+        }
+
+        uint8_t lengths[16];
+        store_be64(lengths, static_cast<uint64_t>(aad_size) * 8);
+        store_be64(lengths + 8, static_cast<uint64_t>(size) * 8);
+        ghash_update(hh_, hl_, x, lengths, sizeof(lengths));
+
+        counter[12] = counter[13] = counter[14] = 0;
+        counter[15] = 1;
+        aes_encrypt_block(rk_, counter, keystream);
+        for (auto i = 0; i < 16; ++i) {
+            tag[i] = x[i] ^ keystream[i];
+        }
+    }
+
+    static bool tag_matches(const uint8_t *computed, const uint8_t *tag, size_t tag_size) {
+        auto diff = uint8_t{0};
+        for (size_t i = 0; i < tag_size && i < 16; ++i) {
+            diff |= computed[i] ^ tag[i];
+        }
+        return diff == 0;
+    }
+
+    void Gcm::encrypt(const uint8_t *iv, const uint8_t *aad, size_t aad_size, uint8_t *data, size_t size,
+                      uint8_t *tag, size_t tag_size) const
+    {
+        uint8_t full_tag[16];
+        crypt(iv, aad, aad_size, data, size, full_tag, false);
+        std::memcpy(tag, full_tag, tag_size < 16 ? tag_size : 16);
+    }
+
+    bool Gcm::decrypt(const uint8_t *iv, const uint8_t *aad, size_t aad_size, uint8_t *data, size_t size,
+                      const uint8_t *tag, size_t tag_size) const
+    {
+        uint8_t full_tag[16];
+        crypt(iv, aad, aad_size, data, size, full_tag, true);
+        return tag_matches(full_tag, tag, tag_size);
+    }
+
+    /*
+     * Jobs are sorted by size so that the messages sharing a step of the lanes end at about the same
+     * block. Jobs whose Gcm has no hardware support are decrypted one by one.
+     */
+    void Gcm::decrypt_many(GcmJob *jobs, size_t count)
+    {
+        auto order = std::vector<GcmJob*>{};
+        order.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            if (jobs[i].gcm->hardware_) {
+                order.push_back(&jobs[i]);
+            } else {
+                jobs[i].valid = jobs[i].gcm->decrypt(jobs[i].iv, jobs[i].aad, jobs[i].aad_size, jobs[i].data,
+                                                     jobs[i].size, jobs[i].tag, jobs[i].tag_size);
+            }
+        }
+#if defined(YADI_X86)
+        std::sort(order.begin(), order.end(), [](GcmJob const* a, GcmJob const* b) { return a->size < b->size; });
+        uint8_t tags[LANES][16];
+        Lane lanes[LANES];
+        for (size_t first = 0; first < order.size(); first += LANES) {
+            auto n = std::min(LANES, order.size() - first);
+            for (size_t l = 0; l < LANES; ++l) {
+                auto const& job = *order[first + (l < n ? l : 0)];
+                lanes[l] = Lane{job.gcm->round_keys_, job.gcm->h_powers_[0], job.iv, job.aad, job.aad_size,
+                                job.data, l < n ? job.size : 0, tags[l]};
+            }
+            hw_decrypt_lanes(lanes);
+            for (size_t l = 0; l < n; ++l) {
+                auto &job = *order[first + l];
+                job.valid = tag_matches(tags[l], job.tag, job.tag_size);
+            }
+        }
+#endif
+    }
+
+}
@@ -0,0 +1,554 @@
+/*
+ * This file is part of the yadi.cpp project.
+ *
+ * Copyright (C) 2017 Paulo Faco <paulofaco@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+///@file
+
+#include "hash.h"
+#include "cpu.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if defined(YADI_X86)
+#include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define YADI_HASH_LANES 1
+#endif
+
+namespace dlms
+{
+
+    static const auto BLOCK_SIZE = size_t{64};
+
+    /*
+     * MD5, SHA-1 and SHA-256 are written once, over a word type W: uint32_t hashes one message, Lanes
+     * hashes four messages of the same block count side by side. W needs + & | ^ ~, rotl and shr.
+     */
+
+    static inline uint32_t rotl(uint32_t x, unsigned n) {
+        return (x << n) | (x >> (32U - n));
+    }
+
+    static inline uint32_t shr(uint32_t x, unsigned n) {
+        return x >> n;
+    }
+
+#if defined(YADI_HASH_LANES)
+    struct Lanes {
+        __m128i v;
+
+        Lanes() = default;
+        Lanes(__m128i x) : v{x} {}
+        Lanes(uint32_t x) : v{_mm_set1_epi32(static_cast<int>(x))} {}
+    };
+
+    static inline Lanes operator+(Lanes a, Lanes b) { return _mm_add_epi32(a.v, b.v); }
+    static inline Lanes operator&(Lanes a, Lanes b) { return _mm_and_si128(a.v, b.v); }
+    static inline Lanes operator|(Lanes a, Lanes b) { return _mm_or_si128(a.v, b.v); }
+    static inline Lanes operator^(Lanes a, Lanes b) { return _mm_xor_si128(a.v, b.v); }
+    static inline Lanes operator~(Lanes a) { return _mm_xor_si128(a.v, _mm_set1_epi32(-1)); }
+
+    static inline Lanes rotl(Lanes x, unsigned n) {
+        return _mm_or_si128(_mm_slli_epi32(x.v, static_cast<int>(n)), _mm_srli_epi32(x.v, static_cast<int>(32U - n)));
+    }
+
+    static inline Lanes shr(Lanes x, unsigned n) {
+        return _mm_srli_epi32(x.v, static_cast<int>(n));
+    }
+#endif
+
+    template<typename W>
+    static inline W rotr(W x, unsigned n) {
+        return rotl(x, 32U - n);
+    }
+
+    static const uint32_t MD5_K[64] = {
+        0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+        0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+        0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+        0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+        0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+        0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+        0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+        0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+    };
+
+    static const uint32_t SHA256_K[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+    };
+
+    struct Md5 {
+        static const size_t STATE_WORDS = 4;
+        static const bool big_endian = false;
+        static const uint32_t IV[STATE_WORDS];
+
+        template<typename W>
+        static void compress(W *state, const W *m) {
+            static const unsigned S[4][4] = {{7, 12, 17, 22}, {5, 9, 14, 20}, {4, 11, 16, 23}, {6, 10, 15, 21}};
+            W a = state[0], b = state[1], c = state[2], d = state[3];
+            for (unsigned i = 0; i < 64; ++i) {
+                W f;
+                unsigned g;
+                switch (i / 16) {
+                    case 0:
+                        f = (b & c) | (~b & d);
+                        g = i;
+                        break;
+                    case 1:
+                        f = (d & b) | (~d & c);
+                        g = (5 * i + 1) % 16;
+                        break;
+                    case 2:
+                        f = b ^ c ^ d;
+                        g = (3 * i + 5) % 16;
+                        break;
+                    default:
+                        f = c ^ (b | ~d);
+                        g = (7 * i) % 16;
+                        break;
+                }
+                f = f + a + W(MD5_K[i]) + m[g];
+                a = d;
+                d = c;
+                c = b;
+                b = b + rotl(f, S[i / 16][i % 4]);
+            }
+            state[0] = state[0] + a;
+            state[1] = state[1] + b;
+            state[2] = state[2] + c;
+            state[3] = state[3] + d;
+        }
+    };
+
+    struct Sha1 {
+        static const size_t STATE_WORDS = 5;
+        static const bool big_endian = true;
+        static const uint32_t IV[STATE_WORDS];
+
+        template<typename W>
+        static void compress(W *state, const W *m) {
+            W w[80];
+            std::copy(m, m + 16, w);
+            for (unsigned t = 16; t < 80; ++t) {
+                w[t] = rotl(w[t - 3] ^ w[t - 8] ^ w[t - 14] ^ w[t - 16], 1);
+            }
+            W a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+            for (unsigned t = 0; t < 80; ++t) {
+                W f;
+                uint32_t k;
+                switch (t / 20) {
+                    case 0:
+                        f = (b & c) | (~b & d);
+                        k = 0x5A827999;
+                        break;
+                    case 1:
+                        f = b ^ c ^ d;
+                        k = 0x6ED9EBA1;
+                        break;
+                    case 2:
+                        f = (b & c) | (b & d) | (c & d);
+                        k = 0x8F1BBCDC;
+                        break;
+                    default:
+                        f = b ^ c ^ d;
+                        k = 0xCA62C1D6;
+                        break;
+                }
+                W temp = rotl(a, 5) + f + e + W(k) + w[t];
+                e = d;
+                d = c;
+                c = rotl(b, 30);
+                b = a;
+                a = temp;
+            }
+            state[0] = state[0] + a;
+            state[1] = state[1] + b;
+            state[2] = state[2] + c;
+            state[3] = state[3] + d;
+            state[4] = state[4] + e;
+        }
+    };
+
+    struct Sha256 {
+        static const size_t STATE_WORDS = 8;
+        static const bool big_endian = true;
+        static const uint32_t IV[STATE_WORDS];
+
+        template<typename W>
+        static void compress(W *state, const W *m) {
+            W w[64];
+            std::copy(m, m + 16, w);
+            for (unsigned t = 16; t < 64; ++t) {
+                W s0 = rotr(w[t - 15], 7) ^ rotr(w[t - 15], 18) ^ shr(w[t - 15], 3);
+                W s1 = rotr(w[t - 2], 17) ^ rotr(w[t - 2], 19) ^ shr(w[t - 2], 10);
+                w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+            }
+            W a = state[0], b = state[1], c = state[2], d = state[3];
+            W e = state[4], f = state[5], g = state[6], h = state[7];
+            for (unsigned t = 0; t < 64; ++t) {
+                W t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + W(SHA256_K[t]) + w[t];
+                W t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+                h = g;
+                g = f;
+                f = e;
+                e = d + t1;
+                d = c;
+                c = b;
+                b = a;
+                a = t1 + t2;
+            }
+            state[0] = state[0] + a;
+            state[1] = state[1] + b;
+            state[2] = state[2] + c;
+            state[3] = state[3] + d;
+            state[4] = state[4] + e;
+            state[5] = state[5] + f;
+            state[6] = state[6] + g;
+            state[7] = state[7] + h;
+        }
+    };
+
+    const uint32_t Md5::IV[] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+    const uint32_t Sha1::IV[] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+    const uint32_t Sha256::IV[] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+    template<typename A>
+    static inline uint32_t load_word(const uint8_t *p) {
+        if (A::big_endian) {
+            return static_cast<uint32_t>(p[0]) << 24U | static_cast<uint32_t>(p[1]) << 16U |
+                   static_cast<uint32_t>(p[2]) << 8U | p[3];
+        }
+        return static_cast<uint32_t>(p[3]) << 24U | static_cast<uint32_t>(p[2]) << 16U |
+               static_cast<uint32_t>(p[1]) << 8U | p[0];
+    }
+
+    template<typename A>
+    static inline void store_word(uint8_t *p, uint32_t x) {
+        for (unsigned i = 0; i < 4; ++i) {
+            p[A::big_endian ? 3 - i : i] = static_cast<uint8_t>(x >> (8U * i));
+        }
+    }
+
+    /**
+     * Writes the last partial block of the message and its padding (0x80, zeros, size in bits in the
+     * byte order of the algorithm) to tail.
+     * @return number of blocks written, 1 or 2
+     */
+    template<typename A>
+    static size_t pad(const uint8_t *data, size_t size, uint8_t *tail) {
+        auto rest = size % BLOCK_SIZE;
+        std::memset(tail, 0, 2 * BLOCK_SIZE);
+        if (rest != 0) {
+            std::memcpy(tail, data + size - rest, rest);
+        }
+        tail[rest] = 0x80;
+        auto blocks = rest + 9 > BLOCK_SIZE ? size_t{2} : size_t{1};
+        auto bits = static_cast<uint64_t>(size) * 8U;
+        auto end = tail + blocks * BLOCK_SIZE - 8;
+        for (unsigned i = 0; i < 8; ++i) {
+            end[A::big_endian ? 7 - i : i] = static_cast<uint8_t>(bits >> (8U * i));
+        }
+        return blocks;
+    }
+
+    static size_t padded_blocks(size_t size) {
+        return (size + 8) / BLOCK_SIZE + 1;
+    }
+
+    using BlockFunction = void (*)(uint32_t *state, const uint8_t *blocks, size_t count);
+
+    template<typename A>
+    static void compress_blocks(uint32_t *state, const uint8_t *blocks, size_t count) {
+        uint32_t m[16];
+        for (size_t b = 0; b < count; ++b, blocks += BLOCK_SIZE) {
+            for (unsigned j = 0; j < 16; ++j) {
+                m[j] = load_word<A>(blocks + 4 * j);
+            }
+            A::compress(state, m);
+        }
+    }
+
+    template<typename A>
+    static void digest(BlockFunction compress, const uint8_t *data, size_t size, uint8_t *out) {
+        uint32_t state[A::STATE_WORDS];
+        std::copy(A::IV, A::IV + A::STATE_WORDS, state);
+        compress(state, data, size / BLOCK_SIZE);
+        uint8_t tail[2 * BLOCK_SIZE];
+        compress(state, tail, pad<A>(data, size, tail));
+        for (size_t i = 0; i < A::STATE_WORDS; ++i) {
+            store_word<A>(out + 4 * i, state[i]);
+        }
+    }
+
+#if defined(YADI_HASH_LANES)
+    /**
+     * Hashes four messages of the same padded block count, one per lane
+     */
+    template<typename A>
+    static void digest4(HashJob *const *jobs) {
+        uint8_t tails[4][2 * BLOCK_SIZE];
+        size_t full[4];
+        for (unsigned l = 0; l < 4; ++l) {
+            full[l] = jobs[l]->size / BLOCK_SIZE;
+            pad<A>(jobs[l]->data, jobs[l]->size, tails[l]);
+        }
+
+        Lanes state[A::STATE_WORDS];
+        for (size_t i = 0; i < A::STATE_WORDS; ++i) {
+            state[i] = Lanes(A::IV[i]);
+        }
+        Lanes m[16];
+        auto blocks = padded_blocks(jobs[0]->size);
+        for (size_t b = 0; b < blocks; ++b) {
+            const uint8_t *p[4];
+            for (unsigned l = 0; l < 4; ++l) {
+                p[l] = b < full[l] ? jobs[l]->data + b * BLOCK_SIZE : tails[l] + (b - full[l]) * BLOCK_SIZE;
+            }
+            for (unsigned j = 0; j < 16; ++j) {
+                m[j] = _mm_set_epi32(static_cast<int>(load_word<A>(p[3] + 4 * j)), static_cast<int>(load_word<A>(p[2] + 4 * j)),
+                                     static_cast<int>(load_word<A>(p[1] + 4 * j)), static_cast<int>(load_word<A>(p[0] + 4 * j)));
+            }
+            A::compress(state, m);
+        }
+
+        uint32_t words[4];
+        for (size_t i = 0; i < A::STATE_WORDS; ++i) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(words), state[i].v);
+            for (unsigned l = 0; l < 4; ++l) {
+                store_word<A>(jobs[l]->digest + 4 * i, words[l]);
+            }
+        }
+    }
+#endif
+
+    template<typename A>
+    static void digest_many(BlockFunction compress, bool lanes, HashJob *jobs, size_t count) {
+        auto order = std::vector<HashJob*>(count);
+        for (size_t i = 0; i < count; ++i) {
+            order[i] = &jobs[i];
+        }
+#if defined(YADI_HASH_LANES)
+        if (lanes) {
+            std::stable_sort(order.begin(), order.end(), [](HashJob const* a, HashJob const* b) {
+                return padded_blocks(a->size) < padded_blocks(b->size);
+            });
+        }
+#endif
+        size_t i = 0;
+        while (i < count) {
+#if defined(YADI_HASH_LANES)
+            if (lanes && i + 4 <= count && padded_blocks(order[i]->size) == padded_blocks(order[i + 3]->size)) {
+                digest4<A>(&order[i]);
+                i += 4;
+                continue;
+            }
+#endif
+            digest<A>(compress, order[i]->data, order[i]->size, order[i]->digest);
+            ++i;
+        }
+    }
+
+#if defined(YADI_X86)
+#define SHA_HW_TARGET YADI_TARGET("sha,sse4.1,ssse3")
+
+    /*
+     * SHA extensions. The state is kept as ABEF/CDGH (SHA-256) or ABCD/E (SHA-1) and each group of four
+     * rounds extends the message schedule for a later group, with the four schedule registers used in turn.
+     */
+
+    SHA_HW_TARGET
+    static void sha256_blocks_hw(uint32_t *state, const uint8_t *blocks, size_t count) {
+        const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+        __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state));
+        __m128i state1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4));
+        tmp = _mm_shuffle_epi32(tmp, 0xB1);               // CDAB
+        state1 = _mm_shuffle_epi32(state1, 0x1B);         // EFGH
+        __m128i state0 = _mm_alignr_epi8(tmp, state1, 8); // ABEF
+        state1 = _mm_blend_epi16(state1, tmp, 0xF0);      // CDGH
+
+        for (size_t b = 0; b < count; ++b, blocks += BLOCK_SIZE) {
+            auto abef = state0;
+            auto cdgh = state1;
+            __m128i msg[4];
+            for (unsigned i = 0; i < 16; ++i) {
+                if (i < 4) {
+                    msg[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(blocks + 16 * i)), mask);
+                }
+                auto k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(SHA256_K + 4 * i));
+                auto rounds = _mm_add_epi32(msg[i % 4], k);
+                state1 = _mm_sha256rnds2_epu32(state1, state0, rounds);
+                if (i >= 3 && i <= 14) {
+                    auto &next = msg[(i + 1) % 4];
+                    next = _mm_add_epi32(next, _mm_alignr_epi8(msg[i % 4], msg[(i + 3) % 4], 4));
+                    next = _mm_sha256msg2_epu32(next, msg[i % 4]);
+                }
+                rounds = _mm_shuffle_epi32(rounds, 0x0E);
+                state0 = _mm_sha256rnds2_epu32(state0, state1, rounds);
+                if (i >= 1 && i <= 12) {
+                    msg[(i + 3) % 4] = _mm_sha256msg1_epu32(msg[(i + 3) % 4], msg[i % 4]);
+                }
+            }
+            state0 = _mm_add_epi32(state0, abef);
+            state1 = _mm_add_epi32(state1, cdgh);
+        }
+
+        tmp = _mm_shuffle_epi32(state0, 0x1B);            // FEBA
+        state1 = _mm_shuffle_epi32(state1, 0xB1);         // DCHG
+        state0 = _mm_blend_epi16(tmp, state1, 0xF0);      // DCBA
+        state1 = _mm_alignr_epi8(state1, tmp, 8);         // ABEF
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(state), state0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), state1);
+    }
+
+    SHA_HW_TARGET
+    static __m128i sha1_rounds(__m128i abcd, __m128i e, unsigned i) {
+        switch (i / 5) {
+            case 0: return _mm_sha1rnds4_epu32(abcd, e, 0);
+            case 1: return _mm_sha1rnds4_epu32(abcd, e, 1);
+            case 2: return _mm_sha1rnds4_epu32(abcd, e, 2);
+            default: return _mm_sha1rnds4_epu32(abcd, e, 3);
+        }
+    }
+
+    SHA_HW_TARGET
+    static void sha1_blocks_hw(uint32_t *state, const uint8_t *blocks, size_t count) {
+        const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+        __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0x1B);
+        __m128i e0 = _mm_set_epi32(static_cast<int>(state[4]), 0, 0, 0);
+        __m128i e1;
+
+        for (size_t b = 0; b < count; ++b, blocks += BLOCK_SIZE) {
+            auto abcd_save = abcd;
+            auto e0_save = e0;
+            __m128i msg[4];
+            for (unsigned i = 0; i < 20; ++i) {
+                if (i < 4) {
+                    msg[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(blocks + 16 * i)), mask);
+                }
+                // e0 and e1 alternate between the E input of this group and the saved A of the next one
+                auto &e_in = (i % 2 == 0) ? e0 : e1;
+                auto &e_out = (i % 2 == 0) ? e1 : e0;
+                e_in = i == 0 ? _mm_add_epi32(e_in, msg[0]) : _mm_sha1nexte_epu32(e_in, msg[i % 4]);
+                e_out = abcd;
+                if (i >= 3 && i <= 18) {
+                    msg[(i + 1) % 4] = _mm_sha1msg2_epu32(msg[(i + 1) % 4], msg[i % 4]);
+                }
+                abcd = sha1_rounds(abcd, e_in, i);
+                if (i >= 1 && i <= 16) {
+                    msg[(i + 3) % 4] = _mm_sha1msg1_epu32(msg[(i + 3) % 4], msg[i % 4]);
+                }
+                if (i >= 2 && i <= 17) {
+                    msg[(i + 2) % 4] = _mm_xor_si128(msg[(i + 2) % 4], msg[i % 4]);
+                }
+            }
+            e0 = _mm_sha1nexte_epu32(e0, e0_save);
+            abcd = _mm_add_epi32(abcd, abcd_save);
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_shuffle_epi32(abcd, 0x1B));
+        state[4] = static_cast<uint32_t>(_mm_extract_epi32(e0, 3));
+    }
+
+    static bool sha_hardware_supported() {
+        return cpu::has_sha() && cpu::has_ssse3() && cpu::has_sse41();
+    }
+#endif
+
+    static auto sha1_blocks(bool allow_hardware) -> BlockFunction {
+#if defined(YADI_X86)
+        if (allow_hardware && sha_hardware_supported()) {
+            return sha1_blocks_hw;
+        }
+#else
+        (void)allow_hardware;
+#endif
+        return compress_blocks<Sha1>;
+    }
+
+    static auto sha256_blocks(bool allow_hardware) -> BlockFunction {
+#if defined(YADI_X86)
+        if (allow_hardware && sha_hardware_supported()) {
+            return sha256_blocks_hw;
+        }
+#else
+        (void)allow_hardware;
+#endif
+        return compress_blocks<Sha256>;
+    }
+
+    auto digest_size(HashAlgorithm algorithm) -> size_t {
+        switch (algorithm) {
+            case HashAlgorithm::MD5:
+                return 4 * Md5::STATE_WORDS;
+            case HashAlgorithm::SHA1:
+                return 4 * Sha1::STATE_WORDS;
+            default:
+                return 4 * Sha256::STATE_WORDS;
+        }
+    }
+
+    void hash(HashAlgorithm algorithm, const uint8_t *data, size_t size, uint8_t *digest_out, bool allow_hardware) {
+        switch (algorithm) {
+            case HashAlgorithm::MD5:
+                digest<Md5>(compress_blocks<Md5>, data, size, digest_out);
+                break;
+            case HashAlgorithm::SHA1:
+                digest<Sha1>(sha1_blocks(allow_hardware), data, size, digest_out);
+                break;
+            case HashAlgorithm::SHA256:
+                digest<Sha256>(sha256_blocks(allow_hardware), data, size, digest_out);
+                break;
+        }
+    }
+
+    /*
+     * With SHA extensions one message at a time beats four portable lanes, so lanes are only used for
+     * MD5 and for SHA on cpus without them.
+     */
+    void hash_many(HashAlgorithm algorithm, HashJob *jobs, size_t count, bool allow_hardware) {
+        switch (algorithm) {
+            case HashAlgorithm::MD5:
+                digest_many<Md5>(compress_blocks<Md5>, true, jobs, count);
+                break;
+            case HashAlgorithm::SHA1: {
+                auto blocks = sha1_blocks(allow_hardware);
+                digest_many<Sha1>(blocks, blocks == compress_blocks<Sha1>, jobs, count);
+                break;
+            }
+            case HashAlgorithm::SHA256: {
+                auto blocks = sha256_blocks(allow_hardware);
+                digest_many<Sha256>(blocks, blocks == compress_blocks<Sha256>, jobs, count);
+                break;
+            }
+        }
+    }
+
+} //namespace dlms
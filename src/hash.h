@@ -0,0 +1,66 @@
+/*
+ * This file is part of the yadi.cpp project.
+ *
+ * Copyright (C) 2017 Paulo Faco <paulofaco@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef YADI_DLMS_HASH_H
+#define YADI_DLMS_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace dlms
+{
+
+/**
+ * Hash functions used by the HLS authentication mechanisms
+ */
+enum class HashAlgorithm {
+    MD5,
+    SHA1,
+    SHA256,
+};
+
+static const auto MAX_DIGEST_SIZE = size_t{32};
+
+auto digest_size(HashAlgorithm algorithm) -> size_t;
+
+/**
+ * Hashes a message, with SHA extensions when the cpu has them
+ * @param digest receives digest_size(algorithm) bytes
+ * @param allow_hardware false forces the portable code, for testing
+ */
+void hash(HashAlgorithm algorithm, const uint8_t *data, size_t size, uint8_t *digest, bool allow_hardware = true);
+
+/**
+ * One message of a batch hashed with hash_many
+ */
+struct HashJob {
+    const uint8_t *data;
+    size_t size;
+    uint8_t *digest;
+};
+
+/**
+ * Hashes independent messages. Messages spanning the same number of blocks are hashed four at
+ * a time, one per SIMD lane, which is how many HLS challenges of the same size are answered at once.
+ */
+void hash_many(HashAlgorithm algorithm, HashJob *jobs, size_t count, bool allow_hardware = true);
+
+} //namespace dlms
+
+#endif //YADI_DLMS_HASH_H
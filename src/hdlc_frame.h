@@ -3,6 +3,7 @@
 #ifndef HDLC_FRAME_H_
 #define HDLC_FRAME_H_
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
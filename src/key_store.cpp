@@ -0,0 +1,195 @@
+/*
+ * This file is part of the yadi.cpp project.
+ *
+ * Copyright (C) 2017 Paulo Faco <paulofaco@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+///@file
+
+#include <yadi/key_store.h>
+#include <yadi/cosem.h>
+#include "security.h"
+#include <cstring>
+#include <stdexcept>
+
+namespace dlms
+{
+
+    /**
+     * Marks an erased slot; the title stays so that probing goes on past it
+     */
+    static const KeySet erased_marker{};
+    static const KeySet *const ERASED = &erased_marker;
+
+    static auto title_key(std::array<uint8_t,8> const& system_title) -> uint64_t {
+        uint64_t key;
+        std::memcpy(&key, system_title.data(), sizeof(key));
+        return key;
+    }
+
+    KeyStore::Table::Table(size_t capacity) :
+        mask{0}, shift{64}
+    {
+        auto slots_count = size_t{8};
+        while (slots_count < capacity) {
+            slots_count <<= 1U;
+        }
+        mask = slots_count - 1;
+        for (auto n = slots_count; n > 1; n >>= 1U) {
+            --shift;
+        }
+        slots.reset(new Slot[slots_count]);
+    }
+
+    auto KeyStore::probe_start(Table const& table, uint64_t title) -> size_t {
+        return static_cast<size_t>((title * 0x9E3779B97F4A7C15ULL) >> table.shift);
+    }
+
+    KeyStore::KeyStore(size_t capacity) :
+        table_{new Table{capacity + capacity / 2}}
+    {
+    }
+
+    KeyStore::~KeyStore() {
+        auto table = table_.load();
+        for (size_t i = 0; i <= table->mask; ++i) {
+            auto keys = table->slots[i].keys.load();
+            if (keys != nullptr && keys != ERASED) {
+                delete keys;
+            }
+        }
+        delete table;
+    }
+
+    auto KeyStore::find(std::array<uint8_t,8> const& system_title) const -> const KeySet* {
+        auto title = title_key(system_title);
+        auto const& table = *table_.load(std::memory_order_acquire);
+        for (auto i = probe_start(table, title);; i = (i + 1) & table.mask) {
+            auto &slot = table.slots[i];
+            auto keys = slot.keys.load(std::memory_order_acquire);
+            if (keys == nullptr) {
+                return nullptr;
+            }
+            if (slot.title == title) {
+                return keys == ERASED ? nullptr : keys;
+            }
+        }
+    }
+
+    /*
+     * The table is kept at most 3/4 full, counting erased slots, so that probing always ends on an
+     * empty slot.
+     */
+    void KeyStore::insert(std::array<uint8_t,8> const& system_title, std::array<uint8_t,16> const& guek,
+                          std::array<uint8_t,16> const& ak) {
+        auto keys = std::unique_ptr<KeySet>{new KeySet{system_title, guek, ak, Gcm{guek}}};
+        auto title = title_key(system_title);
+
+        std::lock_guard<std::mutex> lock(writer_);
+        if (4 * (used_ + 1) > 3 * (table_.load()->mask + 1)) {
+            grow();
+        }
+        auto &table = *table_.load();
+        for (auto i = probe_start(table, title);; i = (i + 1) & table.mask) {
+            auto &slot = table.slots[i];
+            auto current = slot.keys.load(std::memory_order_relaxed);
+            if (current == nullptr) {
+                slot.title = title;
+                slot.keys.store(keys.release(), std::memory_order_release);
+                ++used_;
+                ++size_;
+                return;
+            }
+            if (slot.title == title) {
+                slot.keys.store(keys.release(), std::memory_order_release);
+                if (current == ERASED) {
+                    ++size_;
+                } else {
+                    retired_keys_.emplace_back(current);
+                }
+                return;
+            }
+        }
+    }
+
+    bool KeyStore::erase(std::array<uint8_t,8> const& system_title) {
+        auto title = title_key(system_title);
+        std::lock_guard<std::mutex> lock(writer_);
+        auto &table = *table_.load();
+        for (auto i = probe_start(table, title);; i = (i + 1) & table.mask) {
+            auto &slot = table.slots[i];
+            auto current = slot.keys.load(std::memory_order_relaxed);
+            if (current == nullptr) {
+                return false;
+            }
+            if (slot.title == title) {
+                if (current == ERASED) {
+                    return false;
+                }
+                slot.keys.store(ERASED, std::memory_order_release);
+                retired_keys_.emplace_back(current);
+                --size_;
+                return true;
+            }
+        }
+    }
+
+    /**
+     * Rehashes the live KeySets into a table twice as large, dropping erased slots. The KeySets are
+     * shared by both tables until the old one is reclaimed.
+     */
+    void KeyStore::grow() {
+        auto old = table_.load();
+        auto table = std::unique_ptr<Table>{new Table{2 * (size_ + 1) > old->mask + 1 ? 2 * (old->mask + 1) : old->mask + 1}};
+        for (size_t i = 0; i <= old->mask; ++i) {
+            auto keys = old->slots[i].keys.load(std::memory_order_relaxed);
+            if (keys == nullptr || keys == ERASED) {
+                continue;
+            }
+            auto title = old->slots[i].title;
+            auto j = probe_start(*table, title);
+            while (table->slots[j].keys.load(std::memory_order_relaxed) != nullptr) {
+                j = (j + 1) & table->mask;
+            }
+            table->slots[j].title = title;
+            table->slots[j].keys.store(keys, std::memory_order_relaxed);
+        }
+        used_ = size_;
+        table_.store(table.release(), std::memory_order_release);
+        retired_tables_.emplace_back(old);
+    }
+
+    auto KeyStore::size() const -> size_t {
+        std::lock_guard<std::mutex> lock(writer_);
+        return size_;
+    }
+
+    void KeyStore::reclaim() {
+        std::lock_guard<std::mutex> lock(writer_);
+        retired_keys_.clear();
+        retired_tables_.clear();
+    }
+
+    auto decipher_general_glo(KeyStore const& store, std::vector<uint8_t> &apdu) -> std::array<uint8_t,8> {
+        return Security::decipher_general_glo(store, apdu);
+    }
+
+    auto decipher_general_glo(KeyStore const& store, std::vector<std::vector<uint8_t>> &apdus) -> std::vector<DecipherStatus> {
+        return Security::decipher_general_glo(store, apdus);
+    }
+
+}
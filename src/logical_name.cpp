@@ -20,58 +20,196 @@
 ///@file
 
 #include <yadi/cosem.h>
-#include <algorithm>
-#include <sstream>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define YADI_OBIS_SSE2 1
+#endif
 
 namespace dlms
 {
-    class LogicalName::impl
-    {
-    public:
-        std::array<uint8_t,6> value_;
-
-        impl(std::string const& str) {
-            std::vector<uint8_t> tokens;
-            std::string token;
-            std::istringstream tokenStream(str);
-            while (std::getline(tokenStream, token, '.')) {
-                uint8_t val = static_cast<uint8_t>(std::atoi(token.c_str()));
-                tokens.push_back(val);
-            }
-            if (tokens.size() != 6) {
-                throw std::runtime_error{"logical name must be 6 bytes long"};
+    static_assert(sizeof(LogicalName) == 6 && std::is_trivially_copyable<LogicalName>::value,
+                  "a logical name is a plain 6-byte value");
+    static_assert("1.0.1.8.0.255"_obis == LogicalName{1, 0, 1, 8, 0, 255}, "OBIS codes are parsed at compile time");
+
+    LogicalName::LogicalName(std::string const& str) :
+        LogicalName{from_value(parse(str.data(), str.size()))} {}
+
+    /**
+     * Longest code, "255.255.255.255.255.255", and the window scanned for it
+     */
+    static const size_t MAX_CODE_SIZE = 23;
+    static const size_t SCAN_SIZE = 32;
+
+    static const char DOTTED_SEPARATORS[] = {'.', '.', '.', '.', '.'};
+    static const char OBIS_SEPARATORS[] = {'-', ':', '.', '.', '*'};
+
+    /**
+     * Digit values of a window of a line, and a mask with one bit per byte that is a digit. Bytes past
+     * the end of the line are never digits.
+     */
+    struct Scan {
+        uint8_t digits[SCAN_SIZE];
+        uint32_t mask;
+    };
+
+    static void scan_scalar(const char *line, size_t size, Scan &scan) {
+        scan.mask = 0;
+        for (size_t i = 0; i < size; ++i) {
+            scan.digits[i] = static_cast<uint8_t>(line[i] - '0');
+            if (scan.digits[i] < 10) {
+                scan.mask |= uint32_t{1} << i;
             }
-            std::copy_n(tokens.begin(), 6, value_.begin());
         }
+    }
 
-        impl(std::initializer_list<uint8_t> const& initializer_list) {
-            if (initializer_list.size() != 6) {
-                throw std::runtime_error{"logical name must be 6 bytes long"};
-            }
-            std::copy_n(initializer_list.begin(), 6, value_.begin());
+#if defined(YADI_OBIS_SSE2)
+    /**
+     * Reads SCAN_SIZE bytes from line, so at least that many must be readable
+     */
+    static void scan_sse2(const char *line, size_t size, Scan &scan) {
+        auto zero = _mm_set1_epi8('0');
+        auto nine = _mm_set1_epi8(9);
+        uint32_t mask = 0;
+        for (size_t i = 0; i < SCAN_SIZE; i += 16) {
+            auto digits = _mm_sub_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(line + i)), zero);
+            auto is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digits, nine), digits);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(scan.digits + i), digits);
+            mask |= static_cast<uint32_t>(_mm_movemask_epi8(is_digit)) << i;
         }
+        scan.mask = mask & ((uint32_t{1} << size) - 1);
+    }
+#endif
 
-        std::array<uint8_t,6>::const_iterator begin() const {
-            return value_.begin();
+    static bool separator_allowed(char c, size_t group, ObisNotation notation) {
+        if (notation == ObisNotation::DOTTED) {
+            return c == '.';
         }
+        return c == OBIS_SEPARATORS[group] || (group == 4 && c == '.');
+    }
 
-        std::array<uint8_t,6>::const_iterator end() const {
-            return value_.end();
+    /**
+     * @return nullptr, or the reason the line is not a code
+     */
+    static auto decode(const char *line, size_t size, Scan const& scan, uint64_t &value) -> const char* {
+        auto notation = ObisNotation::DOTTED;
+        size_t position = 0;
+        value = 0;
+        for (size_t group = 0; group < 6; ++group) {
+            auto digits = size_t{0};
+            while (digits < 4 && (scan.mask >> (position + digits) & 1U) != 0) {
+                ++digits;
+            }
+            if (digits == 0) {
+                return "value group expected";
+            }
+            if (digits > 3) {
+                return "value group longer than 3 digits";
+            }
+            auto d = scan.digits + position;
+            auto group_value = digits == 1 ? d[0] : digits == 2 ? 10U * d[0] + d[1] : 100U * d[0] + 10U * d[1] + d[2];
+            if (group_value > 255) {
+                return "value group out of range";
+            }
+            value = value << 8U | group_value;
+            position += digits;
+            if (group == 5) {
+                break;
+            }
+            if (position == size) {
+                return "6 value groups expected";
+            }
+            if (group == 0 && line[position] == '-') {
+                notation = ObisNotation::OBIS;
+            }
+            if (!separator_allowed(line[position], group, notation)) {
+                return "invalid separator";
+            }
+            ++position;
         }
-    };
+        return position == size ? nullptr : "unexpected characters after the code";
+    }
 
-    LogicalName::LogicalName(std::string const& str) :
-            pimpl_{std::make_unique<impl>(str)} {}
+    /**
+     * Lines are found with memchr. The digits of each line are classified in one pass over a window of
+     * SCAN_SIZE bytes, SIMD when the window lies within the buffer, then the groups are decoded from the
+     * digit mask without going back to the text.
+     */
+    auto parse_logical_names(const char *text, size_t size, std::vector<LogicalName> &names) -> std::vector<LogicalNameError> {
+        std::vector<LogicalNameError> errors;
+        names.reserve(names.size() + size / (MAX_CODE_SIZE / 2 + 1));
+        auto end = text + size;
+        Scan scan;
+        for (size_t number = 1; text < end; ++number) {
+            auto eol = static_cast<const char*>(std::memchr(text, '\n', static_cast<size_t>(end - text)));
+            auto next = eol == nullptr ? end : eol + 1;
+            auto line_size = static_cast<size_t>((eol == nullptr ? end : eol) - text);
+            if (line_size > 0 && text[line_size - 1] == '\r') {
+                --line_size;
+            }
+
+            if (line_size > MAX_CODE_SIZE) {
+                errors.push_back({number, "line too long for a code"});
+            } else if (line_size > 0) {
+#if defined(YADI_OBIS_SSE2)
+                if (static_cast<size_t>(end - text) >= SCAN_SIZE) {
+                    scan_sse2(text, line_size, scan);
+                } else {
+                    scan_scalar(text, line_size, scan);
+                }
+#else
+                scan_scalar(text, line_size, scan);
+#endif
+                uint64_t value;
+                auto reason = decode(text, line_size, scan, value);
+                if (reason == nullptr) {
+                    names.push_back(LogicalName::from_value(value));
+                } else {
+                    errors.push_back({number, reason});
+                }
+            }
+            text = next;
+        }
+        return errors;
+    }
 
-    LogicalName::LogicalName(std::initializer_list<uint8_t> const& initializer_list) :
-            pimpl_{std::make_unique<impl>(initializer_list)} {}
+    static auto format_group(uint8_t group, char *out) -> char* {
+        if (group >= 100) {
+            *out++ = static_cast<char>('0' + group / 100);
+        }
+        if (group >= 10) {
+            *out++ = static_cast<char>('0' + group / 10 % 10);
+        }
+        *out++ = static_cast<char>('0' + group % 10);
+        return out;
+    }
 
-    LogicalName::~LogicalName() = default;
+    static auto format(LogicalName const& logical_name, ObisNotation notation, char *out) -> char* {
+        auto separators = notation == ObisNotation::DOTTED ? DOTTED_SEPARATORS : OBIS_SEPARATORS;
+        for (size_t group = 0; group < 6; ++group) {
+            out = format_group(logical_name[group], out);
+            if (group < 5) {
+                *out++ = separators[group];
+            }
+        }
+        return out;
+    }
 
-    std::array<uint8_t,6>::const_iterator LogicalName::begin() const {
-        return pimpl_->begin();
+    void format_logical_names(LogicalName const *names, size_t count, std::string &text, ObisNotation notation) {
+        auto start = text.size();
+        text.resize(start + count * (MAX_CODE_SIZE + 1));
+        auto out = &text[start];
+        for (size_t i = 0; i < count; ++i) {
+            out = format(names[i], notation, out);
+            *out++ = '\n';
+        }
+        text.resize(static_cast<size_t>(out - text.data()));
     }
-    std::array<uint8_t,6>::const_iterator LogicalName::end() const {
-        return pimpl_->end();
+
+    auto to_string(LogicalName const& logical_name, ObisNotation notation) -> std::string {
+        char buffer[MAX_CODE_SIZE];
+        return std::string(buffer, format(logical_name, notation, buffer));
     }
 }
@@ -0,0 +1,170 @@
+/*
+ * This file is part of the yadi.cpp project.
+ *
+ * Copyright (C) 2017 Paulo Faco <paulofaco@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+///@file
+
+#include <yadi/object_registry.h>
+#include <algorithm>
+#include <stdexcept>
+
+namespace dlms
+{
+
+    static const uint64_t GOLDEN_RATIO = 0x9E3779B97F4A7C15ULL;
+    static const uint32_t MAX_SEED = 1U << 16U;
+
+    static auto mix(uint64_t x) -> uint64_t {
+        x ^= x >> 30U;
+        x *= 0xBF58476D1CE4E5B9ULL;
+        x ^= x >> 27U;
+        x *= 0x94D049BB133111EBULL;
+        return x ^ (x >> 31U);
+    }
+
+    static auto object_key(ClassID class_id, LogicalName const& logical_name) -> uint64_t {
+        return uint64_t{static_cast<uint16_t>(class_id)} << 48U | logical_name.value();
+    }
+
+    static auto slot_hash(uint64_t hash, uint32_t seed) -> uint64_t {
+        return mix(hash ^ seed * GOLDEN_RATIO);
+    }
+
+    static auto power_of_two(size_t at_least) -> size_t {
+        auto n = size_t{1};
+        while (n < at_least) {
+            n <<= 1U;
+        }
+        return n;
+    }
+
+    /**
+     * Keys are spread over buckets of about 4 by the top half of their hash. Buckets are placed largest
+     * first: each one gets the first seed that sends all of its keys to free slots. Should a bucket find
+     * no seed, the table doubles and placement starts over.
+     */
+    ObjectRegistry::ObjectRegistry(std::vector<ObjectInfo> const& objects) :
+        size_{objects.size()}
+    {
+        std::vector<uint64_t> keys;
+        keys.reserve(objects.size());
+        size_t attribute_count = 0;
+        for (auto const& object : objects) {
+            if (static_cast<uint16_t>(object.class_id) == 0 || object.attributes.empty()) {
+                throw std::invalid_argument{"object needs a class id and attributes"};
+            }
+            keys.push_back(object_key(object.class_id, object.logical_name));
+            attribute_count += object.attributes.size();
+        }
+        auto sorted = keys;
+        std::sort(sorted.begin(), sorted.end());
+        if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+            throw std::invalid_argument{"object registered twice"};
+        }
+
+        bucket_mask_ = power_of_two(std::max<size_t>(1, objects.size() / 4)) - 1;
+        std::vector<std::vector<size_t>> buckets(bucket_mask_ + 1);
+        for (size_t i = 0; i < keys.size(); ++i) {
+            buckets[(mix(keys[i]) >> 32U) & bucket_mask_].push_back(i);
+        }
+        std::vector<size_t> order(buckets.size());
+        for (size_t b = 0; b < order.size(); ++b) {
+            order[b] = b;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return buckets[a].size() > buckets[b].size();
+        });
+
+        auto slot_count = power_of_two(std::max<size_t>(8, objects.size() + objects.size() / 4));
+        std::vector<size_t> placed(objects.size());
+        std::vector<size_t> positions;
+        for (;; slot_count *= 2) {
+            slot_mask_ = slot_count - 1;
+            seeds_.assign(buckets.size(), 0);
+            std::vector<bool> taken(slot_count);
+            auto placed_all = true;
+            for (auto b : order) {
+                auto const& bucket = buckets[b];
+                if (bucket.empty()) {
+                    break;
+                }
+                auto seed = uint32_t{0};
+                for (; seed < MAX_SEED; ++seed) {
+                    positions.clear();
+                    for (auto i : bucket) {
+                        auto position = slot_hash(mix(keys[i]), seed) & slot_mask_;
+                        if (taken[position] || std::find(positions.begin(), positions.end(), position) != positions.end()) {
+                            break;
+                        }
+                        positions.push_back(position);
+                    }
+                    if (positions.size() == bucket.size()) {
+                        break;
+                    }
+                }
+                if (seed == MAX_SEED) {
+                    placed_all = false;
+                    break;
+                }
+                seeds_[b] = seed;
+                for (size_t j = 0; j < bucket.size(); ++j) {
+                    taken[positions[j]] = true;
+                    placed[bucket[j]] = positions[j];
+                }
+            }
+            if (placed_all) {
+                break;
+            }
+        }
+
+        slots_.resize(slot_count);
+        attributes_.reserve(attribute_count);
+        for (size_t i = 0; i < objects.size(); ++i) {
+            auto &slot = slots_[placed[i]];
+            slot.key = keys[i];
+            slot.first = static_cast<uint32_t>(attributes_.size());
+            slot.count = static_cast<uint32_t>(objects[i].attributes.size());
+            attributes_.insert(attributes_.end(), objects[i].attributes.begin(), objects[i].attributes.end());
+        }
+    }
+
+    auto ObjectRegistry::slot(uint64_t key) const -> Slot const& {
+        auto hash = mix(key);
+        auto seed = seeds_[(hash >> 32U) & bucket_mask_];
+        return slots_[slot_hash(hash, seed) & slot_mask_];
+    }
+
+    auto ObjectRegistry::find(ClassID class_id, LogicalName const& logical_name) const -> Attributes {
+        auto key = object_key(class_id, logical_name);
+        auto const& s = slot(key);
+        if (s.key != key) {
+            return {};
+        }
+        return {attributes_.data() + s.first, s.count};
+    }
+
+    auto ObjectRegistry::find(ClassID class_id, LogicalName const& logical_name, uint8_t index) const -> const AttributeInfo* {
+        auto attributes = find(class_id, logical_name);
+        if (index == 0 || index > attributes.size) {
+            return nullptr;
+        }
+        return attributes.data + index - 1;
+    }
+
+}
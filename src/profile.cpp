@@ -0,0 +1,645 @@
+/*
+ * This file is part of the yadi.cpp project.
+ *
+ * Copyright (C) 2017 Paulo Faco <paulofaco@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+///@file
+
+#include <yadi/profile.h>
+#include "data_type.h"
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+namespace dlms
+{
+
+    static bool is_signed(DataType tag)
+    {
+        return tag == DataType::INT8 || tag == DataType::INT16 || tag == DataType::INT32 || tag == DataType::INT64;
+    }
+
+    /**
+     * @param length bytes of an OCTET_STRING field, which is only taken for a date-time
+     */
+    static auto column_type(DataType tag, size_t length) -> ColumnType
+    {
+        switch (tag) {
+            case DataType::DATE_TIME:
+                return ColumnType::TIMESTAMP;
+            case DataType::OCTET_STRING:
+                if (length == 12) {
+                    return ColumnType::TIMESTAMP;
+                }
+                break;
+            case DataType::INT8:
+            case DataType::INT16:
+            case DataType::INT32:
+            case DataType::INT64:
+            case DataType::UINT16:
+            case DataType::UINT32:
+            case DataType::UINT64:
+                return ColumnType::INT64;
+            case DataType::FLOAT32:
+            case DataType::FLOAT64:
+                return ColumnType::DOUBLE;
+            case DataType::UINT8:
+            case DataType::ENUM:
+            case DataType::BOOLEAN:
+            case DataType::BCD:
+                return ColumnType::UINT8;
+            default:
+                break;
+        }
+        throw std::invalid_argument{"profile field is not a timestamp or number"};
+    }
+
+    /**
+     * Where the contents of a field start and how many bytes it takes, fixed for the whole column
+     */
+    struct FieldLayout {
+        size_t header;
+        size_t width;
+        bool is_signed;
+    };
+
+    /**
+     * Adds a row to a column, then set by set_field or fill_null
+     */
+    static void grow(Column &column)
+    {
+        switch (column.type) {
+            case ColumnType::DOUBLE:
+                column.reals.emplace_back();
+                break;
+            case ColumnType::UINT8:
+                column.bytes.emplace_back();
+                break;
+            default:
+                column.integers.emplace_back();
+                break;
+        }
+    }
+
+    /**
+     * Sets a null field from the rows before, which must be set already
+     */
+    static void fill_null(Column &column, size_t row)
+    {
+        if (row == 0) {
+            throw std::invalid_argument{"first profile row has a null value"};
+        }
+        switch (column.type) {
+            case ColumnType::TIMESTAMP: {
+                auto &times = column.integers;
+                auto previous = times[row - 1];
+                if (row < 2 || previous == NO_TIMESTAMP || times[row - 2] == NO_TIMESTAMP) {
+                    times[row] = NO_TIMESTAMP;
+                } else {
+                    times[row] = previous + (previous - times[row - 2]);
+                }
+                break;
+            }
+            case ColumnType::INT64:
+                column.integers[row] = column.integers[row - 1];
+                break;
+            case ColumnType::DOUBLE:
+                column.reals[row] = column.reals[row - 1];
+                break;
+            case ColumnType::UINT8:
+                column.bytes[row] = column.bytes[row - 1];
+                break;
+        }
+    }
+
+    static void set_field(Column &column, FieldLayout const& layout, const uint8_t *contents, size_t row)
+    {
+        switch (column.type) {
+            case ColumnType::TIMESTAMP:
+                column.integers[row] = epoch_seconds(contents);
+                break;
+            case ColumnType::INT64: {
+                auto value = read_big_endian(contents, layout.width);
+                if (layout.is_signed && layout.width < 8) {
+                    auto shift = 64 - 8 * layout.width;
+                    column.integers[row] = static_cast<int64_t>(value << shift) >> shift;
+                } else {
+                    column.integers[row] = static_cast<int64_t>(value);
+                }
+                break;
+            }
+            case ColumnType::DOUBLE: {
+                auto bits = read_big_endian(contents, layout.width);
+                if (layout.width == 4) {
+                    auto bits32 = static_cast<uint32_t>(bits);
+                    float real;
+                    std::memcpy(&real, &bits32, sizeof(real));
+                    column.reals[row] = real;
+                } else {
+                    std::memcpy(&column.reals[row], &bits, sizeof(bits));
+                }
+                break;
+            }
+            case ColumnType::UINT8:
+                column.bytes[row] = contents[0];
+                break;
+        }
+    }
+
+    /**
+     * Sizes each column for rows, keeping the capacity of its vector
+     */
+    static void resize(Column &column, size_t rows)
+    {
+        switch (column.type) {
+            case ColumnType::DOUBLE:
+                column.reals.resize(rows);
+                break;
+            case ColumnType::UINT8:
+                column.bytes.resize(rows);
+                break;
+            default:
+                column.integers.resize(rows);
+                break;
+        }
+    }
+
+    /**
+     * Rows below which a slice is not worth a thread
+     */
+    static const size_t MIN_SLICE_ROWS = 4096;
+
+    static auto slice_count(size_t rows, unsigned threads) -> size_t
+    {
+        if (threads == 0) {
+            threads = std::max(1U, std::thread::hardware_concurrency());
+        }
+        return std::max<size_t>(1, std::min<size_t>(threads, rows / MIN_SLICE_ROWS));
+    }
+
+    /**
+     * Runs work(slice, first row, end row) for each slice of rows, the last one on the calling thread.
+     * The slices share nothing but read-only data and their own ranges of the columns. Once all are
+     * done, the exception of the first slice that failed is rethrown.
+     */
+    template<typename Work>
+    static void run_slices(size_t rows, size_t slices, Work const& work)
+    {
+        std::vector<std::exception_ptr> errors(slices);
+        auto run = [&](size_t slice) {
+            try {
+                work(slice, rows * slice / slices, rows * (slice + 1) / slices);
+            } catch (...) {
+                errors[slice] = std::current_exception();
+            }
+        };
+        std::vector<std::thread> workers;
+        workers.reserve(slices - 1);
+        for (size_t slice = 0; slice + 1 < slices; ++slice) {
+            try {
+                workers.emplace_back(run, slice);
+            } catch (std::system_error const&) {
+                run(slice);
+            }
+        }
+        run(slices - 1);
+        for (auto &worker : workers) {
+            worker.join();
+        }
+        for (auto const& error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+
+    static void store(Column const& column, size_t row, size_t width, uint8_t *contents)
+    {
+        uint64_t bits = 0;
+        switch (column.type) {
+            case ColumnType::TIMESTAMP:
+                write_date_time(column.integers[row], 0, 0, contents);
+                return;
+            case ColumnType::INT64:
+                bits = static_cast<uint64_t>(column.integers[row]);
+                break;
+            case ColumnType::DOUBLE:
+                if (width == 4) {
+                    auto real = static_cast<float>(column.reals[row]);
+                    uint32_t bits32;
+                    std::memcpy(&bits32, &real, sizeof(bits32));
+                    bits = bits32;
+                } else {
+                    std::memcpy(&bits, &column.reals[row], sizeof(bits));
+                }
+                break;
+            case ColumnType::UINT8:
+                bits = column.bytes[row];
+                break;
+        }
+        for (size_t i = width; i-- > 0; bits >>= 8U) {
+            contents[i] = static_cast<uint8_t>(bits);
+        }
+    }
+
+    static void clear(ProfileColumns &profile)
+    {
+        profile.rows = 0;
+        for (auto &column : profile.columns) {
+            column.integers.clear();
+            column.reals.clear();
+            column.bytes.clear();
+        }
+    }
+
+    /**
+     * Converts the rows from first to end of the contents of a compact array into their columns
+     */
+    static void convert_rows(ProfileColumns &profile, std::vector<FieldLayout> const& layouts, const uint8_t *contents,
+                             size_t stride, size_t first, size_t end)
+    {
+        auto rows = end - first;
+        contents += first * stride;
+        std::vector<float> floats;
+        for (size_t i = 0; i < layouts.size(); ++i) {
+            auto &column = profile.columns[i];
+            auto const& layout = layouts[i];
+            auto values = contents + layout.header;
+            switch (column.type) {
+                case ColumnType::TIMESTAMP:
+                    for (size_t row = 0; row < rows; ++row) {
+                        if (layout.header != 0 && contents[row * stride] != 12) {
+                            throw std::invalid_argument{"profile row does not match the first row"};
+                        }
+                        column.integers[first + row] = epoch_seconds(values + row * stride);
+                    }
+                    break;
+                case ColumnType::INT64:
+                    convert_big_endian(column.tag, values, stride, rows, column.integers.data() + first);
+                    break;
+                case ColumnType::DOUBLE:
+                    if (layout.width == 8) {
+                        convert_big_endian(values, stride, rows, column.reals.data() + first);
+                    } else {
+                        floats.resize(rows);
+                        convert_big_endian(values, stride, rows, floats.data());
+                        std::copy(floats.begin(), floats.end(), column.reals.begin() + static_cast<std::ptrdiff_t>(first));
+                    }
+                    break;
+                case ColumnType::UINT8:
+                    for (size_t row = 0; row < rows; ++row) {
+                        column.bytes[first + row] = values[row * stride];
+                    }
+                    break;
+            }
+            contents += layout.header + layout.width;
+        }
+    }
+
+    /**
+     * Every row of a compact array takes the same bytes, without tags, so each column is converted in
+     * one strided run, or one run per slice of rows. A date-time may be described as an OCTET_STRING,
+     * whose contents then start with their length.
+     */
+    static void decode_compact_profile(const uint8_t *data, size_t size, size_t &offset, ProfileColumns &profile,
+                                       unsigned threads)
+    {
+        auto position = offset + 1;
+        auto description = position;
+        skip_type_description(data, size, position);
+        auto length = read_size(data, size, position);
+        if (length > size - position) {
+            throw std::underflow_error{"not enough bytes"};
+        }
+
+        auto fields = size_t{1};
+        if (data[description] == static_cast<uint8_t>(DataType::STRUCTURE)) {
+            ++description;
+            fields = read_size(data, size, description);
+        }
+        clear(profile);
+        profile.columns.resize(fields);
+        std::vector<FieldLayout> layouts(fields);
+        auto stride = size_t{0};
+        for (size_t i = 0; i < fields; ++i) {
+            auto tag = static_cast<DataType>(data[description++]);
+            auto &column = profile.columns[i];
+            column.tag = tag;
+            column.type = column_type(tag, 12);
+            layouts[i].header = tag == DataType::OCTET_STRING ? 1 : 0;
+            layouts[i].width = tag == DataType::OCTET_STRING ? 12 : fixed_width(tag);
+            layouts[i].is_signed = is_signed(tag);
+            stride += layouts[i].header + layouts[i].width;
+        }
+        if (length != 0 && (stride == 0 || length % stride != 0)) {
+            throw std::invalid_argument{"compact array contents do not match their type description"};
+        }
+
+        auto rows = length == 0 ? 0 : length / stride;
+        if (rows == 0) {
+            profile.columns.clear();
+            offset = position;
+            return;
+        }
+        for (auto &column : profile.columns) {
+            resize(column, rows);
+        }
+        auto contents = data + position;
+        auto slices = slice_count(rows, threads);
+        if (slices == 1) {
+            convert_rows(profile, layouts, contents, stride, 0, rows);
+        } else {
+            run_slices(rows, slices, [&](size_t, size_t first, size_t end) {
+                convert_rows(profile, layouts, contents, stride, first, end);
+            });
+        }
+        profile.rows = rows;
+        offset = position + length;
+    }
+
+    static auto read_row_header(const uint8_t *data, size_t size, size_t &offset) -> size_t
+    {
+        if (offset >= size) {
+            throw std::underflow_error{"not enough bytes"};
+        }
+        if (data[offset++] != static_cast<uint8_t>(DataType::STRUCTURE)) {
+            throw std::invalid_argument{"profile row is not a structure"};
+        }
+        return read_size(data, size, offset);
+    }
+
+    /**
+     * The schema is read from the first row; each field of the following rows then only needs its
+     * tag compared and its fixed-size contents copied to the end of its column.
+     */
+    void decode_profile(const uint8_t *data, size_t size, size_t &offset, ProfileColumns &profile)
+    {
+        if (offset >= size) {
+            throw std::underflow_error{"not enough bytes"};
+        }
+        if (data[offset] == static_cast<uint8_t>(DataType::COMPACT_ARRAY)) {
+            decode_compact_profile(data, size, offset, profile, 1);
+            return;
+        }
+        if (data[offset++] != static_cast<uint8_t>(DataType::ARRAY)) {
+            throw std::invalid_argument{"profile buffer is not an array"};
+        }
+        auto rows = read_size(data, size, offset);
+        if (rows > size - offset) {
+            throw std::underflow_error{"not enough bytes"};
+        }
+        clear(profile);
+        if (rows == 0) {
+            profile.columns.clear();
+            return;
+        }
+
+        auto first = offset;
+        auto fields = read_row_header(data, size, first);
+        if (fields > size - first) {
+            throw std::underflow_error{"not enough bytes"};
+        }
+        profile.columns.resize(fields);
+        std::vector<FieldLayout> layouts(fields);
+        for (size_t i = 0; i < fields; ++i) {
+            if (first >= size) {
+                throw std::underflow_error{"not enough bytes"};
+            }
+            auto tag = static_cast<DataType>(data[first]);
+            auto &column = profile.columns[i];
+            column.tag = tag;
+            column.type = column_type(tag, first + 1 < size ? data[first + 1] : 0);
+            layouts[i].header = tag == DataType::OCTET_STRING ? 2 : 1;
+            layouts[i].width = tag == DataType::OCTET_STRING ? 12 : fixed_width(tag);
+            layouts[i].is_signed = is_signed(tag);
+            switch (column.type) {
+                case ColumnType::DOUBLE:
+                    column.reals.reserve(rows);
+                    break;
+                case ColumnType::UINT8:
+                    column.bytes.reserve(rows);
+                    break;
+                default:
+                    column.integers.reserve(rows);
+                    break;
+            }
+            skip_value(data, size, first);
+        }
+
+        for (size_t row = 0; row < rows; ++row) {
+            if (read_row_header(data, size, offset) != fields) {
+                throw std::invalid_argument{"profile row does not match the first row"};
+            }
+            for (size_t i = 0; i < fields; ++i) {
+                auto &column = profile.columns[i];
+                auto const& layout = layouts[i];
+                if (offset >= size) {
+                    throw std::underflow_error{"not enough bytes"};
+                }
+                auto tag = static_cast<DataType>(data[offset]);
+                grow(column);
+                if (tag == DataType::NULL_DATA) {
+                    fill_null(column, row);
+                    ++offset;
+                    continue;
+                }
+                if (tag != column.tag || (layout.header == 2 && (offset + 1 >= size || data[offset + 1] != 12))) {
+                    throw std::invalid_argument{"profile row does not match the first row"};
+                }
+                if (layout.header + layout.width > size - offset) {
+                    throw std::underflow_error{"not enough bytes"};
+                }
+                set_field(column, layout, data + offset + layout.header, row);
+                offset += layout.header + layout.width;
+            }
+            profile.rows = row + 1;
+        }
+    }
+
+    void decode_profile(std::vector<uint8_t> const& buffer, ProfileColumns &profile)
+    {
+        auto offset = size_t{0};
+        decode_profile(buffer.data(), buffer.size(), offset, profile);
+    }
+
+    void encode_profile(ProfileColumns const& profile, std::vector<uint8_t> &buffer, DataType encoding)
+    {
+        if (encoding != DataType::ARRAY && encoding != DataType::COMPACT_ARRAY) {
+            throw std::invalid_argument{"profile is encoded as an array or a compact array"};
+        }
+        auto compact = encoding == DataType::COMPACT_ARRAY;
+        auto fields = profile.columns.size();
+        std::vector<FieldLayout> layouts(fields);
+        auto stride = size_t{0};
+        std::vector<uint8_t> row_header;
+        for (size_t i = 0; i < fields; ++i) {
+            auto const& column = profile.columns[i];
+            if (column_type(column.tag, 12) != column.type) {
+                throw std::invalid_argument{"column type does not match its tag"};
+            }
+            auto values = column.type == ColumnType::DOUBLE ? column.reals.size() :
+                          column.type == ColumnType::UINT8 ? column.bytes.size() : column.integers.size();
+            if (values != profile.rows) {
+                throw std::invalid_argument{"column does not have a value per row"};
+            }
+            layouts[i].header = column.tag == DataType::OCTET_STRING ? 1 : 0;
+            layouts[i].width = column.tag == DataType::OCTET_STRING ? 12 : fixed_width(column.tag);
+            stride += layouts[i].header + layouts[i].width;
+        }
+
+        if (compact) {
+            if (fields == 0) {
+                throw std::invalid_argument{"compact array of rows without fields"};
+            }
+            buffer.push_back(static_cast<uint8_t>(DataType::COMPACT_ARRAY));
+            buffer.push_back(static_cast<uint8_t>(DataType::STRUCTURE));
+            write_size(buffer, fields);
+            for (auto const& column : profile.columns) {
+                buffer.push_back(static_cast<uint8_t>(column.tag));
+            }
+            write_size(buffer, profile.rows * stride);
+        } else {
+            buffer.push_back(static_cast<uint8_t>(DataType::ARRAY));
+            write_size(buffer, profile.rows);
+            row_header.push_back(static_cast<uint8_t>(DataType::STRUCTURE));
+            write_size(row_header, fields);
+            stride += row_header.size() + fields;
+        }
+
+        auto position = buffer.size();
+        buffer.resize(position + profile.rows * stride);
+        for (size_t row = 0; row < profile.rows; ++row) {
+            std::copy(row_header.begin(), row_header.end(), &buffer[position]);
+            position += row_header.size();
+            for (size_t i = 0; i < fields; ++i) {
+                auto const& column = profile.columns[i];
+                if (!compact) {
+                    buffer[position++] = static_cast<uint8_t>(column.tag);
+                }
+                if (layouts[i].header != 0) {
+                    buffer[position++] = 12;
+                }
+                store(column, row, layouts[i].width, &buffer[position]);
+                position += layouts[i].width;
+            }
+        }
+    }
+
+    /**
+     * Decodes the rows from first to end, which start at entry row, into their range of the columns.
+     * A null field depends on the rows before, possibly in another slice, so its position is kept in
+     * nulls to be filled once all slices are done.
+     */
+    static void decode_rows(Tape const& tape, size_t row_entry, std::vector<FieldLayout> const& layouts,
+                            ProfileColumns &profile, size_t first, size_t end, std::vector<size_t> &nulls)
+    {
+        auto fields = layouts.size();
+        for (auto row = first; row < end; ++row) {
+            auto const& entry = tape[row_entry];
+            if (entry.type != DataType::STRUCTURE) {
+                throw std::invalid_argument{"profile row is not a structure"};
+            }
+            if (entry.children != fields) {
+                throw std::invalid_argument{"profile row does not match the first row"};
+            }
+            for (size_t i = 0; i < fields; ++i) {
+                auto field = row_entry + 1 + i;
+                auto &column = profile.columns[i];
+                auto const& layout = layouts[i];
+                auto type = tape[field].type;
+                if (type == DataType::NULL_DATA) {
+                    nulls.push_back(row * fields + i);
+                    continue;
+                }
+                if (type != column.tag || tape[field].length != layout.header + layout.width) {
+                    throw std::invalid_argument{"profile row does not match the first row"};
+                }
+                set_field(column, layout, tape.contents(field), row);
+            }
+            row_entry = entry.next;
+        }
+    }
+
+    /**
+     * The rows are split between the slices by walking the next entry of each row, which touches
+     * only the tape; each slice then reads its fields through their entries.
+     */
+    void decode_profile(Tape const& tape, size_t entry, ProfileColumns &profile, unsigned threads)
+    {
+        if (entry >= tape.size()) {
+            throw std::out_of_range{"no such entry"};
+        }
+        auto const& array = tape[entry];
+        if (array.type == DataType::COMPACT_ARRAY) {
+            auto offset = size_t{0};
+            decode_compact_profile(tape.bytes(entry), array.length, offset, profile, threads);
+            return;
+        }
+        if (array.type != DataType::ARRAY) {
+            throw std::invalid_argument{"profile buffer is not an array"};
+        }
+        clear(profile);
+        auto rows = size_t{array.children};
+        if (rows == 0) {
+            profile.columns.clear();
+            return;
+        }
+
+        auto const& first_row = tape[entry + 1];
+        if (first_row.type != DataType::STRUCTURE) {
+            throw std::invalid_argument{"profile row is not a structure"};
+        }
+        auto fields = size_t{first_row.children};
+        profile.columns.resize(fields);
+        std::vector<FieldLayout> layouts(fields);
+        for (size_t i = 0; i < fields; ++i) {
+            auto const& field = tape[entry + 2 + i];
+            auto &column = profile.columns[i];
+            column.tag = field.type;
+            column.type = column_type(field.type, field.length - field.header);
+            layouts[i].header = field.header;
+            layouts[i].width = field.length - field.header;
+            layouts[i].is_signed = is_signed(field.type);
+            resize(column, rows);
+        }
+
+        auto slices = slice_count(rows, threads);
+        std::vector<size_t> starts(slices);
+        auto row_entry = entry + 1;
+        for (size_t row = 0, slice = 0; slice < slices; ++row) {
+            if (row == rows * slice / slices) {
+                starts[slice++] = row_entry;
+            }
+            row_entry = tape[row_entry].next;
+        }
+        std::vector<std::vector<size_t>> nulls(slices);
+        run_slices(rows, slices, [&](size_t slice, size_t first, size_t end) {
+            decode_rows(tape, starts[slice], layouts, profile, first, end, nulls[slice]);
+        });
+        for (auto const& slice : nulls) {
+            for (auto position : slice) {
+                fill_null(profile.columns[position % fields], position / fields);
+            }
+        }
+        profile.rows = rows;
+    }
+
+}
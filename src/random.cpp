@@ -0,0 +1,220 @@
+/*
+ * This file is part of the yadi.cpp project.
+ *
+ * Copyright (C) 2017 Paulo Faco <paulofaco@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+///@file
+
+#include "random.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/random.h>)
+#include <sys/random.h>
+#define YADI_GETRANDOM 1
+#endif
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#define YADI_FORK 1
+#endif
+
+namespace dlms
+{
+
+    static inline uint32_t rotl(uint32_t x, unsigned n) {
+        return (x << n) | (x >> (32U - n));
+    }
+
+    static inline void quarter_round(uint32_t *s, unsigned a, unsigned b, unsigned c, unsigned d) {
+        s[a] += s[b]; s[d] = rotl(s[d] ^ s[a], 16);
+        s[c] += s[d]; s[b] = rotl(s[b] ^ s[c], 12);
+        s[a] += s[b]; s[d] = rotl(s[d] ^ s[a], 8);
+        s[c] += s[d]; s[b] = rotl(s[b] ^ s[c], 7);
+    }
+
+    void chacha20_block(const uint32_t key[8], uint32_t counter, const uint32_t nonce[3], uint8_t out[64]) {
+        uint32_t input[16] = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574};
+        std::copy(key, key + 8, input + 4);
+        input[12] = counter;
+        std::copy(nonce, nonce + 3, input + 13);
+
+        uint32_t x[16];
+        std::copy(input, input + 16, x);
+        for (auto i = 0; i < 10; ++i) {
+            quarter_round(x, 0, 4, 8, 12);
+            quarter_round(x, 1, 5, 9, 13);
+            quarter_round(x, 2, 6, 10, 14);
+            quarter_round(x, 3, 7, 11, 15);
+            quarter_round(x, 0, 5, 10, 15);
+            quarter_round(x, 1, 6, 11, 12);
+            quarter_round(x, 2, 7, 8, 13);
+            quarter_round(x, 3, 4, 9, 14);
+        }
+        for (auto i = 0; i < 16; ++i) {
+            auto word = x[i] + input[i];
+            out[4 * i] = static_cast<uint8_t>(word);
+            out[4 * i + 1] = static_cast<uint8_t>(word >> 8U);
+            out[4 * i + 2] = static_cast<uint8_t>(word >> 16U);
+            out[4 * i + 3] = static_cast<uint8_t>(word >> 24U);
+        }
+    }
+
+    /**
+     * Entropy from the operating system: getrandom where available, std::random_device otherwise
+     */
+    static void os_random(uint8_t *buffer, size_t size) {
+#if defined(YADI_GETRANDOM)
+        while (size > 0) {
+            auto n = getrandom(buffer, size, 0);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("getrandom failed");
+            }
+            buffer += n;
+            size -= static_cast<size_t>(n);
+        }
+#else
+        std::random_device device;
+        for (size_t i = 0; i < size; i += sizeof(unsigned int)) {
+            auto value = device();
+            std::memcpy(buffer + i, &value, std::min(sizeof(value), size - i));
+        }
+#endif
+    }
+
+#ifdef YADI_FORK
+    /**
+     * Bumped in every forked child, so generators notice the fork without a system call per fill
+     */
+    static std::atomic<unsigned> fork_generation{0};
+
+    static void on_fork_child() {
+        fork_generation.fetch_add(1, std::memory_order_relaxed);
+    }
+#endif
+
+    /**
+     * Fast-key-erasure generator: each refill produces a buffer of key stream, whose first 32 bytes
+     * become the next key. Bytes are wiped once handed out, so a later memory disclosure cannot
+     * recover earlier challenges or keys. A forked child inherits the state of its parent, so the
+     * generator reseeds when a pthread_atfork handler reports a fork.
+     */
+    class ChaChaGenerator {
+    public:
+        ChaChaGenerator() {
+#ifdef YADI_FORK
+            static const auto registered = ::pthread_atfork(nullptr, nullptr, on_fork_child);
+            (void)registered;
+#endif
+            reseed();
+        }
+
+        ~ChaChaGenerator() {
+            wipe(key_, sizeof(key_));
+            wipe(buffer_, sizeof(buffer_));
+        }
+
+        void fill(uint8_t *out, size_t size) {
+#ifdef YADI_FORK
+            if (fork_generation.load(std::memory_order_relaxed) != generation_) {
+                wipe(buffer_, sizeof(buffer_));
+                available_ = 0;
+                reseed();
+            }
+#endif
+            while (size > 0) {
+                if (available_ == 0) {
+                    refill();
+                }
+                auto n = std::min(size, available_);
+                auto from = buffer_ + BUFFER_SIZE - available_;
+                std::memcpy(out, from, n);
+                wipe(from, n);
+                available_ -= n;
+                out += n;
+                size -= n;
+            }
+        }
+
+    private:
+        static const size_t BUFFER_SIZE = 768;
+        static const size_t KEY_SIZE = 32;
+        static const uint64_t RESEED_INTERVAL = uint64_t{1} << 20U; //bytes
+
+        static void wipe(void *p, size_t size) {
+            volatile auto bytes = static_cast<volatile uint8_t*>(p);
+            for (size_t i = 0; i < size; ++i) {
+                bytes[i] = 0;
+            }
+        }
+
+        void reseed() {
+            uint8_t seed[KEY_SIZE];
+            os_random(seed, sizeof(seed));
+            for (size_t i = 0; i < 8; ++i) {
+                uint32_t word;
+                std::memcpy(&word, seed + 4 * i, sizeof(word));
+                key_[i] ^= word;
+            }
+            wipe(seed, sizeof(seed));
+            generated_ = 0;
+#ifdef YADI_FORK
+            generation_ = fork_generation.load(std::memory_order_relaxed);
+#endif
+        }
+
+        void refill() {
+            if (generated_ >= RESEED_INTERVAL) {
+                reseed();
+            }
+            uint32_t nonce[3] = {static_cast<uint32_t>(blocks_ >> 32U), 0, 0};
+            for (size_t offset = 0; offset < BUFFER_SIZE; offset += 64) {
+                chacha20_block(key_, static_cast<uint32_t>(blocks_++), nonce, buffer_ + offset);
+                nonce[0] = static_cast<uint32_t>(blocks_ >> 32U);
+            }
+            std::memcpy(key_, buffer_, KEY_SIZE);
+            wipe(buffer_, KEY_SIZE);
+            available_ = BUFFER_SIZE - KEY_SIZE;
+            generated_ += available_;
+        }
+
+        uint32_t key_[8] = {0};
+        uint64_t blocks_ = 0;
+        uint64_t generated_ = 0;
+        uint8_t buffer_[BUFFER_SIZE];
+        size_t available_ = 0;
+#ifdef YADI_FORK
+        unsigned generation_ = 0;
+#endif
+    };
+
+    void random_bytes(uint8_t *buffer, size_t size) {
+        thread_local ChaChaGenerator generator;
+        generator.fill(buffer, size);
+    }
+
+} //namespace dlms
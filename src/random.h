@@ -0,0 +1,43 @@
+/*
+ * This file is part of the yadi.cpp project.
+ *
+ * Copyright (C) 2017 Paulo Faco <paulofaco@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef YADI_DLMS_RANDOM_H
+#define YADI_DLMS_RANDOM_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace dlms
+{
+
+/**
+ * ChaCha20 block function (RFC 8439)
+ * @param out receives 64 bytes of key stream
+ */
+void chacha20_block(const uint32_t key[8], uint32_t counter, const uint32_t nonce[3], uint8_t out[64]);
+
+/**
+ * Fills a buffer with cryptographically secure random bytes. Each thread owns a ChaCha20 generator
+ * seeded from the operating system, so concurrent associations never share state or take a lock.
+ */
+void random_bytes(uint8_t *buffer, size_t size);
+
+} //namespace dlms
+
+#endif //YADI_DLMS_RANDOM_H
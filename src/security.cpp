@@ -18,35 +18,455 @@
  */
 
 #include "security.h"
+#include "hash.h"
+#include "random.h"
 #include <yadi/cosem.h>
+#include <yadi/counter_store.h>
+#include <yadi/gcm.h>
+#include <yadi/key_store.h>
+#include <yadi/parser.h>
 #include <iterator>
-#include <random>
-#include <climits>
 #include <algorithm>
-
-std::independent_bits_engine<std::default_random_engine, CHAR_BIT, unsigned int> rng;
+#include <stdexcept>
 
 namespace dlms {
 
-    void Security::generate_challenger(unsigned size, std::vector<uint8_t> &buffer) {
-        for (unsigned i = 0; i < size; ++i) {
-            buffer.push_back(rng());
+    void Security::generate_challenger(uint8_t *challenger, size_t size) {
+        random_bytes(challenger, size);
+    }
+
+    /**
+     * Security control byte, for security suite 0 (AES-GCM-128)
+     */
+    enum SecurityControl : uint8_t {
+        SC_AUTHENTICATION = 0x10,
+        SC_ENCRYPTION = 0x20,
+        SC_SUITE_MASK = 0x0F,
+    };
+
+    static const auto TAG_SIZE = size_t{12};
+    static const auto IC_SIZE = size_t{4};
+    static const auto DED_CIPHERING_FIRST_TAG = uint8_t{208}; //ded-get-request
+    static const auto DED_CIPHERING_LAST_TAG = uint8_t{215};  //ded-action-response
+    static const auto GENERAL_GLO_CIPHERING = uint8_t{219};
+
+    void Security::generate_dedicated_key(Cosem &cosem) {
+        random_bytes(cosem.context.dek.data(), cosem.context.dek.size());
+    }
+
+    void Security::expand_keys(Cosem &cosem) {
+        cosem.context.glo_cipher = Gcm{cosem.parameters.guek};
+        if (cosem.parameters.dedicated_key) {
+            cosem.context.ded_cipher = Gcm{cosem.context.dek};
+        }
+    }
+
+    /**
+     * Ded-ciphering APDU tags (ded-get-request .. ded-action-response) use the dedicated key,
+     * every other ciphered APDU the global unicast key.
+     */
+    static auto cipher_for(Cosem &cosem, uint8_t tag) -> Gcm const& {
+        auto dedicated = tag >= DED_CIPHERING_FIRST_TAG && tag <= DED_CIPHERING_LAST_TAG;
+        auto &gcm = dedicated ? cosem.context.ded_cipher : cosem.context.glo_cipher;
+        if (!gcm.keyed()) {
+            gcm = dedicated ? Gcm{cosem.context.dek} : Gcm{cosem.parameters.guek};
+        }
+        return gcm;
+    }
+
+    /**
+     * With a counter store, counters come from ranges reserved for the session, so sessions sharing
+     * a system title never reuse a counter; otherwise the context counter just increments.
+     */
+    static auto next_invocation_counter(Cosem &cosem) -> uint32_t {
+        auto store = cosem.parameters.invocation_counters;
+        auto &context = cosem.context;
+        if (store != nullptr && context.invocation_counter == context.invocation_counter_end) {
+            auto count = std::max(cosem.parameters.invocation_counter_range, uint32_t{1});
+            context.invocation_counter = store->reserve(cosem.parameters.system_title, count);
+            context.invocation_counter_end = context.invocation_counter + count;
+        }
+        return context.invocation_counter++;
+    }
+
+    static auto security_control(SecurityContext security) -> uint8_t {
+        switch (security) {
+            case SecurityContext::AUTHENTICATION:
+                return SC_AUTHENTICATION;
+            case SecurityContext::ENCRYPTION:
+                return SC_ENCRYPTION;
+            case SecurityContext::AUTHENTICATION_ENCRYPTION:
+                return SC_AUTHENTICATION | SC_ENCRYPTION;
+            default:
+                throw std::invalid_argument("invalid security context");
+        }
+    }
+
+    static auto make_iv(std::array<uint8_t,8> const& system_title, uint32_t invocation_counter) -> std::array<uint8_t,12> {
+        std::array<uint8_t,12> iv;
+        std::copy(system_title.begin(), system_title.end(), iv.begin());
+        iv[8] = static_cast<uint8_t>(invocation_counter >> 24U);
+        iv[9] = static_cast<uint8_t>(invocation_counter >> 16U);
+        iv[10] = static_cast<uint8_t>(invocation_counter >> 8U);
+        iv[11] = static_cast<uint8_t>(invocation_counter);
+        return iv;
+    }
+
+    /**
+     * Additional authenticated data: SC || AK, followed by the plain APDU when it is only authenticated
+     */
+    static auto make_aad(uint8_t sc, std::array<uint8_t,16> const& ak, const uint8_t *plain, size_t size) -> std::vector<uint8_t> {
+        auto aad = std::vector<uint8_t>{};
+        aad.reserve(1 + ak.size() + size);
+        aad.push_back(sc);
+        aad.insert(aad.end(), ak.begin(), ak.end());
+        aad.insert(aad.end(), plain, plain + size);
+        return aad;
+    }
+
+    void Security::framing(Cosem const& cosem, size_t plain_size, size_t &header, size_t &trailer) {
+        auto sc = security_control(cosem.parameters.security);
+        trailer = (sc & SC_AUTHENTICATION) ? TAG_SIZE : 0;
+        header = 1 + size_length(1 + IC_SIZE + plain_size + trailer) + 1 + IC_SIZE;
+    }
+
+    /*
+     * Ciphered APDU ::= tag, length, security-header (SC || IC), information, authentication tag
+     *
+     * The header is written in front of the plain APDU, which is then encrypted where it is.
+     */
+    void Security::cipher(Cosem &cosem, uint8_t tag, std::vector<uint8_t> &apdu) {
+        auto plain_size = apdu.size();
+        size_t header, trailer;
+        framing(cosem, plain_size, header, trailer);
+        apdu.insert(apdu.begin(), header, 0);
+        apdu.resize(apdu.size() + trailer);
+        cipher(cosem, tag, apdu.data(), plain_size);
+    }
+
+    void Security::cipher(Cosem &cosem, uint8_t tag, uint8_t *frame, size_t plain_size) {
+        auto sc = security_control(cosem.parameters.security);
+        auto ic = next_invocation_counter(cosem);
+        auto authenticated = (sc & SC_AUTHENTICATION) != 0;
+
+        auto length = 1 + IC_SIZE + plain_size + (authenticated ? TAG_SIZE : 0);
+        auto p = frame;
+        *p++ = tag;
+        p = write_size(p, length);
+        *p++ = sc;
+        *p++ = static_cast<uint8_t>(ic >> 24U);
+        *p++ = static_cast<uint8_t>(ic >> 16U);
+        *p++ = static_cast<uint8_t>(ic >> 8U);
+        *p++ = static_cast<uint8_t>(ic);
+
+        auto iv = make_iv(cosem.parameters.system_title, ic);
+        auto plain = p;
+        auto auth_tag = plain + plain_size;
+        uint8_t unused_tag[TAG_SIZE];
+        auto const& gcm = cipher_for(cosem, tag);
+        if (sc & SC_ENCRYPTION) {
+            auto aad = make_aad(sc, cosem.parameters.ak, nullptr, 0);
+            gcm.encrypt(iv.data(), authenticated ? aad.data() : nullptr, authenticated ? aad.size() : 0,
+                        plain, plain_size, authenticated ? auth_tag : unused_tag, TAG_SIZE);
+        } else {
+            auto aad = make_aad(sc, cosem.parameters.ak, plain, plain_size);
+            gcm.encrypt(iv.data(), aad.data(), aad.size(), nullptr, 0, auth_tag, TAG_SIZE);
+        }
+    }
+
+    /**
+     * Layout of a ciphered content: length, security header (SC || IC), information, tag
+     */
+    struct CipheredContent {
+        uint8_t sc;
+        uint32_t ic;
+        size_t plain_offset;
+        size_t plain_size;
+        bool authenticated;
+    };
+
+    static auto parse_content(std::vector<uint8_t> const& apdu, size_t offset) -> CipheredContent {
+        auto size = read_size(apdu, offset);
+        if (size < 1 + IC_SIZE || offset + size > apdu.size()) {
+            throw InvalidCosemFrame{};
+        }
+
+        CipheredContent content;
+        content.sc = apdu[offset];
+        content.ic = static_cast<uint32_t>(apdu[offset + 1] << 24U | apdu[offset + 2] << 16U | apdu[offset + 3] << 8U | apdu[offset + 4]);
+        content.authenticated = (content.sc & SC_AUTHENTICATION) != 0;
+        if ((content.sc & SC_SUITE_MASK) != 0 || (content.authenticated && size < 1 + IC_SIZE + TAG_SIZE)) {
+            throw InvalidCosemFrame{};
+        }
+        content.plain_offset = offset + 1 + IC_SIZE;
+        content.plain_size = size - 1 - IC_SIZE - (content.authenticated ? TAG_SIZE : 0);
+        return content;
+    }
+
+    /**
+     * Leaves only the plain APDU in the buffer
+     */
+    static void strip_content(std::vector<uint8_t> &apdu, CipheredContent const& content) {
+        apdu.erase(apdu.begin() + content.plain_offset + content.plain_size, apdu.end());
+        apdu.erase(apdu.begin(), apdu.begin() + content.plain_offset);
+    }
+
+    /**
+     * Deciphers the ciphered content found at offset and leaves only the plain APDU in the buffer
+     */
+    static void decipher_content(Gcm const& gcm, std::array<uint8_t,16> const& ak, std::array<uint8_t,8> const& system_title,
+                                 std::vector<uint8_t> &apdu, size_t offset) {
+        auto content = parse_content(apdu, offset);
+        auto sc = content.sc;
+        auto authenticated = content.authenticated;
+        auto plain = apdu.data() + content.plain_offset;
+        auto plain_size = content.plain_size;
+        auto auth_tag = plain + plain_size;
+        auto iv = make_iv(system_title, content.ic);
+
+        auto valid = true;
+        if (sc & SC_ENCRYPTION) {
+            auto aad = make_aad(sc, ak, nullptr, 0);
+            valid = gcm.decrypt(iv.data(), authenticated ? aad.data() : nullptr, authenticated ? aad.size() : 0,
+                                plain, plain_size, auth_tag, authenticated ? TAG_SIZE : 0);
+        } else if (authenticated) {
+            auto aad = make_aad(sc, ak, plain, plain_size);
+            valid = gcm.decrypt(iv.data(), aad.data(), aad.size(), nullptr, 0, auth_tag, TAG_SIZE);
+        }
+        if (!valid) {
+            throw CosemAuthenticationError{};
+        }
+        strip_content(apdu, content);
+    }
+
+    void Security::decipher(Cosem &cosem, std::vector<uint8_t> &apdu) {
+        auto const& gcm = cipher_for(cosem, apdu.at(0));
+        decipher_content(gcm, cosem.parameters.ak, cosem.context.server_system_title, apdu, 1);
+    }
+
+    /*
+     * general-glo-ciphering ::= tag, system-title (octet-string), ciphered-content (octet-string)
+     */
+    static auto general_glo_title(std::vector<uint8_t> const& apdu) -> std::array<uint8_t,8> {
+        std::array<uint8_t,8> system_title;
+        if (apdu.size() < 2 + system_title.size() || apdu[0] != GENERAL_GLO_CIPHERING || apdu[1] != system_title.size()) {
+            throw InvalidCosemFrame{};
         }
+        std::copy(apdu.begin() + 2, apdu.begin() + 2 + system_title.size(), system_title.begin());
+        return system_title;
     }
 
-    std::vector<uint8_t> Security::process_challenger(CosemParameters const& params) {
-        switch (params.authentication) {
+    auto Security::decipher_general_glo(KeyStore const& store, std::vector<uint8_t> &apdu) -> std::array<uint8_t,8> {
+        auto system_title = general_glo_title(apdu);
+        auto keys = store.find(system_title);
+        if (keys == nullptr) {
+            throw std::out_of_range("no keys for system title");
+        }
+        decipher_content(keys->cipher, keys->ak, system_title, apdu, 2 + system_title.size());
+        return system_title;
+    }
+
+    /*
+     * Encrypted APDUs go to Gcm::decrypt_many; the few that are only authenticated, or malformed,
+     * take the single APDU path.
+     */
+    auto Security::decipher_general_glo(KeyStore const& store, std::vector<std::vector<uint8_t>> &apdus) -> std::vector<DecipherStatus> {
+        struct Pending {
+            size_t index;
+            const KeySet *keys;
+            CipheredContent content;
+            std::array<uint8_t,12> iv;
+            std::vector<uint8_t> aad;
+        };
+
+        auto status = std::vector<DecipherStatus>(apdus.size(), DecipherStatus::OK);
+        auto pending = std::vector<Pending>{};
+        pending.reserve(apdus.size());
+        for (size_t i = 0; i < apdus.size(); ++i) {
+            auto &apdu = apdus[i];
+            try {
+                auto system_title = general_glo_title(apdu);
+                auto keys = store.find(system_title);
+                if (keys == nullptr) {
+                    status[i] = DecipherStatus::UNKNOWN_SYSTEM_TITLE;
+                    continue;
+                }
+                auto content = parse_content(apdu, 2 + system_title.size());
+                if ((content.sc & SC_ENCRYPTION) == 0) {
+                    decipher_content(keys->cipher, keys->ak, system_title, apdu, 2 + system_title.size());
+                    continue;
+                }
+                auto aad = content.authenticated ? make_aad(content.sc, keys->ak, nullptr, 0) : std::vector<uint8_t>{};
+                pending.push_back(Pending{i, keys, content, make_iv(system_title, content.ic), std::move(aad)});
+            } catch (CosemAuthenticationError const&) {
+                status[i] = DecipherStatus::AUTHENTICATION_FAILED;
+            } catch (std::exception const&) {
+                status[i] = DecipherStatus::INVALID_FRAME;
+            }
+        }
+
+        auto jobs = std::vector<GcmJob>{};
+        jobs.reserve(pending.size());
+        for (auto const& p : pending) {
+            auto &apdu = apdus[p.index];
+            auto plain = apdu.data() + p.content.plain_offset;
+            jobs.push_back(GcmJob{&p.keys->cipher, p.iv.data(), p.aad.data(), p.aad.size(), plain, p.content.plain_size,
+                                  plain + p.content.plain_size, p.content.authenticated ? TAG_SIZE : 0, false});
+        }
+        Gcm::decrypt_many(jobs.data(), jobs.size());
+
+        for (size_t j = 0; j < pending.size(); ++j) {
+            auto index = pending[j].index;
+            if (jobs[j].valid) {
+                strip_content(apdus[index], pending[j].content);
+            } else {
+                status[index] = DecipherStatus::AUTHENTICATION_FAILED;
+            }
+        }
+        return status;
+    }
+
+    /**
+     * HLS-GMAC: f(challenge) = SC || IC || GMAC(SC || AK || challenge), with the IV built from the system title of
+     * the party answering the challenge. It uses the cached global key schedule, as data ciphering does.
+     */
+    static auto gmac_challenger(Cosem &cosem, std::array<uint8_t,8> const& system_title, uint32_t ic,
+                                std::vector<uint8_t> const& challenger) -> std::vector<uint8_t> {
+        auto sc = static_cast<uint8_t>(SC_AUTHENTICATION);
+        auto iv = make_iv(system_title, ic);
+        auto aad = make_aad(sc, cosem.parameters.ak, challenger.data(), challenger.size());
+
+        auto result = std::vector<uint8_t>(1 + IC_SIZE + TAG_SIZE);
+        result[0] = sc;
+        std::copy(iv.begin() + 8, iv.end(), result.begin() + 1);
+        cipher_for(cosem, 0).encrypt(iv.data(), aad.data(), aad.size(), nullptr, 0, result.data() + 1 + IC_SIZE, TAG_SIZE);
+        return result;
+    }
+
+    static auto hash_algorithm(AuthenticationMechanism mechanism) -> HashAlgorithm {
+        switch (mechanism) {
             case AuthenticationMechanism::HLS_MD5:
-                break;
+                return HashAlgorithm::MD5;
             case AuthenticationMechanism::HLS_SHA1:
-                break;
+                return HashAlgorithm::SHA1;
             case AuthenticationMechanism::HLS_SHA256:
-                break;
+                return HashAlgorithm::SHA256;
+            default:
+                throw std::invalid_argument("invalid authentication type");
+        }
+    }
+
+    /**
+     * Message hashed to answer a challenge. HLS-MD5 and HLS-SHA1: challenge || secret. HLS-SHA256:
+     * secret || own system title || peer system title || challenge || own challenge.
+     * @param client true for f(StoC), answered by the client, false for f(CtoS), answered by the server
+     */
+    static auto hls_message(Cosem &cosem, bool client) -> std::vector<uint8_t> {
+        auto const& secret = cosem.parameters.secret;
+        auto const& challenge = client ? cosem.context.server_challenger : cosem.context.client_challenger;
+        auto message = std::vector<uint8_t>{};
+        if (cosem.parameters.authentication != AuthenticationMechanism::HLS_SHA256) {
+            message.reserve(challenge.size() + secret.size());
+            message.insert(message.end(), challenge.begin(), challenge.end());
+            message.insert(message.end(), secret.begin(), secret.end());
+            return message;
+        }
+
+        auto const& own_title = client ? cosem.parameters.system_title : cosem.context.server_system_title;
+        auto const& peer_title = client ? cosem.context.server_system_title : cosem.parameters.system_title;
+        auto const& own_challenge = client ? cosem.context.client_challenger : cosem.context.server_challenger;
+        message.reserve(secret.size() + own_title.size() + peer_title.size() + challenge.size() + own_challenge.size());
+        message.insert(message.end(), secret.begin(), secret.end());
+        message.insert(message.end(), own_title.begin(), own_title.end());
+        message.insert(message.end(), peer_title.begin(), peer_title.end());
+        message.insert(message.end(), challenge.begin(), challenge.end());
+        message.insert(message.end(), own_challenge.begin(), own_challenge.end());
+        return message;
+    }
+
+    static auto hls_challenger(Cosem &cosem, bool client) -> std::vector<uint8_t> {
+        auto algorithm = hash_algorithm(cosem.parameters.authentication);
+        auto message = hls_message(cosem, client);
+        auto result = std::vector<uint8_t>(digest_size(algorithm));
+        hash(algorithm, message.data(), message.size(), result.data());
+        return result;
+    }
+
+    auto Security::process_challenger(Cosem &cosem) -> std::vector<uint8_t> {
+        switch (cosem.parameters.authentication) {
+            case AuthenticationMechanism::HLS_MD5:
+            case AuthenticationMechanism::HLS_SHA1:
+            case AuthenticationMechanism::HLS_SHA256:
+                return hls_challenger(cosem, true);
             case AuthenticationMechanism::HLS_GMAC:
-                break;
+                return gmac_challenger(cosem, cosem.parameters.system_title, next_invocation_counter(cosem),
+                                       cosem.context.server_challenger);
             default:
                 throw std::invalid_argument("invalid authentication type");
         }
-		return {};
+    }
+
+    /*
+     * Hash-based answers are grouped by algorithm so that hash_many can hash them side by side;
+     * HLS-GMAC answers go through the cached key schedule of each session. Sessions without HLS
+     * have nothing to answer and are left with an empty answer.
+     */
+    auto Security::process_challengers(std::vector<Cosem*> const& sessions) -> std::vector<std::vector<uint8_t>> {
+        auto results = std::vector<std::vector<uint8_t>>(sessions.size());
+        auto messages = std::vector<std::vector<uint8_t>>(sessions.size());
+        const HashAlgorithm algorithms[] = {HashAlgorithm::MD5, HashAlgorithm::SHA1, HashAlgorithm::SHA256};
+        for (auto algorithm : algorithms) {
+            auto jobs = std::vector<HashJob>{};
+            for (size_t i = 0; i < sessions.size(); ++i) {
+                auto mechanism = sessions[i]->parameters.authentication;
+                if (mechanism != AuthenticationMechanism::HLS_MD5 && mechanism != AuthenticationMechanism::HLS_SHA1 &&
+                    mechanism != AuthenticationMechanism::HLS_SHA256) {
+                    continue;
+                }
+                if (hash_algorithm(mechanism) != algorithm) {
+                    continue;
+                }
+                messages[i] = hls_message(*sessions[i], true);
+                results[i].resize(digest_size(algorithm));
+                jobs.push_back(HashJob{messages[i].data(), messages[i].size(), results[i].data()});
+            }
+            hash_many(algorithm, jobs.data(), jobs.size());
+        }
+        for (size_t i = 0; i < sessions.size(); ++i) {
+            if (sessions[i]->parameters.authentication == AuthenticationMechanism::HLS_GMAC) {
+                results[i] = process_challenger(*sessions[i]);
+            }
+        }
+        return results;
+    }
+
+    bool Security::verify_challenger(Cosem &cosem, std::vector<uint8_t> const& response) {
+        auto expected = std::vector<uint8_t>{};
+        switch (cosem.parameters.authentication) {
+            case AuthenticationMechanism::HLS_MD5:
+            case AuthenticationMechanism::HLS_SHA1:
+            case AuthenticationMechanism::HLS_SHA256:
+                expected = hls_challenger(cosem, false);
+                break;
+            case AuthenticationMechanism::HLS_GMAC: {
+                if (response.size() != 1 + IC_SIZE + TAG_SIZE || response[0] != SC_AUTHENTICATION) {
+                    return false;
+                }
+                auto ic = static_cast<uint32_t>(response[1] << 24U | response[2] << 16U | response[3] << 8U | response[4]);
+                expected = gmac_challenger(cosem, cosem.context.server_system_title, ic, cosem.context.client_challenger);
+                break;
+            }
+            default:
+                return false;
+        }
+
+        if (expected.size() != response.size()) {
+            return false;
+        }
+        auto diff = uint8_t{0};
+        for (size_t i = 0; i < expected.size(); ++i) {
+            diff |= expected[i] ^ response[i];
+        }
+        return diff == 0;
     }
 }
@@ -21,6 +21,7 @@
 #define YADI_DLMS_SECURITY_H
 
 #include <yadi/cosem.h>
+#include <yadi/key_store.h>
 
 namespace dlms
 {
@@ -28,9 +29,72 @@ namespace dlms
 class Security
 {
 public:
-    static void generate_challenger(unsigned size, std::vector <uint8_t> &buffer);
+    /**
+     * Writes a random challenge of the given size, from the per-thread generator of random.h
+     */
+    static void generate_challenger(uint8_t *challenger, size_t size);
 
-    static auto process_challenger(CosemParameters const &params) -> std::vector<uint8_t>;
+    /**
+     * Computes f(StoC), the client answer to the server challenge, in HLS pass 3
+     */
+    static auto process_challenger(Cosem &cosem) -> std::vector<uint8_t>;
+
+    /**
+     * Computes f(StoC) for many associations at once, hashing challenges of the same mechanism together
+     */
+    static auto process_challengers(std::vector<Cosem*> const& sessions) -> std::vector<std::vector<uint8_t>>;
+
+    /**
+     * Verifies f(CtoS), the server answer to the client challenge, received in HLS pass 4
+     */
+    static bool verify_challenger(Cosem &cosem, std::vector<uint8_t> const& response);
+
+    /**
+     * Generates a fresh dedicated key for the association
+     */
+    static void generate_dedicated_key(Cosem &cosem);
+
+    /**
+     * Expands the key schedules of the global and dedicated keys, once per association
+     */
+    static void expand_keys(Cosem &cosem);
+
+    /**
+     * Ciphers an xDLMS APDU in place, according to the security context of the association, using
+     * and incrementing the invocation counter of the context.
+     * @param tag the ciphered APDU tag, ded-ciphering tags select the dedicated key
+     * @param apdu the plain APDU, replaced by the ciphered one
+     */
+    static void cipher(Cosem &cosem, uint8_t tag, std::vector<uint8_t> &apdu);
+
+    /**
+     * Room a ciphered APDU needs around its plain_size bytes of plain APDU: header in front (tag, length,
+     * SC, IC) and trailer after it (authentication tag)
+     */
+    static void framing(Cosem const& cosem, size_t plain_size, size_t &header, size_t &trailer);
+
+    /**
+     * Ciphers a plain APDU that is already framed by the room given by framing(), without moving it.
+     * @param frame the header room, followed by the plain APDU and the trailer room
+     */
+    static void cipher(Cosem &cosem, uint8_t tag, uint8_t *frame, size_t plain_size);
+
+    /**
+     * Deciphers a glo-ciphered or ded-ciphered xDLMS APDU received from the server in place.
+     * @throw CosemAuthenticationError if the authentication tag does not match
+     */
+    static void decipher(Cosem &cosem, std::vector<uint8_t> &apdu);
+
+    /**
+     * Deciphers a general-glo-ciphering APDU in place, with the keys of the system title it carries
+     * @return the system title of the sender
+     */
+    static auto decipher_general_glo(KeyStore const& store, std::vector<uint8_t> &apdu) -> std::array<uint8_t,8>;
+
+    /**
+     * Deciphers a burst of general-glo-ciphering APDUs in place, encrypted ones in parallel lanes
+     */
+    static auto decipher_general_glo(KeyStore const& store, std::vector<std::vector<uint8_t>> &apdus) -> std::vector<DecipherStatus>;
 };
 
 }
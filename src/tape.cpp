@@ -0,0 +1,127 @@
+/*
+ * This file is part of the yadi.cpp project.
+ *
+ * Copyright (C) 2017 Paulo Faco <paulofaco@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+///@file
+
+#include <yadi/tape.h>
+#include "data_type.h"
+#include <stdexcept>
+
+namespace dlms
+{
+
+    /**
+     * Arrays and structures are kept open on a stack until their last child is indexed, when their
+     * length and next entry are known; the stack replaces recursion so that a hostile buffer is
+     * bounded by MAX_DEPTH without using the call stack.
+     */
+    void Tape::index(const uint8_t *data, size_t size)
+    {
+        if (size > UINT32_MAX) {
+            throw std::invalid_argument{"buffer too large to index"};
+        }
+        data_ = data;
+        size_ = size;
+        entries_.clear();
+        open_.clear();
+
+        auto offset = size_t{0};
+        while (offset < size) {
+            TapeEntry entry;
+            entry.type = static_cast<DataType>(data[offset]);
+            entry.offset = static_cast<uint32_t>(offset);
+            auto position = offset + 1;
+            auto length = size_t{0};
+            switch (entry.type) {
+                case DataType::ARRAY:
+                case DataType::STRUCTURE: {
+                    if (open_.size() == MAX_DEPTH) {
+                        throw std::invalid_argument{"values nested too deep"};
+                    }
+                    auto count = read_size(data, size, position);
+                    if (count > size - position) {
+                        throw std::underflow_error{"not enough bytes"}; //every child takes at least its tag
+                    }
+                    entry.children = static_cast<uint32_t>(count);
+                    break;
+                }
+                case DataType::COMPACT_ARRAY:
+                    skip_type_description(data, size, position);
+                    length = read_size(data, size, position);
+                    break;
+                case DataType::BIT_STRING:
+                    length = (read_size(data, size, position) + 7) / 8;
+                    break;
+                default:
+                    length = fixed_width(entry.type);
+                    if (length == VARIABLE_WIDTH) {
+                        length = read_size(data, size, position);
+                    }
+                    break;
+            }
+            if (length > size - position) {
+                throw std::underflow_error{"not enough bytes"};
+            }
+            entry.header = static_cast<uint32_t>(position - offset);
+            entries_.push_back(entry);
+            if (entry.children != 0) {
+                open_.push_back({entries_.size() - 1, entry.children});
+                offset = position;
+                continue;
+            }
+
+            offset = position + length;
+            entries_.back().length = static_cast<uint32_t>(offset - entry.offset);
+            entries_.back().next = static_cast<uint32_t>(entries_.size());
+            while (!open_.empty() && --open_.back().remaining == 0) {
+                auto &parent = entries_[open_.back().entry];
+                parent.length = static_cast<uint32_t>(offset - parent.offset);
+                parent.next = static_cast<uint32_t>(entries_.size());
+                open_.pop_back();
+            }
+        }
+        if (!open_.empty()) {
+            throw std::underflow_error{"not enough bytes"};
+        }
+    }
+
+    void Tape::index(std::vector<uint8_t> const& buffer)
+    {
+        index(buffer.data(), buffer.size());
+    }
+
+    auto Tape::child(size_t entry, size_t index) const -> size_t
+    {
+        if (index >= entries_.at(entry).children) {
+            throw std::out_of_range{"no such child"};
+        }
+        auto child = entry + 1;
+        while (index-- > 0) {
+            child = entries_[child].next;
+        }
+        return child;
+    }
+
+    auto Tape::view(size_t entry) const -> DataView
+    {
+        return DataView{data_, size_, entries_[entry].offset};
+    }
+
+}
@@ -60,8 +60,7 @@ namespace wrapper
 		if (!wrapper_frame_complete(data)) {
 			throw std::runtime_error("wrapper: received invalid data");
 		}
-		//TODO unpack wrapper frame
-		return data;
+		return std::vector<uint8_t>(data.begin() + 8, data.end());
 	}
 
 } //namespace wrapper
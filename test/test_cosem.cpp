@@ -4,8 +4,10 @@
 
 #include "catch.hpp"
 #include "yadi/cosem.h"
+#include "yadi/object_registry.h"
 #include <iostream>
 #include <iomanip>
+#include <unordered_set>
 
 TEST_CASE( "AARQ is correctly serialized for LLS and no Security", "[serialize_aarq]") {
     static std::vector<uint8_t> expected_aarq = {0x60, 0x39, 0x80, 0x02, 0x07, 0x80, 0xA1, 0x09, 0x06, 0x07, 0x60, 0x85,
@@ -80,3 +82,245 @@ TEST_CASE( "Action-Request is correctly serialized", "serialize_act") {
 
     REQUIRE (dlms::serialize_action_request(cosem, request) == expected_act);
 }
+
+static std::vector<uint8_t> gbt_block(uint8_t control, uint16_t block_number, uint16_t block_number_ack,
+                                      std::vector<uint8_t> const& data) {
+    std::vector<uint8_t> buffer;
+    buffer.reserve(7 + data.size());
+    buffer.push_back(0xE0);
+    buffer.push_back(control);
+    buffer.push_back(static_cast<uint8_t>(block_number >> 8));
+    buffer.push_back(static_cast<uint8_t>(block_number));
+    buffer.push_back(static_cast<uint8_t>(block_number_ack >> 8));
+    buffer.push_back(static_cast<uint8_t>(block_number_ack));
+    buffer.push_back(static_cast<uint8_t>(data.size()));
+    buffer.insert(buffer.end(), data.begin(), data.end());
+    return buffer;
+}
+
+TEST_CASE( "GBT blocks are streamed to the consumer and acknowledged per window", "[gbt]") {
+    dlms::Cosem cosem{};
+    cosem.parameters.gbt_window_size = 3;
+    std::vector<uint8_t> received;
+    auto consumer = [&received](const uint8_t *data, size_t size) { received.insert(received.end(), data, data + size); };
+
+    REQUIRE (dlms::parse_gbt(cosem, gbt_block(0x43, 1, 0, {0xC4, 0x01}), consumer) == dlms::GbtStatus::RECEIVING);
+    REQUIRE (dlms::parse_gbt(cosem, gbt_block(0x43, 2, 0, {0xC1, 0x00}), consumer) == dlms::GbtStatus::RECEIVING);
+    REQUIRE (dlms::parse_gbt(cosem, gbt_block(0x03, 3, 0, {0x09, 0x02}), consumer) == dlms::GbtStatus::WINDOW_COMPLETE);
+    REQUIRE (received == std::vector<uint8_t>{0xC4, 0x01, 0xC1, 0x00, 0x09, 0x02});
+    REQUIRE (dlms::serialize_gbt_ack(cosem) == gbt_block(0x83, 1, 3, {}));
+
+    REQUIRE (dlms::parse_gbt(cosem, gbt_block(0x83, 4, 1, {0x12, 0x34}), consumer) == dlms::GbtStatus::LAST_BLOCK);
+    REQUIRE (received == std::vector<uint8_t>{0xC4, 0x01, 0xC1, 0x00, 0x09, 0x02, 0x12, 0x34});
+}
+
+TEST_CASE( "GBT lost blocks are recovered by acknowledging the last block in sequence", "[gbt]") {
+    dlms::Cosem cosem{};
+    cosem.parameters.gbt_window_size = 3;
+    std::vector<uint8_t> received;
+    auto consumer = [&received](const uint8_t *data, size_t size) { received.insert(received.end(), data, data + size); };
+
+    REQUIRE (dlms::parse_gbt(cosem, gbt_block(0x43, 1, 0, {0x01}), consumer) == dlms::GbtStatus::RECEIVING);
+    REQUIRE (dlms::parse_gbt(cosem, gbt_block(0x83, 3, 0, {0x03}), consumer) == dlms::GbtStatus::WINDOW_COMPLETE);
+    REQUIRE (dlms::serialize_gbt_ack(cosem) == gbt_block(0x83, 1, 1, {}));
+
+    REQUIRE (dlms::parse_gbt(cosem, gbt_block(0x43, 2, 1, {0x02}), consumer) == dlms::GbtStatus::RECEIVING);
+    REQUIRE (dlms::parse_gbt(cosem, gbt_block(0x83, 3, 1, {0x03}), consumer) == dlms::GbtStatus::LAST_BLOCK);
+    REQUIRE (received == std::vector<uint8_t>{0x01, 0x02, 0x03});
+}
+
+TEST_CASE( "Large APDUs are split in GBT blocks", "[gbt]") {
+    dlms::Cosem cosem{};
+    cosem.parameters.gbt_window_size = 1;
+    cosem.context.max_pdu_size = 11;
+    cosem.context.gbt.peer_window = 2;
+
+    std::vector<uint8_t> apdu = {0x01, 0x02, 0x03, 0x04, 0x05};
+    REQUIRE (dlms::gbt_block_count(cosem, apdu) == 3);
+    auto blocks = dlms::serialize_gbt(cosem, apdu, 0);
+    REQUIRE (blocks.size() == 2);
+    REQUIRE (blocks[0] == gbt_block(0x41, 1, 0, {0x01, 0x02}));
+    REQUIRE (blocks[1] == gbt_block(0x01, 2, 0, {0x03, 0x04}));
+    blocks = dlms::serialize_gbt(cosem, apdu, 2);
+    REQUIRE (blocks.size() == 1);
+    REQUIRE (blocks[0] == gbt_block(0x81, 3, 0, {0x05}));
+}
+
+TEST_CASE( "Invoke-ids are allocated while outstanding and released by the response", "[invoke_id]") {
+    dlms::Cosem cosem{};
+
+    REQUIRE (dlms::allocate_invoke_id(cosem) == 2);
+    REQUIRE (dlms::allocate_invoke_id(cosem) == 3);
+    dlms::release_invoke_id(cosem, 2);
+    for (auto id = 4; id < 16; ++id) {
+        REQUIRE (dlms::allocate_invoke_id(cosem) == id);
+    }
+    REQUIRE (dlms::allocate_invoke_id(cosem) == 0);
+    REQUIRE (dlms::allocate_invoke_id(cosem) == 1);
+    REQUIRE (dlms::allocate_invoke_id(cosem) == 2);
+    REQUIRE_THROWS (dlms::allocate_invoke_id(cosem));
+
+    auto response = dlms::parse_get_response(cosem, {0xC4, 0x01, 0xC7, 0x00, 0x11, 0x01});
+    REQUIRE (response.invoke_id == 7);
+    REQUIRE (dlms::allocate_invoke_id(cosem) == 7);
+}
+
+TEST_CASE( "AARE result and negotiated max pdu size are parsed", "[parse_aare]") {
+    static std::vector<uint8_t> aare = {0x61, 0x29, 0xA1, 0x09, 0x06, 0x07, 0x60, 0x85, 0x74, 0x05, 0x08, 0x01, 0x01,
+                                        0xA2, 0x03, 0x02, 0x01, 0x00, 0xA3, 0x05, 0xA1, 0x03, 0x02, 0x01, 0x00, 0xBE,
+                                        0x10, 0x04, 0x0E, 0x08, 0x00, 0x06, 0x5F, 0x1F, 0x04, 0x00, 0x00, 0x10, 0x14,
+                                        0x00, 0xEF, 0x00, 0x07};
+    dlms::Cosem cosem{};
+
+    REQUIRE (dlms::parse_aare(cosem, aare) == dlms::AssociationResult::ACCEPTED);
+    REQUIRE (cosem.context.max_pdu_size == 0xEF);
+    REQUIRE_THROWS_AS (dlms::parse_aare(cosem, {0x60, 0x00}), dlms::InvalidCosemFrame);
+}
+
+TEST_CASE( "Request templates frame the same APDU as a serialized request", "[request_template]") {
+    std::array<uint8_t,12> from = {0x07, 0xE2, 0x09, 0x0F, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00};
+    std::array<uint8_t,12> to = {0x07, 0xE2, 0x09, 0x10, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00};
+    std::vector<uint8_t> range = {0x01, 0x02, 0x04, 0x02, 0x04, 0x12, 0x00, 0x08, 0x09, 0x06, 0x00, 0x00, 0x01, 0x00,
+                                  0x00, 0xFF, 0x0F, 0x02, 0x12, 0x00, 0x00, 0x09, 0x0C};
+    range.insert(range.end(), 12, 0x00);
+    range.insert(range.end(), {0x09, 0x0C});
+    range.insert(range.end(), 12, 0x00);
+    range.insert(range.end(), {0x01, 0x00});
+
+    auto request = dlms::Request{static_cast<dlms::ClassID>(7), {"1.0.99.1.0.255"}, 2, range};
+    dlms::RequestTemplate get{dlms::RequestType::GET, request};
+    REQUIRE (get.add_field(23, 12) == 0);
+    REQUIRE (get.add_field(37, 12) == 1);
+    REQUIRE_THROWS (get.add_field(40, 12));
+
+    std::copy(from.begin(), from.end(), request.data.begin() + 23);
+    std::copy(to.begin(), to.end(), request.data.begin() + 37);
+
+    for (auto security : {dlms::SecurityContext::NONE, dlms::SecurityContext::AUTHENTICATION_ENCRYPTION}) {
+        dlms::Cosem framed{}, serialized{};
+        for (auto cosem : {&framed, &serialized}) {
+            cosem->parameters.security = security;
+            cosem->parameters.system_title = {0x4D, 0x4D, 0x4D, 0x00, 0x00, 0xBC, 0x61, 0x4E};
+            cosem->parameters.guek = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F};
+            cosem->context.invocation_counter = 0x01234567;
+            cosem->context.invoke_id = 5;
+        }
+
+        std::vector<uint8_t> apdu;
+        get.serialize(framed, apdu, {from.data(), to.data()});
+        REQUIRE (apdu == dlms::serialize_get_request(serialized, request));
+        REQUIRE (framed.context.invocation_counter == serialized.context.invocation_counter);
+        REQUIRE_THROWS_AS (get.serialize(framed, {from.data()}), std::invalid_argument);
+    }
+
+    dlms::Cosem cosem{};
+    auto action = dlms::Request{dlms::ClassID::ASSOCIATION_LN, {"0.0.40.0.0.255"}, 1, {0x09, 0x01, 0x00}};
+    dlms::RequestTemplate act{dlms::RequestType::ACTION, action};
+    REQUIRE (act.serialize(cosem) == dlms::serialize_action_request(cosem, action));
+    dlms::RequestTemplate set{dlms::RequestType::SET, action};
+    REQUIRE (set.serialize(cosem) == dlms::serialize_set_request(cosem, action));
+}
+
+TEST_CASE( "Logical names are parsed into 6-byte values", "[logical_name]") {
+    using namespace dlms::literals;
+    constexpr auto energy = "1.0.1.8.0.255"_obis;
+    static_assert(energy.value() == 0x0100010800FFULL, "parsed at compile time");
+    static_assert(dlms::LogicalName{"0.0.40.0.0.255"} == dlms::LogicalName{0, 0, 40, 0, 0, 255}, "");
+
+    REQUIRE (std::vector<uint8_t>(energy.begin(), energy.end()) == std::vector<uint8_t>{1, 0, 1, 8, 0, 255});
+    REQUIRE (dlms::LogicalName{std::string{"1.0.1.8.0.255"}} == energy);
+    REQUIRE (dlms::LogicalName::from_value(energy.value()) == energy);
+    REQUIRE ("1.0.1.8.0.254"_obis < energy);
+    REQUIRE ("1.0.2.8.0.255"_obis != energy);
+
+    for (auto invalid : {"", "1.0.1.8.0", "1.0.1.8.0.255.1", "1.0.1.8.0.256", "1.0..8.0.255", "1.0.1.8.0.255.",
+                         "1.0.a.8.0.255", " 1.0.1.8.0.255"}) {
+        REQUIRE_THROWS_AS (dlms::LogicalName{std::string{invalid}}, std::runtime_error);
+    }
+    REQUIRE_THROWS_AS ((dlms::LogicalName{1, 0, 1, 8, 0}), std::runtime_error);
+
+    std::unordered_set<dlms::LogicalName> names{energy, "1.0.2.8.0.255"_obis, energy};
+    REQUIRE (names.size() == 2);
+    REQUIRE (names.count("1.0.2.8.0.255"_obis) == 1);
+}
+
+TEST_CASE( "OBIS code lists are parsed and formatted in bulk", "[logical_name]") {
+    using namespace dlms::literals;
+    std::string text = "1.0.1.8.0.255\r\n"
+                       "1-0:2.8.0*255\n"
+                       "\n"
+                       "0-0:96.1.0.255\n"
+                       "1.0.1.8.0.256\n"
+                       "1.0.1.8.0\n"
+                       "1-0.1.8.0.255\n"
+                       "1.0.1.8.0.255 \n"
+                       "1000.0.1.8.0.255\n"
+                       "255.255.255.255.255.255.255\n"
+                       "0.0.40.0.0.255";
+    std::vector<dlms::LogicalName> names;
+    auto errors = dlms::parse_logical_names(text.data(), text.size(), names);
+
+    REQUIRE (names == std::vector<dlms::LogicalName>{"1.0.1.8.0.255"_obis, "1.0.2.8.0.255"_obis, "0.0.96.1.0.255"_obis,
+                                                     "0.0.40.0.0.255"_obis});
+    REQUIRE (errors.size() == 6);
+    std::vector<size_t> lines;
+    for (auto const& error : errors) {
+        lines.push_back(error.line);
+    }
+    REQUIRE (lines == std::vector<size_t>{5, 6, 7, 8, 9, 10});
+
+    std::string dotted, obis;
+    dlms::format_logical_names(names.data(), names.size(), dotted);
+    dlms::format_logical_names(names.data(), names.size(), obis, dlms::ObisNotation::OBIS);
+    REQUIRE (dotted == "1.0.1.8.0.255\n1.0.2.8.0.255\n0.0.96.1.0.255\n0.0.40.0.0.255\n");
+    REQUIRE (obis == "1-0:1.8.0*255\n1-0:2.8.0*255\n0-0:96.1.0*255\n0-0:40.0.0*255\n");
+    REQUIRE (dlms::to_string("255.255.255.255.255.255"_obis) == "255.255.255.255.255.255");
+
+    std::vector<dlms::LogicalName> all;
+    for (uint64_t value = 0; value < 0x10000; value += 7) {
+        all.push_back(dlms::LogicalName::from_value(value * 0x0101010101ULL & 0xFFFFFFFFFFFFULL));
+    }
+    for (auto notation : {dlms::ObisNotation::DOTTED, dlms::ObisNotation::OBIS}) {
+        std::string formatted;
+        dlms::format_logical_names(all.data(), all.size(), formatted, notation);
+        std::vector<dlms::LogicalName> parsed;
+        REQUIRE (dlms::parse_logical_names(formatted.data(), formatted.size(), parsed).empty());
+        REQUIRE (parsed == all);
+    }
+}
+
+TEST_CASE( "Object registry finds the attributes of every registered object", "[object_registry]") {
+    std::vector<dlms::ObjectInfo> objects;
+    for (uint64_t i = 0; i < 5000; ++i) {
+        auto class_id = static_cast<dlms::ClassID>(i % 3 == 0 ? 1 : 3);
+        auto logical_name = dlms::LogicalName::from_value(0x010000000000ULL | i << 8U | 0xFF);
+        std::vector<dlms::AttributeInfo> attributes(1 + i % 4);
+        for (size_t a = 0; a < attributes.size(); ++a) {
+            attributes[a] = {dlms::DataType::UINT32, static_cast<int8_t>(-static_cast<int>(a)), static_cast<uint8_t>(i),
+                             dlms::AttributeAccess::READ_ONLY};
+        }
+        objects.push_back({class_id, logical_name, attributes});
+    }
+    dlms::ObjectRegistry registry{objects};
+    REQUIRE (registry.size() == objects.size());
+
+    for (auto const& object : objects) {
+        auto attributes = registry.find(object.class_id, object.logical_name);
+        REQUIRE (attributes.size == object.attributes.size());
+        REQUIRE (attributes.data[0].unit == object.attributes[0].unit);
+        auto last = registry.find(object.class_id, object.logical_name, static_cast<uint8_t>(attributes.size));
+        REQUIRE (last != nullptr);
+        REQUIRE (last->scaler == object.attributes.back().scaler);
+        REQUIRE (registry.find(object.class_id, object.logical_name, 0) == nullptr);
+        REQUIRE (registry.find(object.class_id, object.logical_name, static_cast<uint8_t>(attributes.size + 1)) == nullptr);
+    }
+    REQUIRE (registry.find(dlms::ClassID::CLOCK, objects[0].logical_name).size == 0);
+    REQUIRE (registry.find(objects[0].class_id, {"0.0.1.0.0.255"}).data == nullptr);
+
+    dlms::ObjectRegistry empty{{}};
+    REQUIRE (empty.find(dlms::ClassID::DATA, {"0.0.1.0.0.255"}).size == 0);
+
+    objects.push_back(objects[10]);
+    REQUIRE_THROWS_AS (dlms::ObjectRegistry{objects}, std::invalid_argument);
+    REQUIRE_THROWS_AS ((dlms::ObjectRegistry{{{dlms::ClassID::DATA, {"0.0.1.0.0.255"}, {}}}}), std::invalid_argument);
+}
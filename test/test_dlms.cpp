@@ -0,0 +1,205 @@
+#include "catch.hpp"
+#include "yadi/dlms.h"
+#include "yadi/parser.h"
+#include <deque>
+#include <stdexcept>
+#include <string>
+
+struct MockTransport {
+    std::vector<std::vector<uint8_t>> written;
+    std::deque<std::vector<uint8_t>> responses;
+
+    void write(std::vector<uint8_t> const& data) {
+        written.push_back(data);
+    }
+
+    std::vector<uint8_t> read() {
+        if (responses.empty()) {
+            throw std::runtime_error("timeout");
+        }
+        auto frame = responses.front();
+        responses.pop_front();
+        return frame;
+    }
+};
+
+static std::vector<uint8_t> wrap(std::vector<uint8_t> const& apdu) {
+    return dlms::wrapper::serialize(dlms::wrapper::WrapperParameters{}, apdu);
+}
+
+TEST_CASE( "Wrapper client reassembles a GBT response", "[gbt]") {
+    dlms::CosemWrapperClient<MockTransport> client;
+    client.cosem.parameters.gbt_window_size = 2;
+    MockTransport transport;
+    transport.responses = {
+        wrap({0xE0, 0x42, 0x00, 0x01, 0x00, 0x00, 0x03, 0xC4, 0x01, 0xC1}),
+        wrap({0xE0, 0x02, 0x00, 0x02, 0x00, 0x00, 0x01, 0x00}),
+        wrap({0xE0, 0x82, 0x00, 0x03, 0x00, 0x01, 0x03, 0x11, 0x22, 0x33}),
+    };
+
+    auto response = client.get_request(transport, {dlms::ClassID::DATA, {"0.0.96.1.0.255"}, 2, {}});
+
+    REQUIRE (response.result == dlms::DataAccessResult::SUCCESS);
+    REQUIRE (response.data == std::vector<uint8_t>{0x11, 0x22, 0x33});
+    REQUIRE (transport.written.size() == 2);
+    REQUIRE (transport.written[1] == wrap({0xE0, 0x82, 0x00, 0x01, 0x00, 0x02, 0x00}));
+}
+
+TEST_CASE( "Wrapper client streams the Data of a GBT response", "[gbt]") {
+    dlms::CosemWrapperClient<MockTransport> client;
+    client.cosem.parameters.gbt_window_size = 2;
+    MockTransport transport;
+    transport.responses = {
+        wrap({0xE0, 0x42, 0x00, 0x01, 0x00, 0x00, 0x03, 0xC4, 0x01, 0xC1}),
+        wrap({0xE0, 0x02, 0x00, 0x02, 0x00, 0x00, 0x02, 0x00, 0x11}),
+        wrap({0xE0, 0x82, 0x00, 0x03, 0x00, 0x01, 0x02, 0x22, 0x33}),
+    };
+
+    std::vector<std::vector<uint8_t>> blocks;
+    auto response = client.get_request(transport, {dlms::ClassID::DATA, {"0.0.96.1.0.255"}, 2, {}},
+                                       [&blocks](const uint8_t *data, size_t size) {
+                                           blocks.emplace_back(data, data + size);
+                                       });
+
+    REQUIRE (response.result == dlms::DataAccessResult::SUCCESS);
+    REQUIRE (blocks == std::vector<std::vector<uint8_t>>{{0x11}, {0x22, 0x33}});
+}
+
+TEST_CASE( "Wrapper client feeds a GBT response to a stream parser", "[gbt]") {
+    struct EventLog : dlms::DataHandler {
+        std::vector<std::string> events;
+
+        void begin_array(size_t count) override { events.push_back("array " + std::to_string(count)); }
+        void begin_structure(size_t count) override { events.push_back("structure " + std::to_string(count)); }
+        void value(dlms::DataType type, const uint8_t *bytes, size_t size) override {
+            auto event = std::to_string(static_cast<int>(type)) + ":" + std::to_string(size);
+            for (size_t i = 0; i < size; ++i) {
+                event += " " + std::to_string(bytes[i]);
+            }
+            events.push_back(event);
+        }
+        void end() override { events.push_back("end"); }
+    };
+
+    //an array of two {long-unsigned, octet-string} structures, with blocks ending inside values
+    dlms::CosemWrapperClient<MockTransport> client;
+    client.cosem.parameters.gbt_window_size = 2;
+    MockTransport transport;
+    transport.responses = {
+        wrap({0xE0, 0x42, 0x00, 0x01, 0x00, 0x00, 0x07, 0xC4, 0x01, 0xC1, 0x00, 0x01, 0x02, 0x02}),
+        wrap({0xE0, 0x02, 0x00, 0x02, 0x00, 0x00, 0x09, 0x02, 0x12, 0x00, 0x01, 0x09, 0x02, 0xAA, 0xBB, 0x02}),
+        wrap({0xE0, 0x82, 0x00, 0x03, 0x00, 0x02, 0x08, 0x02, 0x12, 0x00, 0x02, 0x09, 0x02, 0xCC, 0xDD}),
+    };
+
+    EventLog log;
+    dlms::StreamParser parser{log};
+    auto response = client.get_request(transport, {dlms::ClassID::DATA, {"0.0.96.1.0.255"}, 2, {}},
+                                       [&parser](const uint8_t *data, size_t size) {
+                                           parser.feed(data, size);
+                                       });
+
+    REQUIRE (response.result == dlms::DataAccessResult::SUCCESS);
+    REQUIRE (parser.complete());
+    REQUIRE (log.events == std::vector<std::string>{"array 2", "structure 2", "18:2 0 1", "9:2 170 187", "end",
+                                                    "structure 2", "18:2 0 2", "9:2 204 221", "end", "end"});
+}
+
+TEST_CASE( "Wrapper client sends a large request in windows of the server", "[gbt]") {
+    dlms::CosemWrapperClient<MockTransport> client;
+    client.cosem.parameters.gbt_window_size = 1;
+    client.cosem.context.max_pdu_size = 20;
+    dlms::Request request = {dlms::ClassID::DATA, {"0.0.96.1.0.255"}, 2, std::vector<uint8_t>(32, 0x11)};
+    dlms::Cosem plain{};
+    auto apdu = dlms::serialize_set_request(plain, request);
+    REQUIRE (apdu.size() == 45);
+
+    //the server announces a window of 2 in its first acknowledgement, then acknowledges each window
+    MockTransport transport;
+    transport.responses = {
+        wrap({0xE0, 0x82, 0x00, 0x01, 0x00, 0x01, 0x00}),
+        wrap({0xE0, 0x82, 0x00, 0x02, 0x00, 0x03, 0x00}),
+        wrap({0xC5, 0x01, 0xC1, 0x00}),
+    };
+
+    auto response = client.set_request(transport, request);
+
+    REQUIRE (response.result == dlms::DataAccessResult::SUCCESS);
+    REQUIRE (transport.responses.empty());
+    REQUIRE (transport.written.size() == 5);
+    std::vector<uint8_t> controls, sent;
+    for (size_t i = 0; i < transport.written.size(); ++i) {
+        auto const& block = transport.written[i];
+        REQUIRE (block[8] == 0xE0);
+        REQUIRE ((block[10] << 8 | block[11]) == static_cast<int>(i + 1));
+        controls.push_back(block[9]);
+        sent.insert(sent.end(), block.begin() + 15, block.end());
+    }
+    REQUIRE (controls == std::vector<uint8_t>{0x01, 0x41, 0x01, 0x41, 0x81});
+    REQUIRE (sent == apdu);
+}
+
+TEST_CASE( "Wrapper client matches pipelined responses by invoke-id", "[invoke_id]") {
+    dlms::CosemWrapperClient<MockTransport> client;
+    client.cosem.parameters.max_pending_requests = 2;
+    MockTransport transport;
+    transport.responses = {
+        wrap({0xC4, 0x01, 0xC3, 0x00, 0x11, 0x03}),
+        wrap({0xC4, 0x01, 0xC2, 0x00, 0x11, 0x02}),
+        wrap({0xC4, 0x01, 0xC4, 0x00, 0x11, 0x04}),
+    };
+
+    auto responses = client.get_requests(transport, {
+        {dlms::ClassID::DATA, {"0.0.96.1.0.255"}, 2, {}},
+        {dlms::ClassID::DATA, {"0.0.96.1.1.255"}, 2, {}},
+        {dlms::ClassID::DATA, {"0.0.96.1.2.255"}, 2, {}},
+    });
+
+    REQUIRE (transport.written.size() == 3);
+    REQUIRE (transport.written[0][8 + 2] == 0xC2);
+    REQUIRE (transport.written[1][8 + 2] == 0xC3);
+    REQUIRE (transport.written[2][8 + 2] == 0xC4);
+    REQUIRE (responses.size() == 3);
+    REQUIRE (responses[0].data == std::vector<uint8_t>{0x11, 0x02});
+    REQUIRE (responses[1].data == std::vector<uint8_t>{0x11, 0x03});
+    REQUIRE (responses[2].data == std::vector<uint8_t>{0x11, 0x04});
+    REQUIRE (client.cosem.context.pending_invoke_ids == 0);
+}
+
+TEST_CASE( "Wrapper client releases the invoke-ids of a failed pipeline", "[invoke_id]") {
+    dlms::CosemWrapperClient<MockTransport> client;
+    client.cosem.parameters.max_pending_requests = 16;
+    std::vector<dlms::Request> requests(16, {dlms::ClassID::DATA, {"0.0.96.1.0.255"}, 2, {}});
+    MockTransport transport;
+    transport.responses = {
+        wrap({0xC4, 0x01, 0xC2, 0x00, 0x11, 0x02}),
+    };
+
+    REQUIRE_THROWS_AS (client.get_requests(transport, requests), std::runtime_error);
+    REQUIRE (client.cosem.context.pending_invoke_ids == 0);
+
+    client.cosem.context.pending_invoke_ids = 0xFFFF;
+    dlms::serialize_aarq(client.cosem);
+    REQUIRE (client.cosem.context.pending_invoke_ids == 0);
+}
+
+TEST_CASE( "Wrapper client reassembles pipelined GBT responses", "[invoke_id]") {
+    dlms::CosemWrapperClient<MockTransport> client;
+    client.cosem.parameters.max_pending_requests = 2;
+    client.cosem.parameters.gbt_window_size = 2;
+    MockTransport transport;
+    transport.responses = {
+        wrap({0xE0, 0x42, 0x00, 0x01, 0x00, 0x00, 0x03, 0xC4, 0x01, 0xC3}),
+        wrap({0xE0, 0x82, 0x00, 0x02, 0x00, 0x00, 0x03, 0x00, 0x11, 0x03}),
+        wrap({0xC4, 0x01, 0xC2, 0x00, 0x11, 0x02}),
+    };
+
+    auto responses = client.get_requests(transport, {
+        {dlms::ClassID::DATA, {"0.0.96.1.0.255"}, 2, {}},
+        {dlms::ClassID::DATA, {"0.0.96.1.1.255"}, 2, {}},
+    });
+
+    REQUIRE (transport.written.size() == 2);
+    REQUIRE (responses[0].data == std::vector<uint8_t>{0x11, 0x02});
+    REQUIRE (responses[1].data == std::vector<uint8_t>{0x11, 0x03});
+    REQUIRE (client.cosem.context.pending_invoke_ids == 0);
+}
@@ -1,5 +1,8 @@
 #include "catch.hpp"
+#include "yadi/date_time.h"
 #include "yadi/parser.h"
+#include "yadi/profile.h"
+#include "yadi/tape.h"
 
 TEST_CASE( "Write size works correctly", "[write_size]") {
     std::vector<uint8_t> buffer;
@@ -67,3 +70,743 @@ TEST_CASE( "Strings are correctly packed in dlms_type", "[from_string]" ) {
         REQUIRE( dlms::from_string(str) == expected );
     }
 }
+
+TEST_CASE( "Scalar values are converted to strings and bytes", "[to_string]" ) {
+    REQUIRE (dlms::to_string({0x0A, 0x03, 'A', 'B', 'C'}) == "ABC");
+    REQUIRE (dlms::to_string({0x09, 0x02, '1', '2'}) == "12");
+    REQUIRE (dlms::to_string({0x06, 0x00, 0x01, 0x00, 0x00}) == "65536");
+    REQUIRE (dlms::to_string({0x10, 0xFF, 0xFE}) == "-2");
+    REQUIRE (dlms::to_string({0x02, 0x01, 0x11, 0x01}).empty());
+    REQUIRE_THROWS_AS (dlms::to_string({0x0A, 0x04, 'A', 'B', 'C'}), std::underflow_error);
+    REQUIRE_THROWS_AS (dlms::to_string({0x06, 0x00, 0x01}), std::underflow_error);
+
+    REQUIRE (dlms::to_bytes({0x09, 0x03, 0x01, 0x02, 0x03}) == std::vector<uint8_t>{0x01, 0x02, 0x03});
+    REQUIRE (dlms::to_bytes({0x04, 0x0A, 0xC0, 0x40}) == std::vector<uint8_t>{0xC0, 0x40});
+    REQUIRE (dlms::to_bytes({0x11, 0x01}).empty());
+}
+
+TEST_CASE( "Values of every data type are decoded into an arena", "[decode_value]" ) {
+    std::vector<uint8_t> buffer = {
+        0x01, 0x02,
+            0x02, 0x0E,
+                0x00,
+                0x03, 0x01,
+                0x04, 0x0C, 0xA5, 0xF0,
+                0x05, 0xFF, 0xFF, 0xFF, 0xFE,
+                0x06, 0x12, 0x34, 0x56, 0x78,
+                0x09, 0x02, 0xAB, 0xCD,
+                0x0A, 0x03, 'a', 'b', 'c',
+                0x0D, 0x42,
+                0x0F, 0x80,
+                0x14, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFD,
+                0x16, 0x1E,
+                0x17, 0x3F, 0xC0, 0x00, 0x00,
+                0x18, 0xC0, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                0x19, 0x07, 0xE2, 0x09, 0x0F, 0xFF, 0x0A, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00,
+            0x02, 0x00,
+        0x11, 0x07};
+    dlms::Arena arena{256};
+    size_t offset = 0;
+    auto const& root = dlms::decode_value(buffer, offset, arena);
+    REQUIRE (offset == buffer.size() - 2);
+    REQUIRE (root.type == dlms::DataType::ARRAY);
+    REQUIRE (root.size == 2);
+
+    auto const& s = root[0];
+    REQUIRE (s.type == dlms::DataType::STRUCTURE);
+    REQUIRE (s.size == 14);
+    REQUIRE (s[0].type == dlms::DataType::NULL_DATA);
+    REQUIRE (s[1].unsigned_integer == 1);
+    REQUIRE (s[2].size == 12);
+    REQUIRE (std::vector<uint8_t>(s[2].bytes, s[2].bytes + 2) == std::vector<uint8_t>{0xA5, 0xF0});
+    REQUIRE (s[3].integer == -2);
+    REQUIRE (s[4].unsigned_integer == 0x12345678);
+    REQUIRE (std::vector<uint8_t>(s[5].bytes, s[5].bytes + s[5].size) == std::vector<uint8_t>{0xAB, 0xCD});
+    REQUIRE (std::string(s[6].bytes, s[6].bytes + s[6].size) == "abc");
+    REQUIRE (s[7].unsigned_integer == 0x42);
+    REQUIRE (s[8].integer == -128);
+    REQUIRE (s[9].integer == -3);
+    REQUIRE (s[10].type == dlms::DataType::ENUM);
+    REQUIRE (s[10].unsigned_integer == 30);
+    REQUIRE (s[11].real == 1.5);
+    REQUIRE (s[12].real == -2.5);
+    REQUIRE (s[13].type == dlms::DataType::DATE_TIME);
+    REQUIRE (s[13].size == 12);
+    REQUIRE (s[13].bytes[1] == 0xE2);
+    REQUIRE ((s[13].bytes < buffer.data() || s[13].bytes >= buffer.data() + buffer.size()));
+    REQUIRE (root[1].size == 0);
+    REQUIRE (std::distance(root.begin(), root.end()) == 2);
+
+    auto capacity = arena.capacity();
+    for (auto i = 0; i < 10; ++i) {
+        arena.reset();
+        offset = 0;
+        dlms::decode_value(buffer, offset, arena);
+    }
+    REQUIRE (arena.capacity() == capacity);
+
+    offset = buffer.size() - 2;
+    auto const& last = dlms::decode_value(buffer.data(), buffer.size(), offset, arena);
+    REQUIRE (last.unsigned_integer == 7);
+
+    for (size_t size = 0; size + 2 < buffer.size(); ++size) {
+        offset = 0;
+        REQUIRE_THROWS_AS (dlms::decode_value(buffer.data(), size, offset, arena), std::underflow_error);
+    }
+    offset = 0;
+    REQUIRE_THROWS_AS (dlms::decode_value({0x08, 0x00}, offset, arena), std::invalid_argument);
+    std::vector<uint8_t> nested;
+    for (auto i = 0; i < 100; ++i) {
+        nested.insert(nested.end(), {0x02, 0x01});
+    }
+    nested.push_back(0x00);
+    offset = 0;
+    REQUIRE_THROWS_AS (dlms::decode_value(nested, offset, arena), std::invalid_argument);
+}
+
+TEST_CASE( "Data views pick fields without decoding the whole value", "[data_view]" ) {
+    std::vector<uint8_t> buffer = {0x01, 0x03};
+    for (uint8_t i = 0; i < 3; ++i) {
+        buffer.insert(buffer.end(), {0x02, 0x04,
+                                     0x09, 0x0C, 0x07, 0xE2, 0x09, 0x0F, 0xFF, i, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00,
+                                     0x0A, 0x02, 'e', static_cast<uint8_t>('0' + i),
+                                     0x02, 0x02, 0x10, 0xFF, static_cast<uint8_t>(0xF0 + i), 0x16, 0x1E,
+                                     0x06, 0x00, 0x00, 0x01, i});
+    }
+    buffer.push_back(0x03);
+    buffer.push_back(0x01);
+
+    dlms::DataView view{buffer};
+    REQUIRE (view.type() == dlms::DataType::ARRAY);
+    REQUIRE (view.size() == 3);
+
+    auto entry = view[2];
+    REQUIRE (entry.type() == dlms::DataType::STRUCTURE);
+    REQUIRE (entry.size() == 4);
+    REQUIRE (entry[0].size() == 12);
+    REQUIRE (entry[0].bytes()[5] == 2);
+    REQUIRE (entry[1].to_string() == "e2");
+    REQUIRE (entry[2][0].to_int64() == -14);
+    REQUIRE (entry[2][0].to_double() == -14.0);
+    REQUIRE (entry[2][1].to_uint64() == 30);
+    REQUIRE (entry[3].to_uint64() == 0x102);
+    REQUIRE_THROWS_AS (entry[2][0].to_uint64(), std::out_of_range);
+    REQUIRE_THROWS_AS (entry[1].to_int64(), std::invalid_argument);
+    REQUIRE_THROWS_AS (entry[4], std::out_of_range);
+    REQUIRE_THROWS_AS (entry[3].child(), std::invalid_argument);
+
+    auto field = view[0].child();
+    field.skip();
+    REQUIRE (field.to_string() == "e0");
+
+    view.skip();
+    REQUIRE (view.valid());
+    REQUIRE (view.to_bool());
+    view.skip();
+    REQUIRE (!view.valid());
+    REQUIRE_THROWS_AS (view.skip(), std::underflow_error);
+
+    dlms::Arena arena;
+    auto const& value = dlms::DataView{buffer}[1].to_value(arena);
+    REQUIRE (value.type == dlms::DataType::STRUCTURE);
+    REQUIRE (value[3].unsigned_integer == 0x101);
+
+    auto truncated = std::vector<uint8_t>(buffer.begin(), buffer.begin() + 40);
+    REQUIRE_THROWS_AS (dlms::DataView{truncated}[2], std::underflow_error);
+}
+
+namespace {
+
+struct EventLog : dlms::DataHandler {
+    std::vector<std::string> events;
+
+    void begin_array(size_t count) override { events.push_back("array " + std::to_string(count)); }
+    void begin_structure(size_t count) override { events.push_back("structure " + std::to_string(count)); }
+    void value(dlms::DataType type, const uint8_t *bytes, size_t size) override {
+        auto event = std::to_string(static_cast<int>(type)) + ":" + std::to_string(size);
+        for (size_t i = 0; i < (type == dlms::DataType::BIT_STRING ? (size + 7) / 8 : size); ++i) {
+            event += " " + std::to_string(bytes[i]);
+        }
+        events.push_back(event);
+    }
+    void end() override { events.push_back("end"); }
+};
+
+}
+
+TEST_CASE( "Stream parser keeps its state across blocks", "[stream_parser]" ) {
+    std::vector<uint8_t> stream = {0x01, 0x82, 0x01, 0x2C};
+    for (uint16_t i = 0; i < 300; ++i) {
+        stream.insert(stream.end(), {0x02, 0x05,
+                                     0x09, 0x0C, 0x07, 0xE2, 0x09, 0x0F, 0xFF, static_cast<uint8_t>(i), 0x00, 0x00, 0x00, 0x80, 0x00, 0x00,
+                                     0x12, static_cast<uint8_t>(i >> 8U), static_cast<uint8_t>(i),
+                                     0x04, 0x03, 0xE0,
+                                     0x01, 0x00,
+                                     0x00});
+    }
+    stream.insert(stream.end(), {0x0A, 0x81, 0x90});
+    stream.insert(stream.end(), 0x90, 'x');
+    stream.insert(stream.end(), {0x17, 0x3F, 0xC0, 0x00, 0x00, 0x16, 0x03});
+
+    EventLog whole;
+    dlms::StreamParser whole_parser{whole};
+    whole_parser.feed(stream.data(), stream.size());
+    REQUIRE (whole_parser.complete());
+    REQUIRE (whole.events.size() == 2 + 300 * 8 + 3);
+    REQUIRE (whole.events[1] == "structure 5");
+    REQUIRE (whole.events[3] == "18:2 0 0");
+    REQUIRE (whole.events[4] == "4:3 224");
+    REQUIRE (whole.events[5] == "array 0");
+    REQUIRE (whole.events[6] == "end");
+    REQUIRE (whole.events[7] == "0:0");
+    REQUIRE (whole.events[8] == "end");
+    REQUIRE (whole.events[300 * 8 + 1] == "end");
+    REQUIRE (whole.events.back() == "22:1 3");
+
+    for (size_t block_size : {1, 2, 3, 7, 13, 64, 500}) {
+        EventLog blocks;
+        dlms::StreamParser parser{blocks};
+        for (size_t offset = 0; offset < stream.size(); offset += block_size) {
+            parser.feed(stream.data() + offset, std::min(block_size, stream.size() - offset));
+            if (offset + block_size < 4 + 300 * 25) {
+                REQUIRE (!parser.complete());
+            }
+        }
+        REQUIRE (parser.complete());
+        REQUIRE (blocks.events == whole.events);
+    }
+
+    EventLog broken;
+    dlms::StreamParser parser{broken};
+    parser.feed(stream.data(), 10);
+    REQUIRE (!parser.complete());
+    parser.reset();
+    REQUIRE (parser.complete());
+    uint8_t unknown[] = {0x08, 0x00};
+    REQUIRE_THROWS_AS (parser.feed(unknown, sizeof(unknown)), std::invalid_argument);
+}
+
+TEST_CASE( "Profile buffers are decoded into columns", "[decode_profile]" ) {
+    auto row = [](std::vector<uint8_t> &buffer, uint8_t hour, uint8_t minute, int16_t value, uint8_t status) {
+        buffer.insert(buffer.end(), {0x02, 0x04,
+                                     0x09, 0x0C, 0x07, 0xE2, 0x09, 0x0F, 0x06, hour, minute, 0x00, 0x00, 0xFF, 0xC4, 0x00,
+                                     0x10, static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value),
+                                     0x17, 0x3F, 0xC0, 0x00, 0x00,
+                                     0x11, status});
+    };
+    std::vector<uint8_t> buffer = {0x01, 0x05};
+    row(buffer, 10, 0, -300, 0x08);
+    row(buffer, 10, 15, 1200, 0x00);
+    buffer.insert(buffer.end(), {0x02, 0x04, 0x00, 0x00, 0x00, 0x00});
+    buffer.insert(buffer.end(), {0x02, 0x04, 0x00, 0x10, 0x00, 0x05, 0x00, 0x11, 0x80});
+    row(buffer, 0xFF, 0, 7, 0x01);
+
+    dlms::ProfileColumns profile;
+    dlms::decode_profile(buffer, profile);
+    REQUIRE (profile.rows == 5);
+    REQUIRE (profile.columns.size() == 4);
+
+    //2018-09-15 10:00 local, one hour ahead of UTC
+    auto const& time = profile.columns[0];
+    REQUIRE (time.type == dlms::ColumnType::TIMESTAMP);
+    REQUIRE (time.integers == std::vector<int64_t>{1537002000, 1537002900, 1537003800, 1537004700, dlms::NO_TIMESTAMP});
+    REQUIRE (profile.columns[1].type == dlms::ColumnType::INT64);
+    REQUIRE (profile.columns[1].integers == std::vector<int64_t>{-300, 1200, 1200, 5, 7});
+    REQUIRE (profile.columns[2].reals == std::vector<double>{1.5, 1.5, 1.5, 1.5, 1.5});
+    REQUIRE (profile.columns[3].type == dlms::ColumnType::UINT8);
+    REQUIRE (profile.columns[3].bytes == std::vector<uint8_t>{0x08, 0x00, 0x00, 0x80, 0x01});
+
+    auto capacity = profile.columns[1].integers.capacity();
+    auto data = profile.columns[1].integers.data();
+    dlms::decode_profile(buffer, profile);
+    REQUIRE (profile.rows == 5);
+    REQUIRE (profile.columns[1].integers.capacity() == capacity);
+    REQUIRE (profile.columns[1].integers.data() == data);
+
+    auto mismatch = buffer;
+    mismatch[2 + 26 + 16] = 0x12;
+    REQUIRE_THROWS_AS (dlms::decode_profile(mismatch, profile), std::invalid_argument);
+    auto truncated = std::vector<uint8_t>(buffer.begin(), buffer.end() - 3);
+    REQUIRE_THROWS_AS (dlms::decode_profile(truncated, profile), std::underflow_error);
+    REQUIRE_THROWS_AS (dlms::decode_profile({0x01, 0x01, 0x02, 0x01, 0x00}, profile), std::invalid_argument);
+
+    dlms::decode_profile({0x01, 0x00}, profile);
+    REQUIRE (profile.rows == 0);
+    REQUIRE (profile.columns.empty());
+}
+
+namespace {
+
+struct RegisterReading {
+    uint32_t value;
+    std::tuple<int8_t, dlms::Enum> scaler_unit;
+};
+
+}
+
+TEST_CASE( "Values of known types are decoded and encoded through templates", "[codec]" ) {
+    static_assert(dlms::data_type_of<uint32_t> == dlms::DataType::UINT32, "");
+    static_assert(dlms::data_type_of<std::tuple<int8_t, dlms::Enum>> == dlms::DataType::STRUCTURE, "");
+    static_assert(dlms::data_type_of<std::vector<uint8_t>> == dlms::DataType::OCTET_STRING, "");
+    static_assert(dlms::data_type_of<std::vector<int16_t>> == dlms::DataType::ARRAY, "");
+
+    std::vector<uint8_t> buffer = {0x06, 0x00, 0x01, 0xE2, 0x40, 0x02, 0x02, 0x0F, 0xFD, 0x16, 0x1E};
+    auto reading = dlms::decode<uint32_t, std::tuple<int8_t, dlms::Enum>>(buffer);
+    REQUIRE (std::get<0>(reading) == 123456);
+    REQUIRE (std::get<0>(std::get<1>(reading)) == -3);
+    REQUIRE (std::get<1>(std::get<1>(reading)).value == 30);
+
+    auto aggregate = dlms::decode_as<RegisterReading, uint32_t, std::tuple<int8_t, dlms::Enum>>(buffer);
+    REQUIRE (aggregate.value == 123456);
+    REQUIRE (std::get<1>(aggregate.scaler_unit).value == 30);
+
+    REQUIRE (dlms::encode(std::get<0>(reading), std::get<1>(reading)) == buffer);
+
+    auto encoded = dlms::encode(true, int16_t{-2}, uint64_t{0x0102030405060708}, 1.5f, -2.5, std::string{"abc"},
+                                std::vector<uint8_t>{0xAA, 0xBB}, std::vector<int16_t>{1, -1});
+    REQUIRE (encoded == std::vector<uint8_t>{0x03, 0x01, 0x10, 0xFF, 0xFE, 0x15, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+                                             0x07, 0x08, 0x17, 0x3F, 0xC0, 0x00, 0x00, 0x18, 0xC0, 0x04, 0x00, 0x00,
+                                             0x00, 0x00, 0x00, 0x00, 0x0A, 0x03, 'a', 'b', 'c', 0x09, 0x02, 0xAA, 0xBB,
+                                             0x01, 0x02, 0x10, 0x00, 0x01, 0x10, 0xFF, 0xFF});
+    auto decoded = dlms::decode<bool, int16_t, uint64_t, float, double, std::string, std::vector<uint8_t>,
+                                std::vector<int16_t>>(encoded);
+    REQUIRE (std::get<0>(decoded));
+    REQUIRE (std::get<1>(decoded) == -2);
+    REQUIRE (std::get<2>(decoded) == 0x0102030405060708);
+    REQUIRE (std::get<3>(decoded) == 1.5f);
+    REQUIRE (std::get<4>(decoded) == -2.5);
+    REQUIRE (std::get<5>(decoded) == "abc");
+    REQUIRE (std::get<6>(decoded) == std::vector<uint8_t>{0xAA, 0xBB});
+    REQUIRE (std::get<7>(decoded) == std::vector<int16_t>{1, -1});
+
+    REQUIRE_THROWS_AS (dlms::decode<int32_t>(buffer), std::invalid_argument);
+    REQUIRE_THROWS_AS ((dlms::decode<uint32_t, std::tuple<int8_t>>(buffer)), std::invalid_argument);
+    REQUIRE_THROWS_AS (dlms::decode<uint32_t>({0x06, 0x00, 0x01}), std::underflow_error);
+    REQUIRE_THROWS_AS (dlms::decode<std::string>({0x0A, 0x05, 'a'}), std::underflow_error);
+}
+
+TEST_CASE( "Runs of big-endian values are converted in bulk", "[convert_big_endian]" ) {
+    std::vector<uint8_t> bytes(2000);
+    for (size_t i = 0; i < bytes.size(); ++i) {
+        bytes[i] = static_cast<uint8_t>(i * 37 + 11);
+    }
+    auto expected = [&](size_t offset, size_t width) {
+        uint64_t value = 0;
+        for (size_t b = 0; b < width; ++b) {
+            value = value << 8U | bytes[offset + b];
+        }
+        return value;
+    };
+
+    for (size_t count : {0, 1, 2, 3, 5, 17, 100}) {
+        for (size_t extra : {0, 1, 3}) {
+            std::vector<uint16_t> u16(count + 1, 0xAAAA);
+            std::vector<uint32_t> u32(count + 1, 0xAAAAAAAA);
+            std::vector<uint64_t> u64(count + 1, 0xAAAAAAAAAAAAAAAA);
+            std::vector<int64_t> i16(count + 1, 0x5555);
+            dlms::convert_big_endian(bytes.data(), 2 + extra, count, u16.data());
+            dlms::convert_big_endian(bytes.data(), 4 + extra, count, u32.data());
+            dlms::convert_big_endian(bytes.data(), 8 + extra, count, u64.data());
+            dlms::convert_big_endian(dlms::DataType::INT16, bytes.data(), 2 + extra, count, i16.data());
+            for (size_t i = 0; i < count; ++i) {
+                REQUIRE (u16[i] == expected(i * (2 + extra), 2));
+                REQUIRE (u32[i] == expected(i * (4 + extra), 4));
+                REQUIRE (u64[i] == expected(i * (8 + extra), 8));
+                REQUIRE (i16[i] == static_cast<int16_t>(expected(i * (2 + extra), 2)));
+            }
+            REQUIRE (u16[count] == 0xAAAA);
+            REQUIRE (u32[count] == 0xAAAAAAAA);
+            REQUIRE (u64[count] == 0xAAAAAAAAAAAAAAAA);
+            REQUIRE (i16[count] == 0x5555);
+        }
+    }
+
+    std::vector<int64_t> widened(3);
+    uint8_t int8s[] = {0x80, 0x7F, 0xFF};
+    dlms::convert_big_endian(dlms::DataType::INT8, int8s, 1, 3, widened.data());
+    REQUIRE (widened == std::vector<int64_t>{-128, 127, -1});
+    dlms::convert_big_endian(dlms::DataType::UINT8, int8s, 1, 3, widened.data());
+    REQUIRE (widened == std::vector<int64_t>{128, 127, 255});
+    REQUIRE_THROWS_AS (dlms::convert_big_endian(dlms::DataType::FLOAT32, int8s, 1, 3, widened.data()), std::invalid_argument);
+
+    std::vector<double> reals(1);
+    uint8_t float64[] = {0xC0, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    dlms::convert_big_endian(float64, 8, 1, reals.data());
+    REQUIRE (reals[0] == -2.5);
+
+    std::vector<int32_t> values(1000);
+    for (size_t i = 0; i < values.size(); ++i) {
+        values[i] = static_cast<int32_t>(i * 2654435761U);
+    }
+    auto encoded = dlms::encode(values);
+    REQUIRE (std::get<0>(dlms::decode<std::vector<int32_t>>(encoded)) == values);
+    encoded[encoded.size() - 5] = 0x06;
+    REQUIRE_THROWS_AS (dlms::decode<std::vector<int32_t>>(encoded), std::invalid_argument);
+}
+
+TEST_CASE( "Compact arrays are decoded and encoded", "[compact_array]" ) {
+    //2018-09-15 10:00 and 10:15 UTC, as an octet string, then UINT16 and INT8 fields
+    std::vector<uint8_t> buffer = {0x13, 0x02, 0x03, 0x09, 0x12, 0x0F, 0x20,
+                                   0x0C, 0x07, 0xE2, 0x09, 0x0F, 0x06, 0x0A, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                                   0x01, 0x2C, 0xFE,
+                                   0x0C, 0x07, 0xE2, 0x09, 0x0F, 0x06, 0x0A, 0x0F, 0x00, 0x00, 0x00, 0x00, 0x00,
+                                   0x04, 0xB0, 0x05};
+
+    dlms::ProfileColumns profile;
+    dlms::decode_profile(buffer, profile);
+    REQUIRE (profile.rows == 2);
+    REQUIRE (profile.columns.size() == 3);
+    REQUIRE (profile.columns[0].type == dlms::ColumnType::TIMESTAMP);
+    REQUIRE (profile.columns[0].integers == std::vector<int64_t>{1537005600, 1537006500});
+    REQUIRE (profile.columns[1].tag == dlms::DataType::UINT16);
+    REQUIRE (profile.columns[1].integers == std::vector<int64_t>{300, 1200});
+    REQUIRE (profile.columns[2].integers == std::vector<int64_t>{-2, 5});
+
+    std::vector<uint8_t> encoded;
+    dlms::encode_profile(profile, encoded, dlms::DataType::COMPACT_ARRAY);
+    REQUIRE (encoded == buffer);
+
+    dlms::Arena arena;
+    auto offset = size_t{0};
+    auto const& value = dlms::decode_value(buffer, offset, arena);
+    REQUIRE (offset == buffer.size());
+    REQUIRE (value.type == dlms::DataType::COMPACT_ARRAY);
+    REQUIRE (value.size == 2);
+    REQUIRE (value[1].type == dlms::DataType::STRUCTURE);
+    REQUIRE (value[1].size == 3);
+    REQUIRE (value[1][0].size == 12);
+    REQUIRE (value[1][0].bytes[6] == 0x0F);
+    REQUIRE (value[1][1].unsigned_integer == 1200);
+    REQUIRE (value[0][2].integer == -2);
+
+    dlms::DataView view{buffer};
+    view.skip();
+    REQUIRE (view.offset() == buffer.size());
+
+    offset = 0;
+    std::vector<uint8_t> nested = {0x02, 0x02, 0x13, 0x01, 0x00, 0x02, 0x11, 0x04, 0x05, 0x06, 0x07, 0x08, 0x11, 0x08};
+    auto const& arrays = dlms::decode_value(nested, offset, arena);
+    REQUIRE (offset == nested.size());
+    REQUIRE (arrays[0].size == 2);
+    REQUIRE (arrays[0][1].size == 2);
+    REQUIRE (arrays[0][1][1].unsigned_integer == 0x08);
+    REQUIRE (arrays[1].unsigned_integer == 0x08);
+
+    EventLog blocks;
+    dlms::StreamParser parser{blocks};
+    for (auto byte : nested) {
+        parser.feed(&byte, 1);
+    }
+    REQUIRE (parser.complete());
+    REQUIRE (blocks.events == std::vector<std::string>{"structure 2", "19:9 1 0 2 17 4 5 6 7 8", "17:1 8", "end"});
+
+    auto mismatch = buffer;
+    mismatch[6] = 0x06;
+    REQUIRE_THROWS_AS (dlms::decode_profile(mismatch, profile), std::invalid_argument);
+    offset = 0;
+    REQUIRE_THROWS_AS (dlms::decode_value(mismatch, offset, arena), std::invalid_argument);
+
+    //arrays of 3000 arrays of 3000 null data, one byte of contents
+    std::vector<uint8_t> expanding = {0x13, 0x02, 0x02, 0x01, 0x0B, 0xB8, 0x01, 0x0B, 0xB8, 0x00, 0x11, 0x01, 0x2A};
+    offset = 0;
+    REQUIRE_THROWS_AS (dlms::decode_value(expanding, offset, arena), std::invalid_argument);
+    dlms::DataView expanding_view{expanding};
+    REQUIRE_THROWS_AS (expanding_view.skip(), std::invalid_argument);
+    dlms::ProfileColumns no_columns;
+    std::vector<uint8_t> no_fields;
+    REQUIRE_THROWS_AS (dlms::encode_profile(no_columns, no_fields, dlms::DataType::COMPACT_ARRAY), std::invalid_argument);
+
+    auto truncated = std::vector<uint8_t>(buffer.begin(), buffer.end() - 1);
+    REQUIRE_THROWS_AS (dlms::decode_profile(truncated, profile), std::underflow_error);
+
+    dlms::ProfileColumns generated;
+    generated.rows = 1000;
+    generated.columns.resize(4);
+    generated.columns[0].type = dlms::ColumnType::TIMESTAMP;
+    generated.columns[0].tag = dlms::DataType::DATE_TIME;
+    generated.columns[1].tag = dlms::DataType::INT32;
+    generated.columns[2].type = dlms::ColumnType::DOUBLE;
+    generated.columns[2].tag = dlms::DataType::FLOAT32;
+    generated.columns[3].type = dlms::ColumnType::UINT8;
+    generated.columns[3].tag = dlms::DataType::ENUM;
+    for (int64_t i = 0; i < 1000; ++i) {
+        generated.columns[0].integers.push_back(i == 500 ? dlms::NO_TIMESTAMP : -86400 * 365 + i * 900);
+        generated.columns[1].integers.push_back((i - 500) * 100000);
+        generated.columns[2].reals.push_back(static_cast<double>(i) / 4);
+        generated.columns[3].bytes.push_back(static_cast<uint8_t>(i));
+    }
+    for (auto encoding : {dlms::DataType::ARRAY, dlms::DataType::COMPACT_ARRAY}) {
+        encoded.clear();
+        dlms::encode_profile(generated, encoded, encoding);
+        dlms::decode_profile(encoded, profile);
+        REQUIRE (profile.rows == 1000);
+        for (size_t i = 0; i < 4; ++i) {
+            REQUIRE (profile.columns[i].type == generated.columns[i].type);
+            REQUIRE (profile.columns[i].integers == generated.columns[i].integers);
+            REQUIRE (profile.columns[i].reals == generated.columns[i].reals);
+            REQUIRE (profile.columns[i].bytes == generated.columns[i].bytes);
+        }
+    }
+    REQUIRE (encoded.size() == 10 + 1000 * 21);
+
+    generated.columns[1].tag = dlms::DataType::FLOAT64;
+    REQUIRE_THROWS_AS (dlms::encode_profile(generated, encoded), std::invalid_argument);
+}
+
+TEST_CASE( "Date-times are converted to and from epoch nanoseconds", "[date_time]" ) {
+    //2018-09-15 10:00:00.50 local, one hour ahead of UTC, daylight saving
+    std::vector<uint8_t> date_time = {0x07, 0xE2, 0x09, 0x0F, 0x06, 0x0A, 0x00, 0x00, 0x32, 0xFF, 0xC4, 0x80};
+    REQUIRE (dlms::to_epoch_nanoseconds(date_time.data()) == 1537002000500000000);
+    auto encoded = dlms::from_epoch_nanoseconds(1537002000500000000, -60);
+    REQUIRE (std::vector<uint8_t>(encoded.begin(), encoded.end() - 1) == std::vector<uint8_t>(date_time.begin(), date_time.end() - 1));
+    REQUIRE (encoded.back() == 0x00);
+
+    auto unspecified = date_time;
+    unspecified[8] = 0xFF;
+    unspecified[9] = 0x80;
+    unspecified[10] = 0x00;
+    unspecified[11] = 0xFF;
+    REQUIRE (dlms::to_epoch_nanoseconds(unspecified.data()) == 1537005600000000000);
+
+    for (auto field : {0, 2, 3, 5, 6, 7}) {
+        auto wildcard = date_time;
+        wildcard[field] = 0xFF;
+        if (field == 0) {
+            wildcard[1] = 0xFF;
+        }
+        REQUIRE (dlms::to_epoch_nanoseconds(wildcard.data()) == dlms::NO_TIMESTAMP);
+    }
+    auto invalid = date_time;
+    invalid[11] = 0x81;
+    REQUIRE (dlms::to_epoch_nanoseconds(invalid.data()) == dlms::NO_TIMESTAMP);
+    auto out_of_range = dlms::from_epoch_nanoseconds(0);
+    out_of_range[0] = 0x09;
+    REQUIRE (dlms::to_epoch_nanoseconds(out_of_range.data()) == dlms::NO_TIMESTAMP);
+
+    auto wildcards = dlms::from_epoch_nanoseconds(dlms::NO_TIMESTAMP);
+    REQUIRE (wildcards == std::vector<uint8_t>{0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x80, 0x00, 0xFF});
+    REQUIRE (dlms::from_epoch_nanoseconds(0) == std::vector<uint8_t>{0x07, 0xB2, 0x01, 0x01, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00});
+    REQUIRE (dlms::from_epoch_nanoseconds(-10000000) == std::vector<uint8_t>{0x07, 0xB1, 0x0C, 0x1F, 0x03, 0x17, 0x3B, 0x3B, 0x63, 0x00, 0x00, 0x00});
+
+    std::vector<uint8_t> column;
+    std::vector<int64_t> instants;
+    for (int64_t i = 0; i < 500; ++i) {
+        instants.push_back(i == 7 ? dlms::NO_TIMESTAMP : (i - 250) * 86400 * 1000 * 1000 * 1000 * 97 + i * 10000000);
+        column.push_back(0x11);
+        auto bytes = dlms::from_epoch_nanoseconds(instants.back(), static_cast<int16_t>(i % 3 * 60 - 60));
+        column.insert(column.end(), bytes.begin(), bytes.end());
+    }
+    std::vector<int64_t> converted(500);
+    dlms::to_epoch_nanoseconds(column.data() + 1, 13, 500, converted.data());
+    REQUIRE (converted == instants);
+}
+
+TEST_CASE( "Value trees are encoded into a buffer sized once", "[encode_value]" ) {
+    std::vector<uint8_t> buffer = {
+        0x02, 0x18,
+            0x00,
+            0x01, 0x01, 0x11, 0x05,
+            0x03, 0x00,
+            0x04, 0x0C, 0xA5, 0xF0,
+            0x05, 0xFF, 0xFF, 0xFF, 0xFE,
+            0x06, 0x12, 0x34, 0x56, 0x78,
+            0x09, 0x82, 0x01, 0x2C,
+            0x0A, 0x03, 'a', 'b', 'c',
+            0x0C, 0x02, 0xC3, 0xA9,
+            0x0D, 0x42,
+            0x0F, 0x80,
+            0x10, 0xFF, 0x38,
+            0x11, 0xFF,
+            0x12, 0x01, 0x00,
+            0x13, 0x02, 0x02, 0x12, 0x01, 0x00, 0x02, 0x0F, 0x08, 0x00, 0x01, 0x05, 0x06, 0x00, 0x02, 0x07, 0x08,
+            0x14, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x15, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+            0x16, 0x03,
+            0x17, 0x3F, 0xC0, 0x00, 0x00,
+            0x18, 0xC0, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x19, 0x07, 0xE2, 0x09, 0x0F, 0xFF, 0x0A, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00,
+            0x1A, 0x07, 0xE2, 0x09, 0x0F, 0xFF,
+            0x1B, 0x0A, 0x00, 0x00, 0xFF,
+            0xFF};
+    buffer.insert(buffer.begin() + 27, 300, 0x5A);
+    dlms::Arena arena;
+    auto offset = size_t{0};
+    auto const& root = dlms::decode_value(buffer, offset, arena);
+    REQUIRE (root.size == 24);
+    REQUIRE (dlms::encoded_size(root) == buffer.size());
+    std::vector<uint8_t> encoded = {0xC4};
+    dlms::encode_value(root, encoded);
+    REQUIRE (encoded.size() == 1 + buffer.size());
+    REQUIRE (std::vector<uint8_t>(encoded.begin() + 1, encoded.end()) == buffer);
+
+    //special days table: index, date, day id
+    const uint8_t dates[2][5] = {{0x07, 0xE2, 0x0C, 0x19, 0xFF}, {0xFF, 0xFF, 0x01, 0x01, 0xFF}};
+    auto entries = arena.allocate<dlms::Value>(2);
+    dlms::Value *fields = nullptr;
+    dlms::Value *day_ids[2];
+    for (uint16_t i = 0; i < 2; ++i) {
+        fields = arena.allocate<dlms::Value>(3);
+        fields[0].type = dlms::DataType::UINT16;
+        fields[0].unsigned_integer = i + 1;
+        fields[1].type = dlms::DataType::OCTET_STRING;
+        fields[1].size = 5;
+        fields[1].bytes = dates[i];
+        fields[2].type = dlms::DataType::UINT8;
+        fields[2].unsigned_integer = 2;
+        day_ids[i] = &fields[2];
+        entries[i].type = dlms::DataType::STRUCTURE;
+        entries[i].size = 3;
+        entries[i].items = fields;
+    }
+    dlms::Value table;
+    table.type = dlms::DataType::ARRAY;
+    table.size = 2;
+    table.items = entries;
+    encoded.clear();
+    dlms::encode_value(table, encoded);
+    REQUIRE (encoded == std::vector<uint8_t>{0x01, 0x02,
+                                             0x02, 0x03, 0x12, 0x00, 0x01, 0x09, 0x05, 0x07, 0xE2, 0x0C, 0x19, 0xFF, 0x11, 0x02,
+                                             0x02, 0x03, 0x12, 0x00, 0x02, 0x09, 0x05, 0xFF, 0xFF, 0x01, 0x01, 0xFF, 0x11, 0x02});
+
+    table.type = dlms::DataType::COMPACT_ARRAY;
+    REQUIRE (dlms::encoded_size(table) == 1 + 5 + 1 + 2 * 9);
+    fields[2].type = dlms::DataType::INT8;
+    REQUIRE_THROWS_AS (dlms::encoded_size(table), std::invalid_argument);
+    //the decoder refuses elements that take no byte of the contents
+    day_ids[0]->type = day_ids[1]->type = dlms::DataType::NULL_DATA;
+    REQUIRE_THROWS_AS (dlms::encoded_size(table), std::invalid_argument);
+    day_ids[0]->type = day_ids[1]->type = dlms::DataType::UINT8;
+    table.type = dlms::DataType::ARRAY;
+    fields[1].type = dlms::DataType::DATE;
+    REQUIRE (dlms::encoded_size(table) == encoded.size() - 1);
+    fields[1].size = 4;
+    REQUIRE_THROWS_AS (dlms::encoded_size(table), std::invalid_argument);
+}
+
+TEST_CASE( "Buffers are indexed into a tape in one pass", "[tape]" ) {
+    std::vector<uint8_t> buffer = {
+        0x01, 0x03,
+            0x02, 0x02, 0x12, 0x00, 0x01, 0x09, 0x03, 0xAA, 0xBB, 0xCC,
+            0x02, 0x00,
+            0x01, 0x01, 0x02, 0x03, 0x04, 0x0A, 0xFF, 0xC0, 0x0F, 0xFE, 0x13, 0x02, 0x02, 0x11, 0x11, 0x04, 0x01, 0x02, 0x03, 0x04,
+        0x0A, 0x81, 0x90};
+    buffer.insert(buffer.end(), 0x90, 'x');
+    buffer.push_back(0x00);
+
+    dlms::Tape tape;
+    tape.index(buffer);
+    REQUIRE (tape.size() == 12);
+    REQUIRE (tape[0].type == dlms::DataType::ARRAY);
+    REQUIRE (tape[0].children == 3);
+    REQUIRE (tape[0].length == 34);
+    REQUIRE (tape[0].next == 10);
+    REQUIRE (tape.child(0, 0) == 1);
+    REQUIRE (tape.child(0, 1) == 4);
+    REQUIRE (tape.child(0, 2) == 5);
+    REQUIRE (tape.child(5, 0) == 6);
+    REQUIRE (tape[4].length == 2);
+    REQUIRE (tape[4].next == 5);
+    REQUIRE (tape[3].type == dlms::DataType::OCTET_STRING);
+    REQUIRE (tape[3].offset == 7);
+    REQUIRE (tape[3].header == 2);
+    REQUIRE (tape[3].length == 5);
+    REQUIRE (tape.contents(3)[2] == 0xCC);
+    REQUIRE (tape[7].type == dlms::DataType::BIT_STRING);
+    REQUIRE (tape[7].length == 4);
+    REQUIRE (tape[8].length == 2);
+    REQUIRE (tape[9].type == dlms::DataType::COMPACT_ARRAY);
+    REQUIRE (tape[9].header == 6);
+    REQUIRE (tape[9].length == 10);
+    REQUIRE (tape[9].children == 0);
+    REQUIRE (tape.contents(9)[3] == 0x04);
+    REQUIRE (tape[10].header == 3);
+    REQUIRE (tape[10].length == 3 + 0x90);
+    REQUIRE (tape[11].offset == buffer.size() - 1);
+    REQUIRE (tape[11].next == 12);
+    REQUIRE (tape.view(tape.child(1, 0)).to_uint64() == 1);
+    REQUIRE_THROWS_AS (tape.child(4, 0), std::out_of_range);
+
+    auto copy = std::vector<uint8_t>(tape.bytes(5), tape.bytes(5) + tape[5].length);
+    dlms::Arena arena;
+    auto offset = size_t{0};
+    auto const& value = dlms::decode_value(copy, offset, arena);
+    REQUIRE (offset == copy.size());
+    REQUIRE (value[0][2].size == 2);
+    REQUIRE (value[0][2][1][1].unsigned_integer == 0x04);
+
+    tape.index(buffer.data() + 2, 10);
+    REQUIRE (tape.size() == 3);
+    REQUIRE (tape[2].next == 3);
+    REQUIRE_THROWS_AS (tape.index(buffer.data(), 33), std::underflow_error);
+    REQUIRE_THROWS_AS (tape.index(buffer.data(), 2), std::underflow_error);
+    std::vector<uint8_t> unknown = {0x02, 0x01, 0x08};
+    REQUIRE_THROWS_AS (tape.index(unknown), std::invalid_argument);
+    std::vector<uint8_t> deep(2 * 40, 0x01);
+    REQUIRE_THROWS_AS (tape.index(deep), std::invalid_argument);
+}
+
+TEST_CASE( "Large profile buffers are decoded in parallel slices", "[decode_profile]" ) {
+    //nulls around the boundaries of the slices and through the whole buffer
+    auto rows = 20000;
+    std::vector<uint8_t> buffer = {0x01, 0x82, static_cast<uint8_t>(rows >> 8), static_cast<uint8_t>(rows)};
+    for (int64_t row = 0; row < rows; ++row) {
+        buffer.insert(buffer.end(), {0x02, 0x03});
+        for (int64_t i = 0; i < 3; ++i) {
+            if (row != 0 && ((row + i) % 7 == 0 || row % 5000 < 3)) {
+                buffer.push_back(0x00);
+            } else if (i == 0) {
+                auto date_time = dlms::from_epoch_nanoseconds((1537002000 + row * 900) * 1000000000, -60);
+                buffer.push_back(0x19);
+                buffer.insert(buffer.end(), date_time.begin(), date_time.end());
+            } else if (i == 1) {
+                auto value = static_cast<uint32_t>(row * 7);
+                buffer.insert(buffer.end(), {row == 12345 ? uint8_t{0x05} : uint8_t{0x06}, static_cast<uint8_t>(value >> 24),
+                                             static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value)});
+            } else {
+                auto value = dlms::encode(static_cast<double>(row) / 8);
+                buffer.insert(buffer.end(), value.begin(), value.end());
+            }
+        }
+    }
+
+    dlms::Tape tape;
+    tape.index(buffer);
+    dlms::ProfileColumns sequential;
+    REQUIRE_THROWS_AS (dlms::decode_profile(buffer, sequential), std::invalid_argument);
+    dlms::ProfileColumns parallel;
+    REQUIRE_THROWS_AS (dlms::decode_profile(tape, 0, parallel, 4), std::invalid_argument);
+    REQUIRE (parallel.rows == 0);
+
+    auto row = tape.child(0, 12345);
+    buffer[tape[row + 2].offset] = 0x06;
+    tape.index(buffer);
+    dlms::decode_profile(buffer, sequential);
+    REQUIRE (sequential.rows == 20000);
+    REQUIRE (sequential.columns[0].integers[5001] == 1537002000 + 5001 * 900);
+    for (unsigned threads : {0, 1, 3, 4}) {
+        dlms::decode_profile(tape, 0, parallel, threads);
+        REQUIRE (parallel.rows == 20000);
+        for (size_t i = 0; i < 3; ++i) {
+            REQUIRE (parallel.columns[i].tag == sequential.columns[i].tag);
+            REQUIRE (parallel.columns[i].integers == sequential.columns[i].integers);
+            REQUIRE (parallel.columns[i].reals == sequential.columns[i].reals);
+        }
+    }
+
+    std::vector<uint8_t> compact;
+    dlms::encode_profile(sequential, compact, dlms::DataType::COMPACT_ARRAY);
+    compact.insert(compact.begin(), {0x02, 0x02, 0x11, 0x01});
+    tape.index(compact);
+    dlms::decode_profile(tape, 2, parallel, 4);
+    REQUIRE (parallel.rows == 20000);
+    for (size_t i = 0; i < 3; ++i) {
+        REQUIRE (parallel.columns[i].integers == sequential.columns[i].integers);
+        REQUIRE (parallel.columns[i].reals == sequential.columns[i].reals);
+    }
+
+    REQUIRE_THROWS_AS (dlms::decode_profile(tape, 1, parallel), std::invalid_argument);
+    REQUIRE_THROWS_AS (dlms::decode_profile(tape, 3, parallel), std::out_of_range);
+    std::vector<uint8_t> leading_null = {0x01, 0x02, 0x02, 0x01, 0x00, 0x02, 0x01, 0x11, 0x01};
+    tape.index(leading_null);
+    REQUIRE_THROWS_AS (dlms::decode_profile(tape, 0, parallel), std::invalid_argument);
+}
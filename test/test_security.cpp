@@ -0,0 +1,593 @@
+#include "catch.hpp"
+#include "yadi/gcm.h"
+#include "yadi/cosem.h"
+#include "yadi/counter_store.h"
+#include "yadi/key_store.h"
+#include "security.h"
+#include "hash.h"
+#include "random.h"
+#include <string>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+static std::vector<uint8_t> hex(std::string const& str) {
+    std::vector<uint8_t> bytes;
+    for (size_t i = 0; i + 1 < str.size(); i += 2) {
+        bytes.push_back(static_cast<uint8_t>(std::stoul(str.substr(i, 2), nullptr, 16)));
+    }
+    return bytes;
+}
+
+static std::array<uint8_t,16> key(std::string const& str) {
+    std::array<uint8_t,16> k{};
+    auto bytes = hex(str);
+    std::copy(bytes.begin(), bytes.end(), k.begin());
+    return k;
+}
+
+TEST_CASE( "AES-GCM matches the reference test vectors", "[gcm]") {
+    struct Vector { std::string key, iv, aad, plain, cipher, tag; };
+    std::vector<Vector> vectors = {
+        {"00000000000000000000000000000000", "000000000000000000000000", "", "", "",
+         "58e2fccefa7e3061367f1d57a4e7455a"},
+        {"00000000000000000000000000000000", "000000000000000000000000", "", "00000000000000000000000000000000",
+         "0388dace60b6a392f328c2b971b2fe78", "ab6e47d42cec13bdf53a67b21257bddf"},
+        {"feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888", "",
+         "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255",
+         "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985",
+         "4d5c2af327cd64a62cf35abd2ba6fab4"},
+        {"feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888", "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+         "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+         "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091",
+         "5bc94fbc3221a5db94fae95ae7121a47"},
+    };
+
+    for (auto hardware : {false, true}) {
+        for (auto const& v : vectors) {
+            dlms::Gcm gcm{key(v.key), hardware};
+            auto iv = hex(v.iv);
+            auto aad = hex(v.aad);
+            auto data = hex(v.plain);
+            uint8_t tag[16];
+
+            gcm.encrypt(iv.data(), aad.data(), aad.size(), data.data(), data.size(), tag, sizeof(tag));
+            REQUIRE (data == hex(v.cipher));
+            REQUIRE (std::vector<uint8_t>(tag, tag + 16) == hex(v.tag));
+
+            REQUIRE (gcm.decrypt(iv.data(), aad.data(), aad.size(), data.data(), data.size(), tag, 12));
+            REQUIRE (data == hex(v.plain));
+
+            tag[0] ^= 0x01;
+            REQUIRE_FALSE (gcm.decrypt(iv.data(), aad.data(), aad.size(), data.data(), data.size(), tag, 12));
+        }
+    }
+}
+
+TEST_CASE( "APDUs are glo-ciphered as in the Green Book example", "[cipher]") {
+    dlms::Cosem cosem{};
+    cosem.parameters.security = dlms::SecurityContext::AUTHENTICATION_ENCRYPTION;
+    cosem.parameters.system_title = {0x4D, 0x4D, 0x4D, 0x00, 0x00, 0xBC, 0x61, 0x4E};
+    cosem.parameters.guek = key("000102030405060708090A0B0C0D0E0F");
+    cosem.parameters.ak = key("D0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF");
+    cosem.context.invocation_counter = 0x01234567;
+
+    auto plain = hex("C0010000080000010000FF0200");
+    auto apdu = plain;
+    dlms::Security::cipher(cosem, 0xC8, apdu);
+
+    REQUIRE (apdu == hex("C81E3001234567411312FF935A47566827C467BC7D825C3BE4A77C3FCC056B6B"));
+    REQUIRE (cosem.context.invocation_counter == 0x01234568);
+
+    cosem.context.server_system_title = cosem.parameters.system_title;
+    dlms::Security::decipher(cosem, apdu);
+    REQUIRE (apdu == plain);
+
+    dlms::Security::cipher(cosem, 0xC8, apdu);
+    apdu[10] ^= 0x01;
+    REQUIRE_THROWS_AS (dlms::Security::decipher(cosem, apdu), dlms::CosemAuthenticationError);
+}
+
+TEST_CASE( "Streamed ciphered responses reach the consumer once authenticated", "[cipher]") {
+    dlms::Cosem cosem{};
+    cosem.parameters.security = dlms::SecurityContext::AUTHENTICATION_ENCRYPTION;
+    cosem.parameters.system_title = {0x4D, 0x4D, 0x4D, 0x00, 0x00, 0xBC, 0x61, 0x4E};
+    cosem.parameters.guek = key("000102030405060708090A0B0C0D0E0F");
+    cosem.parameters.ak = key("D0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF");
+    cosem.context.server_system_title = cosem.parameters.system_title;
+
+    auto apdu = hex("C40181000906313233343536");
+    dlms::Security::cipher(cosem, 0xCC, apdu);
+
+    std::vector<uint8_t> data;
+    dlms::GetResponseStream stream{cosem, [&data](const uint8_t *bytes, size_t size) {
+        data.insert(data.end(), bytes, bytes + size);
+    }};
+    stream(apdu.data(), 10);
+    stream(apdu.data() + 10, apdu.size() - 10);
+    REQUIRE (data.empty());
+    auto response = stream.finish();
+    REQUIRE (response.result == dlms::DataAccessResult::SUCCESS);
+    REQUIRE (response.invoke_id == 1);
+    REQUIRE (data == hex("0906313233343536"));
+}
+
+TEST_CASE( "Authenticated only APDUs are sent in clear with a tag", "[cipher]") {
+    dlms::Cosem cosem{};
+    cosem.parameters.security = dlms::SecurityContext::AUTHENTICATION;
+    cosem.parameters.guek = key("000102030405060708090A0B0C0D0E0F");
+    cosem.parameters.ak = key("D0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF");
+
+    auto plain = hex("C0010000080000010000FF0200");
+    auto apdu = plain;
+    dlms::Security::cipher(cosem, 0xC8, apdu);
+
+    REQUIRE (apdu.size() == 2 + 5 + plain.size() + 12);
+    REQUIRE (std::vector<uint8_t>(apdu.begin() + 7, apdu.begin() + 7 + plain.size()) == plain);
+    dlms::Security::decipher(cosem, apdu);
+    REQUIRE (apdu == plain);
+}
+
+TEST_CASE( "AARQ carries a fresh dedicated key in a ciphered InitiateRequest", "[cipher]") {
+    dlms::Cosem cosem{};
+    cosem.parameters.security = dlms::SecurityContext::AUTHENTICATION_ENCRYPTION;
+    cosem.parameters.dedicated_key = true;
+    cosem.parameters.system_title = {0x4D, 0x4D, 0x4D, 0x00, 0x00, 0xBC, 0x61, 0x4E};
+    cosem.parameters.guek = key("000102030405060708090A0B0C0D0E0F");
+    cosem.parameters.ak = key("D0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF");
+
+    auto aarq = dlms::serialize_aarq(cosem);
+    REQUIRE (cosem.context.glo_cipher.keyed());
+    REQUIRE (cosem.context.ded_cipher.keyed());
+
+    auto user_information = std::find(aarq.begin(), aarq.end(), 0xBE);
+    REQUIRE (user_information != aarq.end());
+    auto initiate_request = std::vector<uint8_t>(user_information + 4, aarq.end());
+    REQUIRE (initiate_request[0] == 0x21);
+
+    cosem.context.server_system_title = cosem.parameters.system_title;
+    dlms::Security::decipher(cosem, initiate_request);
+    REQUIRE (initiate_request[0] == 0x01);
+    REQUIRE (initiate_request[1] == 0x01);
+    REQUIRE (initiate_request[2] == 0x10);
+    REQUIRE (std::equal(cosem.context.dek.begin(), cosem.context.dek.end(), initiate_request.begin() + 3));
+
+    auto get = dlms::serialize_get_request(cosem, {dlms::ClassID::DATA, {"1.0.1.8.0.255"}, 2, {}});
+    REQUIRE (get[0] == 0xD0);
+    dlms::Security::decipher(cosem, get);
+    REQUIRE (get[0] == 0xC0);
+}
+
+TEST_CASE( "HLS-GMAC pass 3 and pass 4 are exchanged", "[hls]") {
+    std::array<uint8_t,8> client_title = {0x4D, 0x4D, 0x4D, 0x00, 0x00, 0xBC, 0x61, 0x4E};
+    std::array<uint8_t,8> server_title = {0x4D, 0x4D, 0x4D, 0x00, 0x00, 0x00, 0x00, 0x01};
+    std::vector<uint8_t> stoc = {0x50, 0x36, 0x77, 0x52, 0x4A, 0x32, 0x31, 0x46};
+
+    dlms::Cosem client{};
+    client.parameters.authentication = dlms::AuthenticationMechanism::HLS_GMAC;
+    client.parameters.system_title = client_title;
+    client.parameters.guek = key("000102030405060708090A0B0C0D0E0F");
+    client.parameters.ak = key("D0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF");
+
+    dlms::Cosem server{};
+    server.parameters.authentication = dlms::AuthenticationMechanism::HLS_GMAC;
+    server.parameters.system_title = server_title;
+    server.parameters.guek = client.parameters.guek;
+    server.parameters.ak = client.parameters.ak;
+    server.context.server_system_title = client_title;
+    server.context.client_challenger = stoc;
+
+    dlms::serialize_aarq(client);
+    REQUIRE (client.context.client_challenger.size() == 8);
+
+    std::vector<uint8_t> aare = {0x61, 0x22, 0xA2, 0x03, 0x02, 0x01, 0x00, 0xA4, 0x0A, 0x04, 0x08};
+    aare.insert(aare.end(), server_title.begin(), server_title.end());
+    aare.insert(aare.end(), {0xAA, 0x0A, 0x80, 0x08});
+    aare.insert(aare.end(), stoc.begin(), stoc.end());
+    aare.insert(aare.end(), {0xBE, 0x02, 0x04, 0x00});
+    aare[1] = static_cast<uint8_t>(aare.size() - 2);
+    REQUIRE (dlms::parse_aare(client, aare) == dlms::AssociationResult::ACCEPTED);
+    REQUIRE (client.context.server_challenger == stoc);
+
+    auto pass3 = dlms::serialize_reply_to_hls_authentication(client);
+    auto header = hex("C301C1000F0000280000FF01010911");
+    REQUIRE (std::equal(header.begin(), header.end(), pass3.begin()));
+    REQUIRE (dlms::Security::verify_challenger(server, std::vector<uint8_t>(pass3.begin() + header.size(), pass3.end())));
+
+    server.context.server_challenger = client.context.client_challenger;
+    auto f_ctos = dlms::Security::process_challenger(server);
+    auto pass4 = hex("C701C10001000911");
+    pass4.insert(pass4.end(), f_ctos.begin(), f_ctos.end());
+    REQUIRE (dlms::parse_reply_to_hls_authentication(client, pass4));
+
+    pass4.back() ^= 0x01;
+    REQUIRE_FALSE (dlms::parse_reply_to_hls_authentication(client, pass4));
+}
+
+TEST_CASE( "MD5, SHA-1 and SHA-256 match the reference digests", "[hash]") {
+    std::string abc = "abc";
+    std::string two_blocks = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    std::string long_message(1000, 'a');
+    struct Vector { dlms::HashAlgorithm algorithm; std::string empty, abc, two_blocks, long_message; };
+    std::vector<Vector> vectors = {
+        {dlms::HashAlgorithm::MD5, "d41d8cd98f00b204e9800998ecf8427e", "900150983cd24fb0d6963f7d28e17f72",
+         "8215ef0796a20bcaaae116d3876c664a", "cabe45dcc9ae5b66ba86600cca6b8ba8"},
+        {dlms::HashAlgorithm::SHA1, "da39a3ee5e6b4b0d3255bfef95601890afd80709", "a9993e364706816aba3e25717850c26c9cd0d89d",
+         "84983e441c3bd26ebaae4aa1f95129e5e54670f1", "291e9a6c66994949b57ba5e650361e98fc36b1ba"},
+        {dlms::HashAlgorithm::SHA256, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+         "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+         "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+         "41edece42d63e8d9bf515a9ba6932e1c20cbc9f5a5d134645adb5db1b9737ea3"},
+    };
+
+    //without hardware, hash runs the portable code and four copies in hash_many run the SIMD lanes
+    for (auto hardware : {false, true}) {
+        for (auto const& v : vectors) {
+            auto size = dlms::digest_size(v.algorithm);
+            auto digest = [&](std::string const& message, size_t copies) {
+                std::vector<std::vector<uint8_t>> out(copies, std::vector<uint8_t>(size));
+                std::vector<dlms::HashJob> jobs;
+                for (auto &o : out) {
+                    jobs.push_back({reinterpret_cast<const uint8_t*>(message.data()), message.size(), o.data()});
+                }
+                if (copies == 1) {
+                    dlms::hash(v.algorithm, jobs[0].data, jobs[0].size, jobs[0].digest, hardware);
+                } else {
+                    dlms::hash_many(v.algorithm, jobs.data(), jobs.size(), hardware);
+                }
+                for (auto const& o : out) {
+                    REQUIRE (o == out[0]);
+                }
+                return out[0];
+            };
+            for (size_t copies : {1, 4}) {
+                REQUIRE (digest("", copies) == hex(v.empty));
+                REQUIRE (digest(abc, copies) == hex(v.abc));
+                REQUIRE (digest(two_blocks, copies) == hex(v.two_blocks));
+                REQUIRE (digest(long_message, copies) == hex(v.long_message));
+            }
+        }
+    }
+}
+
+TEST_CASE( "Batched hashing matches one message at a time", "[hash]") {
+    std::vector<uint8_t> data(300);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<uint8_t>(i * 7 + 3);
+    }
+
+    for (auto hardware : {false, true}) {
+        for (auto algorithm : {dlms::HashAlgorithm::MD5, dlms::HashAlgorithm::SHA1, dlms::HashAlgorithm::SHA256}) {
+            auto size = dlms::digest_size(algorithm);
+            std::vector<std::vector<uint8_t>> digests;
+            std::vector<dlms::HashJob> jobs;
+            for (size_t length = 0; length < 140; ++length) {
+                digests.emplace_back(size);
+            }
+            for (size_t length = 0; length < 140; ++length) {
+                jobs.push_back({data.data() + length, length, digests[length].data()});
+            }
+            dlms::hash_many(algorithm, jobs.data(), jobs.size(), hardware);
+
+            for (size_t length = 0; length < 140; ++length) {
+                std::vector<uint8_t> expected(size);
+                dlms::hash(algorithm, data.data() + length, length, expected.data(), false);
+                REQUIRE (digests[length] == expected);
+            }
+        }
+    }
+}
+
+TEST_CASE( "HLS-MD5 and HLS-SHA256 answer and verify the challenges", "[hls]") {
+    std::array<uint8_t,8> client_title = {0x4D, 0x4D, 0x4D, 0x00, 0x00, 0xBC, 0x61, 0x4E};
+    std::array<uint8_t,8> server_title = {0x4D, 0x4D, 0x4D, 0x00, 0x00, 0x00, 0x00, 0x01};
+    std::vector<uint8_t> stoc = {0x50, 0x36, 0x77, 0x52, 0x4A, 0x32, 0x31, 0x46};
+    std::vector<uint8_t> ctos = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08};
+    std::vector<uint8_t> secret = {0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38};
+
+    auto make = [&](dlms::AuthenticationMechanism mechanism, bool client) {
+        dlms::Cosem cosem{};
+        cosem.parameters.authentication = mechanism;
+        cosem.parameters.secret = secret;
+        cosem.parameters.system_title = client ? client_title : server_title;
+        cosem.context.server_system_title = client ? server_title : client_title;
+        cosem.context.client_challenger = client ? ctos : stoc;
+        cosem.context.server_challenger = client ? stoc : ctos;
+        return cosem;
+    };
+
+    auto md5 = make(dlms::AuthenticationMechanism::HLS_MD5, true);
+    REQUIRE (dlms::Security::process_challenger(md5) == hex("53d4537e37dab4ff089629e25557af9f"));
+
+    auto sha256 = make(dlms::AuthenticationMechanism::HLS_SHA256, true);
+    REQUIRE (dlms::Security::process_challenger(sha256) == hex("d67d3bd535931be8193d4acde66ed3f283cfbecd0205d13109cffecbbf3ac012"));
+
+    //the server needs the client system title to check f(CtoS)
+    auto aarq = dlms::serialize_aarq(sha256);
+    std::vector<uint8_t> calling_ap_title = {0xA6, 0x0A, 0x06, 0x08};
+    calling_ap_title.insert(calling_ap_title.end(), client_title.begin(), client_title.end());
+    REQUIRE (std::search(aarq.begin(), aarq.end(), calling_ap_title.begin(), calling_ap_title.end()) != aarq.end());
+
+    for (auto mechanism : {dlms::AuthenticationMechanism::HLS_MD5, dlms::AuthenticationMechanism::HLS_SHA1,
+                           dlms::AuthenticationMechanism::HLS_SHA256}) {
+        auto client = make(mechanism, true);
+        auto server = make(mechanism, false);
+        auto f_ctos = dlms::Security::process_challenger(server);
+        REQUIRE (dlms::Security::verify_challenger(client, f_ctos));
+        f_ctos[0] ^= 0x01;
+        REQUIRE_FALSE (dlms::Security::verify_challenger(client, f_ctos));
+    }
+
+    std::vector<dlms::Cosem> sessions;
+    for (auto i = 0; i < 6; ++i) {
+        sessions.push_back(make(i % 2 ? dlms::AuthenticationMechanism::HLS_MD5 : dlms::AuthenticationMechanism::HLS_SHA256, true));
+        sessions.back().context.server_challenger[0] = static_cast<uint8_t>(i);
+    }
+    sessions.push_back(make(dlms::AuthenticationMechanism::LLS, true));
+    std::vector<dlms::Cosem*> pointers;
+    for (auto &session : sessions) {
+        pointers.push_back(&session);
+    }
+    auto answers = dlms::Security::process_challengers(pointers);
+    REQUIRE (answers.size() == sessions.size());
+    for (size_t i = 0; i + 1 < sessions.size(); ++i) {
+        REQUIRE (answers[i] == dlms::Security::process_challenger(sessions[i]));
+    }
+    REQUIRE (answers.back().empty());
+    auto requests = dlms::serialize_reply_to_hls_authentication(pointers);
+    REQUIRE (requests.size() == sessions.size());
+    REQUIRE (requests.back().empty());
+}
+
+TEST_CASE( "ChaCha20 matches the RFC 8439 block test vector", "[random]") {
+    uint32_t key[8];
+    for (uint32_t i = 0; i < 8; ++i) {
+        key[i] = (4 * i) | (4 * i + 1) << 8U | (4 * i + 2) << 16U | (4 * i + 3) << 24U;
+    }
+    uint32_t nonce[3] = {0x09000000, 0x4a000000, 0x00000000};
+    std::vector<uint8_t> block(64);
+    dlms::chacha20_block(key, 1, nonce, block.data());
+    REQUIRE (block == hex("10f1e7e4d13b5915500fdd1fa32071c4c7d1f4c733c068030422aa9ac3d46c4e"
+                          "d2826446079faa0914c2d705d98b02a2b5129cd1de164eb9cbd083e8a2503c4e"));
+
+    std::vector<uint8_t> first(1000), second(1000);
+    dlms::random_bytes(first.data(), first.size());
+    dlms::random_bytes(second.data(), second.size());
+    REQUIRE (first != second);
+
+    //a forked child must not hand out the bytes its parent has buffered
+    int fds[2];
+    REQUIRE (::pipe(fds) == 0);
+    auto pid = ::fork();
+    REQUIRE (pid >= 0);
+    if (pid == 0) {
+        dlms::random_bytes(first.data(), first.size());
+        auto written = ::write(fds[1], first.data(), first.size());
+        ::_exit(written == static_cast<ssize_t>(first.size()) ? 0 : 1);
+    }
+    std::vector<uint8_t> child(1000);
+    size_t received = 0;
+    while (received < child.size()) {
+        auto n = ::read(fds[0], child.data() + received, child.size() - received);
+        REQUIRE (n > 0);
+        received += static_cast<size_t>(n);
+    }
+    int status = 0;
+    ::waitpid(pid, &status, 0);
+    ::close(fds[0]);
+    ::close(fds[1]);
+    dlms::random_bytes(first.data(), first.size());
+    REQUIRE (first != child);
+}
+
+TEST_CASE( "Sessions sharing a system title draw distinct, persistent invocation counters", "[counter]") {
+    std::string path = "yadi_test_counters.bin";
+    std::remove(path.c_str());
+    std::array<uint8_t,8> title = {0x4D, 0x4D, 0x4D, 0x00, 0x00, 0xBC, 0x61, 0x4E};
+    std::array<uint8_t,8> other = {0x4D, 0x4D, 0x4D, 0x00, 0x00, 0x00, 0x00, 0x01};
+
+    auto ic_of = [](std::vector<uint8_t> const& apdu) {
+        return static_cast<uint32_t>(apdu[3] << 24U | apdu[4] << 16U | apdu[5] << 8U | apdu[6]);
+    };
+
+    {
+        dlms::InvocationCounterStore store{path, 16, 16};
+        std::vector<dlms::Cosem> sessions(2);
+        for (auto &cosem : sessions) {
+            cosem.parameters.security = dlms::SecurityContext::AUTHENTICATION_ENCRYPTION;
+            cosem.parameters.system_title = title;
+            cosem.parameters.invocation_counters = &store;
+            cosem.parameters.invocation_counter_range = 2;
+        }
+
+        std::vector<uint32_t> counters;
+        for (auto i = 0; i < 3; ++i) {
+            for (auto &cosem : sessions) {
+                counters.push_back(ic_of(dlms::serialize_get_request(cosem, {dlms::ClassID::DATA, {"1.0.1.8.0.255"}, 2, {}})));
+            }
+        }
+        REQUIRE (counters == std::vector<uint32_t>{0, 2, 1, 3, 4, 6});
+        REQUIRE (store.reserve(other, 10) == 0);
+        store.advance(other, 100);
+        store.advance(other, 50);
+    }
+
+    //counters move to the limits written ahead of them, as if the last ones were lost in a crash
+    dlms::InvocationCounterStore reopened{path};
+    REQUIRE (reopened.reserve(title, 1) == 18);
+    REQUIRE (reopened.reserve(other, 1) == 100);
+
+    //free slots left claimed by a process that died while writing a title
+    std::array<uint8_t,8> third = {0x4D, 0x4D, 0x4D, 0x00, 0x00, 0x00, 0x00, 0x02};
+    {
+        std::fstream file{path, std::ios::in | std::ios::out | std::ios::binary};
+        for (auto slot = 1; slot <= 16; ++slot) {
+            uint8_t state = 0;
+            file.seekg(64 * slot);
+            file.read(reinterpret_cast<char*>(&state), 1);
+            if (state == 0) {
+                state = 1;
+                file.seekp(64 * slot);
+                file.write(reinterpret_cast<char*>(&state), 1);
+            }
+        }
+    }
+    REQUIRE (reopened.reserve(third, 1) == 0);
+    std::remove(path.c_str());
+}
+
+TEST_CASE( "Key store finds the keys of a server by its system title", "[keys]") {
+    dlms::KeyStore store{4};
+    auto title_of = [](uint32_t n) {
+        return std::array<uint8_t,8>{0x4D, 0x4D, 0x4D, 0x00, static_cast<uint8_t>(n >> 24U), static_cast<uint8_t>(n >> 16U),
+                                     static_cast<uint8_t>(n >> 8U), static_cast<uint8_t>(n)};
+    };
+    auto guek_of = [](uint32_t n) {
+        std::array<uint8_t,16> k{0};
+        k[0] = static_cast<uint8_t>(n);
+        k[1] = static_cast<uint8_t>(n >> 8U);
+        return k;
+    };
+
+    for (uint32_t n = 0; n < 1000; ++n) {
+        store.insert(title_of(n), guek_of(n), {});
+    }
+    REQUIRE (store.size() == 1000);
+    for (uint32_t n = 0; n < 1000; ++n) {
+        auto keys = store.find(title_of(n));
+        REQUIRE (keys != nullptr);
+        REQUIRE (keys->guek == guek_of(n));
+        REQUIRE (keys->cipher.keyed());
+    }
+    REQUIRE (store.find(title_of(1000)) == nullptr);
+
+    store.insert(title_of(7), guek_of(70000), {});
+    REQUIRE (store.find(title_of(7))->guek == guek_of(70000));
+    REQUIRE (store.erase(title_of(8)));
+    REQUIRE_FALSE (store.erase(title_of(8)));
+    REQUIRE (store.find(title_of(8)) == nullptr);
+    REQUIRE (store.find(title_of(9)) != nullptr);
+    REQUIRE (store.size() == 999);
+    store.reclaim();
+    REQUIRE (store.find(title_of(999))->guek == guek_of(999));
+}
+
+TEST_CASE( "Pushed general-glo-ciphering APDUs are deciphered with the keys of their sender", "[keys]") {
+    std::array<uint8_t,8> server_title = {0x4D, 0x4D, 0x4D, 0x00, 0x00, 0x00, 0x00, 0x01};
+    dlms::Cosem server{};
+    server.parameters.security = dlms::SecurityContext::AUTHENTICATION_ENCRYPTION;
+    server.parameters.system_title = server_title;
+    server.parameters.guek = key("000102030405060708090A0B0C0D0E0F");
+    server.parameters.ak = key("D0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF");
+
+    auto notification = hex("0F0000000100090401020304");
+    auto ciphered = notification;
+    dlms::Security::cipher(server, 0xDB, ciphered);
+    ciphered.insert(ciphered.begin() + 1, server_title.begin(), server_title.end());
+    ciphered.insert(ciphered.begin() + 1, 0x08);
+
+    dlms::KeyStore store;
+    REQUIRE_THROWS_AS (dlms::decipher_general_glo(store, ciphered), std::out_of_range);
+    store.insert(server_title, server.parameters.guek, server.parameters.ak);
+
+    auto tampered = ciphered;
+    tampered[tampered.size() - 20] ^= 0x01;
+    REQUIRE_THROWS_AS (dlms::decipher_general_glo(store, tampered), dlms::CosemAuthenticationError);
+
+    REQUIRE (dlms::decipher_general_glo(store, ciphered) == server_title);
+    REQUIRE (ciphered == notification);
+}
+
+TEST_CASE( "Batched AES-GCM decryption matches one message at a time", "[gcm]") {
+    for (auto hardware : {false, true}) {
+        std::vector<dlms::Gcm> ciphers;
+        for (uint8_t k = 0; k < 5; ++k) {
+            std::array<uint8_t,16> key_bytes{0};
+            key_bytes[0] = k;
+            key_bytes[15] = static_cast<uint8_t>(k * 31);
+            ciphers.emplace_back(key_bytes, hardware);
+        }
+
+        const size_t count = 37;
+        std::vector<std::vector<uint8_t>> plains(count), messages(count), tags(count), ivs(count), aads(count);
+        std::vector<dlms::GcmJob> jobs;
+        for (size_t i = 0; i < count; ++i) {
+            auto size = (i * 13) % 90;
+            for (size_t j = 0; j < size; ++j) {
+                plains[i].push_back(static_cast<uint8_t>(i + j * 7));
+            }
+            ivs[i] = std::vector<uint8_t>(12, static_cast<uint8_t>(i));
+            aads[i] = std::vector<uint8_t>(i % 3 == 0 ? 0 : 17, static_cast<uint8_t>(0x30 + i));
+            messages[i] = plains[i];
+            tags[i].resize(12);
+            auto const& gcm = ciphers[i % ciphers.size()];
+            gcm.encrypt(ivs[i].data(), aads[i].data(), aads[i].size(), messages[i].data(), messages[i].size(), tags[i].data(), 12);
+        }
+        messages[5][0] ^= 0x01;
+        tags[11][3] ^= 0x80;
+
+        for (size_t i = 0; i < count; ++i) {
+            jobs.push_back({&ciphers[i % ciphers.size()], ivs[i].data(), aads[i].data(), aads[i].size(),
+                            messages[i].data(), messages[i].size(), tags[i].data(), 12, false});
+        }
+        dlms::Gcm::decrypt_many(jobs.data(), jobs.size());
+
+        for (size_t i = 0; i < count; ++i) {
+            auto tampered = (i == 5 && !plains[i].empty()) || i == 11;
+            REQUIRE (jobs[i].valid == !tampered);
+            if (!tampered) {
+                REQUIRE (messages[i] == plains[i]);
+            }
+        }
+    }
+}
+
+TEST_CASE( "A burst of pushed APDUs is deciphered in one call", "[keys]") {
+    dlms::KeyStore store;
+    std::vector<std::vector<uint8_t>> plains, apdus;
+    for (uint8_t n = 0; n < 12; ++n) {
+        std::array<uint8_t,8> title = {0x4D, 0x4D, 0x4D, 0x00, 0x00, 0x00, 0x00, n};
+        dlms::Cosem server{};
+        server.parameters.security = n == 3 ? dlms::SecurityContext::AUTHENTICATION : dlms::SecurityContext::AUTHENTICATION_ENCRYPTION;
+        server.parameters.system_title = title;
+        server.parameters.guek = key("000102030405060708090A0B0C0D0E0F");
+        server.parameters.guek[0] = n;
+        server.parameters.ak = key("D0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF");
+        server.context.invocation_counter = 100U + n;
+        if (n != 7) {
+            store.insert(title, server.parameters.guek, server.parameters.ak);
+        }
+
+        auto plain = hex("0F0000000100090401020304");
+        plain.insert(plain.end(), n * 5U, n);
+        auto apdu = plain;
+        dlms::Security::cipher(server, 0xDB, apdu);
+        apdu.insert(apdu.begin() + 1, title.begin(), title.end());
+        apdu.insert(apdu.begin() + 1, 0x08);
+        plains.push_back(plain);
+        apdus.push_back(apdu);
+    }
+    apdus[9].back() ^= 0x01;
+    apdus[10].resize(6);
+
+    auto status = dlms::decipher_general_glo(store, apdus);
+    for (size_t n = 0; n < apdus.size(); ++n) {
+        switch (n) {
+            case 7:
+                REQUIRE (status[n] == dlms::DecipherStatus::UNKNOWN_SYSTEM_TITLE);
+                break;
+            case 9:
+                REQUIRE (status[n] == dlms::DecipherStatus::AUTHENTICATION_FAILED);
+                break;
+            case 10:
+                REQUIRE (status[n] == dlms::DecipherStatus::INVALID_FRAME);
+                break;
+            default:
+                REQUIRE (status[n] == dlms::DecipherStatus::OK);
+                REQUIRE (apdus[n] == plains[n]);
+        }
+    }
+}